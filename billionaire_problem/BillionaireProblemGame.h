@@ -19,7 +19,7 @@ namespace fbpcf::billionaire_problem {
  *
  * Alice and Bob wish to determine who has the greater net worth
  * (cash + stocks + property) without revealing their exact net worths to each
- * other.
+ * other. Every asset is a 32-bit value, the net worth is their 64-bit sum.
  *
  * Both parties will call `billionaireProblem()` simultaneously, passing in the
  * true value for their own assets and a dummy value for the other party's
@@ -32,8 +32,10 @@ namespace fbpcf::billionaire_problem {
  */
 template <int schedulerId, bool usingBatch>
 class BillionaireProblemGame : public frontend::MpcGame<schedulerId> {
+  // the assets are 32-bit, their sum is taken in 64 bits so a net worth
+  // above 2^32 doesn't wrap around
   using SecUnsignedInt = typename frontend::MpcGame<
-      schedulerId>::template SecUnsignedInt<32, usingBatch>;
+      schedulerId>::template SecUnsignedInt<64, usingBatch>;
 
  public:
   explicit BillionaireProblemGame(
@@ -48,6 +50,9 @@ class BillionaireProblemGame : public frontend::MpcGame<schedulerId> {
     AssetsType property;
   };
 
+  using WideAssetsType = typename std::
+      conditional<usingBatch, std::vector<uint64_t>, uint64_t>::type;
+
   using CompareResult =
       typename std::conditional<usingBatch, std::vector<bool>, bool>::type;
 
@@ -62,6 +67,8 @@ class BillionaireProblemGame : public frontend::MpcGame<schedulerId> {
 
     SecUnsignedInt getTotalValue();
 
+    static WideAssetsType widen(const AssetsType& assets);
+
    private:
     SecUnsignedInt cash_;
     SecUnsignedInt stock_;
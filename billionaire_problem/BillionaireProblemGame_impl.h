@@ -33,9 +33,20 @@ template <int schedulerId, bool usingBatch>
 BillionaireProblemGame<schedulerId, usingBatch>::SecAssetsLists::SecAssetsLists(
     const AssetsLists& assets,
     int partyId)
-    : cash_(assets.cash, partyId),
-      stock_(assets.stock, partyId),
-      property_(assets.property, partyId) {}
+    : cash_(widen(assets.cash), partyId),
+      stock_(widen(assets.stock), partyId),
+      property_(widen(assets.property), partyId) {}
+
+template <int schedulerId, bool usingBatch>
+typename BillionaireProblemGame<schedulerId, usingBatch>::WideAssetsType
+BillionaireProblemGame<schedulerId, usingBatch>::SecAssetsLists::widen(
+    const AssetsType& assets) {
+  if constexpr (usingBatch) {
+    return WideAssetsType(assets.begin(), assets.end());
+  } else {
+    return assets;
+  }
+}
 
 template <int schedulerId, bool usingBatch>
 typename BillionaireProblemGame<schedulerId, usingBatch>::SecUnsignedInt
@@ -64,7 +64,8 @@ std::pair<bool, uint64_t> runWithScheduler(
                              : game->billionaireProblem(dummyAssets, myAssets);
 
   uint64_t myTotalAssets;
-  myTotalAssets = myAssets.cash + myAssets.stock + myAssets.property;
+  myTotalAssets =
+      uint64_t(myAssets.cash) + myAssets.stock + myAssets.property;
 
   return {mpcResult, myTotalAssets};
 }
@@ -154,7 +155,7 @@ std::pair<std::vector<bool>, std::vector<uint64_t>> runBatchWithScheduler(
   std::vector<uint64_t> myTotalAssets(size);
   for (size_t i = 0; i < size; i++) {
     myTotalAssets[i] =
-        myAssets.cash[i] + myAssets.stock[i] + myAssets.property[i];
+        uint64_t(myAssets.cash[i]) + myAssets.stock[i] + myAssets.property[i];
   }
 
   return {mpcResult, myTotalAssets};
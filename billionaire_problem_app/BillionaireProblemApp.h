@@ -0,0 +1,122 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "../billionaire_problem/BillionaireProblemGame.h"
+#include "../demographic_metrics_app/ReadaheadReader.h"
+#include "fbpcf/engine/communication/IPartyCommunicationAgentFactory.h"
+#include "fbpcf/util/MetricCollector.h"
+
+namespace fbpcf::billionaire_problem {
+
+/**
+ * Production driver of BillionaireProblemGame: compares the net worth of
+ * every row of Alice's asset files with the same row of Bob's.
+ *
+ * Every app runs on one game thread with a scheduler of its own and
+ * processes a contiguous range of the shards, one after the other. The
+ * rows of a shard are compared in batches of batchSize rows through the
+ * batched game, the next shard is parsed while the current one is compared.
+ *
+ * Inputs are csv files with cash, stock and property columns (and an
+ * optional id_ column), row i of Alice's shard has to be the same entity as
+ * row i of Bob's. Alice writes one output row per input row with its id_ (or
+ * row index) and whether Bob's net worth is higher; Bob only learns the row
+ * counts and writes no output.
+ */
+template <int schedulerId>
+class BillionaireProblemApp {
+  using Game = BillionaireProblemGame<schedulerId, true>;
+
+ public:
+  using AssetsLists = typename Game::AssetsLists;
+
+  // One shard of a party's input
+  struct AssetsShard {
+    std::vector<std::string> ids;
+    AssetsLists assets;
+
+    size_t size() const {
+      return assets.cash.size();
+    }
+  };
+
+  BillionaireProblemApp(
+      int party,
+      std::unique_ptr<engine::communication::IPartyCommunicationAgentFactory>
+          communicationAgentFactory,
+      const std::vector<std::string>& inputPaths,
+      const std::vector<std::string>& outputPaths,
+      std::shared_ptr<fbpcf::util::MetricCollector> metricCollector,
+      size_t startFileIndex,
+      size_t numFiles,
+      size_t batchSize)
+      : party_(party),
+        communicationAgentFactory_(std::move(communicationAgentFactory)),
+        inputPaths_(inputPaths),
+        outputPaths_(outputPaths),
+        metricCollector_(std::move(metricCollector)),
+        startFileIndex_(startFileIndex),
+        numFiles_(numFiles),
+        batchSize_(batchSize) {}
+
+  // Compares every row of the shards of this app and writes the outputs
+  void run();
+
+  // Results of one shard, the comparison of row i is at position i. Only
+  // meaningful for Alice.
+  std::vector<bool> compareShard(const AssetsShard& myShard);
+
+  // Streams s3 and local inputs with readahead
+  void setReadahead(
+      const fbpcf::demographic_metrics::ReadaheadOptions& readahead) {
+    readahead_ = readahead;
+  }
+
+  AssetsShard getInputData(const std::string& inputPath) const;
+
+  void putOutputData(
+      const AssetsShard& myShard,
+      const std::vector<bool>& results,
+      const std::string& outputPath) const;
+
+  uint64_t getComparedRows() const {
+    return comparedRows_;
+  }
+
+ private:
+  // Throws if the other party's shard has a different row count, the
+  // batches of both parties have to be of the same size
+  void checkRowCount(size_t rowCount);
+
+  int party_;
+  std::unique_ptr<engine::communication::IPartyCommunicationAgentFactory>
+      communicationAgentFactory_;
+  std::vector<std::string> inputPaths_;
+  std::vector<std::string> outputPaths_;
+  std::shared_ptr<fbpcf::util::MetricCollector> metricCollector_;
+  size_t startFileIndex_;
+  size_t numFiles_;
+  size_t batchSize_;
+  fbpcf::demographic_metrics::ReadaheadOptions readahead_;
+  uint64_t comparedRows_ = 0;
+
+  std::unique_ptr<Game> game_;
+  // plaintext row counts, not part of the circuit
+  std::unique_ptr<engine::communication::IPartyCommunicationAgent>
+      rowCountAgent_;
+};
+
+} // namespace fbpcf::billionaire_problem
+
+#include "./BillionaireProblemApp_impl.h"
@@ -0,0 +1,212 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <cstring>
+#include <future>
+#include <sstream>
+#include <stdexcept>
+
+#include "../demographic_metrics_app/CpuAffinity.h"
+#include "../demographic_metrics_app/Csv.h"
+#include "./BillionaireProblemApp.h"
+#include "fbpcf/scheduler/LazySchedulerFactory.h"
+#include "fbpcf/scheduler/SchedulerHelper.h"
+#include "folly/logging/xlog.h"
+
+namespace fbpcf::billionaire_problem {
+
+template <int schedulerId>
+void BillionaireProblemApp<schedulerId>::run() {
+  game_ = std::make_unique<Game>(
+      fbpcf::scheduler::getLazySchedulerFactoryWithRealEngine(
+          party_, *communicationAgentFactory_, metricCollector_)
+          ->create());
+
+  auto endFileIndex = std::min(startFileIndex_ + numFiles_, inputPaths_.size());
+  auto readInput = [this](size_t i) {
+    return std::async(std::launch::async, [this, i]() {
+      fbpcf::demographic_metrics::releaseHelperThread();
+      return getInputData(inputPaths_.at(i));
+    });
+  };
+
+  // the next shard is parsed while the current one is compared
+  std::future<AssetsShard> nextInput;
+  for (auto i = startFileIndex_; i < endFileIndex; ++i) {
+    try {
+      auto myShard = nextInput.valid() ? nextInput.get() : readInput(i).get();
+      if (i + 1 < endFileIndex) {
+        nextInput = readInput(i + 1);
+      }
+
+      auto results = compareShard(myShard);
+      if (party_ == 0) {
+        putOutputData(myShard, results, outputPaths_.at(i));
+      }
+    } catch (const std::exception& e) {
+      XLOGF(
+          ERR,
+          "Error: Exception caught in BillionaireProblemApp run.\n \t error msg: {} \n \t input shard: {}.",
+          e.what(),
+          inputPaths_.at(i));
+      std::exit(1);
+    }
+  }
+
+  auto gateStatistics =
+      fbpcf::scheduler::SchedulerKeeper<schedulerId>::getGateStatistics();
+  auto trafficStatistics =
+      fbpcf::scheduler::SchedulerKeeper<schedulerId>::getTrafficStatistics();
+  XLOGF(
+      INFO,
+      "Compared {} rows. Non-free gate count = {}, Free gate count = {}, Sent network traffic = {}, Received network traffic = {}",
+      comparedRows_,
+      gateStatistics.first,
+      gateStatistics.second,
+      trafficStatistics.first,
+      trafficStatistics.second);
+  game_.reset();
+  fbpcf::scheduler::SchedulerKeeper<schedulerId>::deleteEngine();
+}
+
+template <int schedulerId>
+std::vector<bool> BillionaireProblemApp<schedulerId>::compareShard(
+    const AssetsShard& myShard) {
+  auto numRows = myShard.size();
+  checkRowCount(numRows);
+
+  std::vector<bool> results;
+  results.reserve(numRows);
+  for (size_t begin = 0; begin < numRows; begin += batchSize_) {
+    auto end = std::min(begin + batchSize_, numRows);
+    auto slice = [begin, end](const std::vector<uint32_t>& column) {
+      return std::vector<uint32_t>(column.begin() + begin, column.begin() + end);
+    };
+    AssetsLists myAssets = {
+        .cash = slice(myShard.assets.cash),
+        .stock = slice(myShard.assets.stock),
+        .property = slice(myShard.assets.property),
+    };
+    AssetsLists dummyAssets = {
+        .cash = std::vector<uint32_t>(end - begin),
+        .stock = std::vector<uint32_t>(end - begin),
+        .property = std::vector<uint32_t>(end - begin),
+    };
+
+    auto batchResults = party_ == 0
+        ? game_->billionaireProblem(myAssets, dummyAssets)
+        : game_->billionaireProblem(dummyAssets, myAssets);
+    results.insert(results.end(), batchResults.begin(), batchResults.end());
+    comparedRows_ += end - begin;
+  }
+  return results;
+}
+
+template <int schedulerId>
+void BillionaireProblemApp<schedulerId>::checkRowCount(size_t rowCount) {
+  if (!rowCountAgent_) {
+    rowCountAgent_ = communicationAgentFactory_->create(1 - party_, "row_count");
+  }
+  uint64_t myCount = rowCount;
+  std::vector<unsigned char> message(sizeof(myCount));
+  std::memcpy(message.data(), &myCount, sizeof(myCount));
+
+  std::vector<unsigned char> received;
+  if (party_ == 0) {
+    rowCountAgent_->send(message);
+    received = rowCountAgent_->receive(sizeof(myCount));
+  } else {
+    received = rowCountAgent_->receive(sizeof(myCount));
+    rowCountAgent_->send(message);
+  }
+  uint64_t theirCount;
+  std::memcpy(&theirCount, received.data(), sizeof(theirCount));
+  if (theirCount != myCount) {
+    throw std::invalid_argument(
+        "The shards of the parties have " + std::to_string(myCount) +
+        " and " + std::to_string(theirCount) + " rows");
+  }
+}
+
+template <int schedulerId>
+typename BillionaireProblemApp<schedulerId>::AssetsShard
+BillionaireProblemApp<schedulerId>::getInputData(
+    const std::string& inputPath) const {
+  XLOG(INFO) << "Parsing input from " << inputPath;
+  AssetsShard shard;
+
+  // positions of the columns in the header
+  int idColumn = -1;
+  int cashColumn = -1;
+  int stockColumn = -1;
+  int propertyColumn = -1;
+  auto processHeader = [&](const std::vector<std::string>& header) {
+    for (size_t i = 0; i < header.size(); ++i) {
+      if (header[i] == "id_") {
+        idColumn = i;
+      } else if (header[i] == "cash") {
+        cashColumn = i;
+      } else if (header[i] == "stock") {
+        stockColumn = i;
+      } else if (header[i] == "property") {
+        propertyColumn = i;
+      }
+    }
+    if (cashColumn < 0 || stockColumn < 0 || propertyColumn < 0) {
+      XLOG(FATAL) << "Input file " << inputPath
+                  << " needs cash, stock and property columns";
+    }
+  };
+
+  auto parse = [&inputPath](const std::string& value) {
+    uint32_t parsed = 0;
+    std::istringstream iss{value};
+    iss >> parsed;
+    if (iss.fail()) {
+      XLOG(FATAL) << "Failed to parse '" << value << "' to uint32_t in "
+                  << inputPath;
+    }
+    return parsed;
+  };
+  auto readLine = [&](const std::vector<std::string>& /* header */,
+                      const std::vector<std::string>& parts) {
+    shard.assets.cash.push_back(parse(parts.at(cashColumn)));
+    shard.assets.stock.push_back(parse(parts.at(stockColumn)));
+    shard.assets.property.push_back(parse(parts.at(propertyColumn)));
+    if (idColumn >= 0) {
+      shard.ids.push_back(parts.at(idColumn));
+    }
+  };
+
+  if (!fbpcf::demographic_metrics::readCsv(
+          inputPath, readLine, processHeader, readahead_)) {
+    XLOG(FATAL) << "Failed to read input file " << inputPath;
+  }
+  return shard;
+}
+
+template <int schedulerId>
+void BillionaireProblemApp<schedulerId>::putOutputData(
+    const AssetsShard& myShard,
+    const std::vector<bool>& results,
+    const std::string& outputPath) const {
+  XLOG(INFO) << "Writing " << results.size() << " results to " << outputPath;
+  std::vector<std::vector<std::string>> rows;
+  rows.reserve(results.size());
+  for (size_t i = 0; i < results.size(); ++i) {
+    rows.push_back(
+        {myShard.ids.empty() ? std::to_string(i) : myShard.ids.at(i),
+         results[i] ? "1" : "0"});
+  }
+  fbpcf::demographic_metrics::writeCsv(
+      outputPath, {"id_", "bob_is_richer"}, rows);
+}
+
+} // namespace fbpcf::billionaire_problem
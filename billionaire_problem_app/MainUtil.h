@@ -0,0 +1,169 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <filesystem>
+#include <future>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "folly/String.h"
+#include "folly/logging/xlog.h"
+
+#include "../demographic_metrics_app/CpuAffinity.h" //@manual
+#include "./BillionaireProblemApp.h" //@manual
+#include "fbpcf/engine/communication/SocketPartyCommunicationAgentFactory.h"
+
+namespace fbpcf::billionaire_problem {
+
+// Options of the game threads, set from the command line
+struct AppOptions {
+  size_t batchSize = 1 << 20;
+  bool pinThreads = false;
+  fbpcf::demographic_metrics::ReadaheadOptions readahead;
+};
+
+inline std::pair<std::vector<std::string>, std::vector<std::string>>
+getIOFilepaths(
+    const std::string& inputBasePath,
+    const std::string& outputBasePath,
+    const std::string& inputDirectory,
+    const std::string& outputDirectory,
+    const std::string& inputFilenames,
+    const std::string& outputFilenames,
+    int32_t numFiles,
+    int32_t fileStartIndex) {
+  std::vector<std::string> inputFilepaths;
+  std::vector<std::string> outputFilepaths;
+
+  if (!inputBasePath.empty()) {
+    for (auto i = fileStartIndex; i < fileStartIndex + numFiles; ++i) {
+      inputFilepaths.push_back(inputBasePath + "_" + std::to_string(i));
+      outputFilepaths.push_back(outputBasePath + "_" + std::to_string(i));
+    }
+  } else {
+    std::filesystem::path inputDir{inputDirectory};
+    std::filesystem::path outputDir{outputDirectory};
+
+    std::vector<std::string> inputFilenamesVector;
+    folly::split(',', inputFilenames, inputFilenamesVector);
+    std::vector<std::string> outputFilenamesVector;
+    folly::split(',', outputFilenames, outputFilenamesVector);
+
+    CHECK_EQ(inputFilenamesVector.size(), outputFilenamesVector.size())
+        << "Error: input_filenames and output_filenames have unequal sizes";
+
+    for (size_t i = 0; i < inputFilenamesVector.size(); ++i) {
+      inputFilepaths.push_back(inputDir / inputFilenamesVector[i]);
+      outputFilepaths.push_back(outputDir / outputFilenamesVector[i]);
+    }
+  }
+  return std::make_pair(inputFilepaths, outputFilepaths);
+}
+
+// Starts an app per game thread, each on a range of the shards. Returns the
+// number of rows compared.
+template <int PARTY, int index>
+inline uint64_t startBillionaireAppsForShardedFilesHelper(
+    size_t startFileIndex,
+    size_t remainingThreads,
+    const std::string& serverIp,
+    int port,
+    const std::vector<std::string>& inputFilepaths,
+    const std::vector<std::string>& outputFilepaths,
+    fbpcf::engine::communication::SocketPartyCommunicationAgent::TlsInfo&
+        tlsInfo,
+    const AppOptions& options) {
+  // split files evenly across threads
+  auto remainingFiles = inputFilepaths.size() - startFileIndex;
+  if (remainingFiles == 0) {
+    return 0;
+  }
+  size_t numFiles =
+      remainingThreads > remainingFiles ? 1 : remainingFiles / remainingThreads;
+
+  std::map<
+      int,
+      fbpcf::engine::communication::SocketPartyCommunicationAgentFactory::
+          PartyInfo>
+      partyInfos(
+          {{0, {serverIp, port + index * 100}},
+           {1, {serverIp, port + index * 100}}});
+  auto metricCollector = std::make_shared<fbpcf::util::MetricCollector>(
+      "billionaire_problem_for_thread_" + std::to_string(index));
+  auto communicationAgentFactory = std::make_unique<
+      fbpcf::engine::communication::SocketPartyCommunicationAgentFactory>(
+      PARTY, partyInfos, tlsInfo, metricCollector);
+
+  // Alice uses even scheduler ids and Bob odd ones
+  auto app = std::make_unique<BillionaireProblemApp<2 * index + PARTY>>(
+      PARTY,
+      std::move(communicationAgentFactory),
+      inputFilepaths,
+      outputFilepaths,
+      metricCollector,
+      startFileIndex,
+      numFiles,
+      options.batchSize);
+  app->setReadahead(options.readahead);
+
+  auto future = std::async(std::launch::async, [&app, &options]() {
+    if (options.pinThreads) {
+      fbpcf::demographic_metrics::pinGameThread(index);
+    }
+    app->run();
+  });
+
+  // the scheduler id is a template parameter, so the apps are constructed
+  // recursively
+  uint64_t comparedRows = 0;
+  if constexpr (index < 64) {
+    if (remainingThreads > 1) {
+      comparedRows +=
+          startBillionaireAppsForShardedFilesHelper<PARTY, index + 1>(
+              startFileIndex + numFiles,
+              remainingThreads - 1,
+              serverIp,
+              port,
+              inputFilepaths,
+              outputFilepaths,
+              tlsInfo,
+              options);
+    }
+  }
+  future.get();
+  return comparedRows + app->getComparedRows();
+}
+
+template <int PARTY>
+inline uint64_t startBillionaireAppsForShardedFiles(
+    const std::vector<std::string>& inputFilepaths,
+    const std::vector<std::string>& outputFilepaths,
+    int16_t concurrency,
+    const std::string& serverIp,
+    int port,
+    fbpcf::engine::communication::SocketPartyCommunicationAgent::TlsInfo&
+        tlsInfo,
+    const AppOptions& options) {
+  // use only as many threads as the number of files
+  auto numThreads = std::min(
+      static_cast<size_t>(concurrency), inputFilepaths.size());
+  return startBillionaireAppsForShardedFilesHelper<PARTY, 0>(
+      0,
+      numThreads,
+      serverIp,
+      port,
+      inputFilepaths,
+      outputFilepaths,
+      tlsInfo,
+      options);
+}
+
+} // namespace fbpcf::billionaire_problem
@@ -0,0 +1,180 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <gflags/gflags.h>
+#include <glog/logging.h>
+#include <signal.h>
+#include <sstream>
+#include <string>
+
+#include "folly/init/Init.h"
+#include "folly/logging/xlog.h"
+
+#include <fbpcf/aws/AwsSdk.h>
+#include "./MainUtil.h" // @manual
+
+DEFINE_int32(party, 1, "1 = Alice, 2 = Bob");
+DEFINE_string(server_ip, "127.0.0.1", "Server's IP Address");
+DEFINE_int32(
+    port,
+    10000,
+    "Network port for establishing connection to other player");
+DEFINE_string(
+    input_directory,
+    "",
+    "Data directory where input files are located");
+DEFINE_string(
+    input_filenames,
+    "in.csv_0[,in.csv_1,in.csv_2,...]",
+    "List of input file names with cash, stock and property columns (and optionally id_), with a header");
+DEFINE_string(
+    output_directory,
+    "",
+    "Local or s3 path where output files are written to");
+DEFINE_string(
+    output_filenames,
+    "out.csv_0[,out.csv_1,out.csv_2,...]",
+    "List of output file names that correspond to input filenames (positionally). Only Alice writes outputs");
+DEFINE_string(
+    input_base_path,
+    "",
+    "Local or s3 base path for the sharded input files");
+DEFINE_string(
+    output_base_path,
+    "",
+    "Local or s3 base path where output files are written to");
+DEFINE_int32(
+    file_start_index,
+    0,
+    "First file that will be read with base path");
+DEFINE_int32(num_files, 0, "Number of files that should be read");
+DEFINE_int32(
+    concurrency,
+    1,
+    "Number of game threads, each with its own scheduler and a range of the files");
+DEFINE_int64(
+    batch_size,
+    1 << 20,
+    "Number of rows compared in one batch");
+DEFINE_bool(
+    pin_threads,
+    false,
+    "Pin every game thread to its own core, filling one NUMA node before the next");
+DEFINE_int32(
+    readahead_chunk_mb,
+    0,
+    "Stream s3 and local inputs in chunks of this many MB, fetched in parallel ahead of the parser. 0 reads the inputs with a plain FileReader");
+DEFINE_int32(
+    readahead_connections,
+    4,
+    "Number of chunks of an input fetched in parallel with --readahead_chunk_mb");
+DEFINE_bool(
+    use_tls,
+    false,
+    "Whether to use TLS when communicating with other parties.");
+DEFINE_string(
+    ca_cert_path,
+    "",
+    "Relative file path where root CA cert is stored. It will be prefixed with $HOME.");
+DEFINE_string(
+    server_cert_path,
+    "",
+    "Relative file path where server cert is stored. It will be prefixed with $HOME.");
+DEFINE_string(
+    private_key_path,
+    "",
+    "Relative file path where private key is stored. It will be prefixed with $HOME.");
+
+int main(int argc, char** argv) {
+  folly::init(&argc, &argv);
+  gflags::ParseCommandLineFlags(&argc, &argv, true);
+
+  fbpcf::AwsSdk::aquire();
+
+  int16_t concurrency = static_cast<int16_t>(FLAGS_concurrency);
+  CHECK_GT(concurrency, 0) << "--concurrency has to be positive";
+  CHECK_LE(concurrency, 64) << "--concurrency can be at most 64";
+  CHECK_GT(FLAGS_batch_size, 0) << "--batch_size has to be positive";
+
+  signal(SIGPIPE, SIG_IGN);
+
+  auto filepaths = fbpcf::billionaire_problem::getIOFilepaths(
+      FLAGS_input_base_path,
+      FLAGS_output_base_path,
+      FLAGS_input_directory,
+      FLAGS_output_directory,
+      FLAGS_input_filenames,
+      FLAGS_output_filenames,
+      FLAGS_num_files,
+      FLAGS_file_start_index);
+  auto inputFilepaths = filepaths.first;
+  auto outputFilepaths = filepaths.second;
+
+  auto tlsInfo = fbpcf::engine::communication::getTlsInfoFromArgs(
+      FLAGS_use_tls,
+      FLAGS_ca_cert_path,
+      FLAGS_server_cert_path,
+      FLAGS_private_key_path,
+      "");
+
+  {
+    std::ostringstream inputFileLogList;
+    for (const auto& inputFilepath : inputFilepaths) {
+      inputFileLogList << "\t\t" << inputFilepath << "\n";
+    }
+    std::ostringstream outputFileLogList;
+    for (const auto& outputFilepath : outputFilepaths) {
+      outputFileLogList << "\t\t" << outputFilepath << "\n";
+    }
+    XLOG(INFO) << "Running billionaire problem with settings:\n"
+               << "\tparty: " << FLAGS_party << "\n"
+               << "\tserver_ip_address: " << FLAGS_server_ip << "\n"
+               << "\tport: " << FLAGS_port << "\n"
+               << "\tconcurrency: " << FLAGS_concurrency << "\n"
+               << "\tbatch size: " << FLAGS_batch_size << "\n"
+               << "\tinput: " << inputFileLogList.str()
+               << "\toutput: " << outputFileLogList.str();
+  }
+
+  fbpcf::billionaire_problem::AppOptions options;
+  options.batchSize = FLAGS_batch_size;
+  options.pinThreads = FLAGS_pin_threads;
+  options.readahead.chunkSize = size_t(FLAGS_readahead_chunk_mb) << 20;
+  options.readahead.connections = FLAGS_readahead_connections;
+
+  FLAGS_party--; // subtract 1 because we use 0 and 1 for Alice and Bob
+                 // instead of 1 and 2
+  uint64_t comparedRows = 0;
+  if (FLAGS_party == 0) {
+    XLOG(INFO) << "Starting as Alice, will wait for Bob...";
+    comparedRows =
+        fbpcf::billionaire_problem::startBillionaireAppsForShardedFiles<0>(
+            inputFilepaths,
+            outputFilepaths,
+            concurrency,
+            FLAGS_server_ip,
+            FLAGS_port,
+            tlsInfo,
+            options);
+  } else if (FLAGS_party == 1) {
+    XLOG(INFO) << "Starting as Bob, will wait for Alice...";
+    comparedRows =
+        fbpcf::billionaire_problem::startBillionaireAppsForShardedFiles<1>(
+            inputFilepaths,
+            outputFilepaths,
+            concurrency,
+            FLAGS_server_ip,
+            FLAGS_port,
+            tlsInfo,
+            options);
+  } else {
+    XLOGF(FATAL, "Invalid Party: {}", FLAGS_party);
+  }
+
+  XLOGF(INFO, "Compared {} rows", comparedRows);
+  return 0;
+}
@@ -0,0 +1,197 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "../BillionaireProblemApp.h"
+#include <gtest/gtest.h>
+#include <unistd.h>
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <future>
+#include <memory>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "fbpcf/engine/communication/test/AgentFactoryCreationHelper.h"
+#include "fbpcf/util/MetricCollector.h"
+
+namespace fbpcf::billionaire_problem {
+
+// One row of a party's input
+struct Assets {
+  uint32_t cash;
+  uint32_t stock;
+  uint32_t property;
+
+  uint64_t total() const {
+    return uint64_t(cash) + stock + property;
+  }
+};
+
+class BillionaireProblemAppTest : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    directory_ = std::filesystem::temp_directory_path() /
+        ("billionaire_problem_app_test_" + std::to_string(::getpid()));
+    std::filesystem::create_directories(directory_);
+  }
+
+  void TearDown() override {
+    std::filesystem::remove_all(directory_);
+  }
+
+  std::string writeInput(
+      const std::string& name,
+      const std::vector<Assets>& rows) {
+    auto path = (directory_ / (name + ".csv")).string();
+    std::ofstream file(path);
+    file << "id_,cash,stock,property\n";
+    for (size_t i = 0; i < rows.size(); ++i) {
+      file << "row" << i << "," << rows[i].cash << "," << rows[i].stock << ","
+           << rows[i].property << "\n";
+    }
+    return path;
+  }
+
+  // bob_is_richer of every row of an output of alice
+  std::vector<bool> readOutput(const std::string& path) {
+    std::ifstream file(path);
+    std::string line;
+    std::getline(file, line);
+    EXPECT_EQ(line, "id_,bob_is_richer");
+    std::vector<bool> results;
+    while (std::getline(file, line)) {
+      auto separator = line.find(',');
+      EXPECT_EQ(
+          line.substr(0, separator), "row" + std::to_string(results.size()));
+      results.push_back(line.substr(separator + 1) == "1");
+    }
+    return results;
+  }
+
+  // Runs alice's and bob's app on threads of their own over the shards
+  void runApps(
+      const std::vector<std::string>& aliceInputs,
+      const std::vector<std::string>& bobInputs,
+      const std::vector<std::string>& outputs,
+      size_t batchSize) {
+    auto factories = engine::communication::getInMemoryAgentFactory(2);
+    auto alice = std::make_unique<BillionaireProblemApp<0>>(
+        0,
+        std::move(factories[0]),
+        aliceInputs,
+        outputs,
+        std::make_shared<fbpcf::util::MetricCollector>("alice_test"),
+        0,
+        aliceInputs.size(),
+        batchSize);
+    auto bob = std::make_unique<BillionaireProblemApp<1>>(
+        1,
+        std::move(factories[1]),
+        bobInputs,
+        // bob writes no output
+        outputs,
+        std::make_shared<fbpcf::util::MetricCollector>("bob_test"),
+        0,
+        bobInputs.size(),
+        batchSize);
+
+    auto bobRun = std::async(std::launch::async, [&bob]() { bob->run(); });
+    alice->run();
+    bobRun.get();
+    EXPECT_EQ(alice->getComparedRows(), bob->getComparedRows());
+  }
+
+  std::vector<Assets> randomAssets(std::mt19937_64& e, size_t size) {
+    std::uniform_int_distribution<uint32_t> dist(0, 0xFFFFFFFF);
+    std::vector<Assets> rows(size);
+    for (auto& row : rows) {
+      row = {dist(e), dist(e), dist(e)};
+    }
+    return rows;
+  }
+
+  void expectResults(
+      const std::vector<Assets>& aliceRows,
+      const std::vector<Assets>& bobRows,
+      const std::vector<bool>& results) {
+    ASSERT_EQ(results.size(), aliceRows.size());
+    for (size_t i = 0; i < results.size(); ++i) {
+      EXPECT_EQ(results[i], aliceRows[i].total() < bobRows[i].total())
+          << "row " << i;
+    }
+  }
+
+  std::filesystem::path directory_;
+};
+
+TEST_F(BillionaireProblemAppTest, testBatchesNotDividingTheShards) {
+  std::mt19937_64 e(42);
+  // 10 and 7 rows in batches of 3, the next shard is read during the first
+  std::vector<std::vector<Assets>> aliceRows = {
+      randomAssets(e, 10), randomAssets(e, 7)};
+  std::vector<std::vector<Assets>> bobRows = {
+      randomAssets(e, 10), randomAssets(e, 7)};
+  std::vector<std::string> aliceInputs;
+  std::vector<std::string> bobInputs;
+  std::vector<std::string> outputs;
+  for (size_t i = 0; i < aliceRows.size(); ++i) {
+    aliceInputs.push_back(
+        writeInput("alice_" + std::to_string(i), aliceRows[i]));
+    bobInputs.push_back(writeInput("bob_" + std::to_string(i), bobRows[i]));
+    outputs.push_back((directory_ / ("out_" + std::to_string(i))).string());
+  }
+
+  runApps(aliceInputs, bobInputs, outputs, 3);
+  for (size_t i = 0; i < aliceRows.size(); ++i) {
+    expectResults(aliceRows[i], bobRows[i], readOutput(outputs[i]));
+  }
+}
+
+TEST_F(BillionaireProblemAppTest, testNetWorthAbove32Bits) {
+  // alice's total wraps around to less than bob's mod 2^32
+  std::vector<Assets> aliceRows = {
+      {3'000'000'000, 3'000'000'000, 0}, {0xFFFFFFFF, 0xFFFFFFFF, 0xFFFFFFFF}};
+  std::vector<Assets> bobRows = {
+      {4'000'000'000, 0, 0}, {0xFFFFFFFF, 0xFFFFFFFF, 0xFFFFFFFE}};
+  auto output = (directory_ / "out").string();
+
+  runApps(
+      {writeInput("alice", aliceRows)},
+      {writeInput("bob", bobRows)},
+      {output},
+      16);
+  auto results = readOutput(output);
+  expectResults(aliceRows, bobRows, results);
+  EXPECT_EQ(results, std::vector<bool>({false, false}));
+}
+
+TEST_F(BillionaireProblemAppTest, testRowCountMismatch) {
+  auto factories = engine::communication::getInMemoryAgentFactory(2);
+  BillionaireProblemApp<0> alice(
+      0, std::move(factories[0]), {}, {}, nullptr, 0, 0, 16);
+  BillionaireProblemApp<1> bob(
+      1, std::move(factories[1]), {}, {}, nullptr, 0, 0, 16);
+
+  // both parties refuse before any batch is compared
+  auto zeros = [](size_t size) {
+    return std::vector<uint32_t>(size);
+  };
+  BillionaireProblemApp<0>::AssetsShard aliceShard;
+  aliceShard.assets = {zeros(5), zeros(5), zeros(5)};
+  BillionaireProblemApp<1>::AssetsShard bobShard;
+  bobShard.assets = {zeros(4), zeros(4), zeros(4)};
+
+  auto bobCompare = std::async(
+      std::launch::async, [&]() { return bob.compareShard(bobShard); });
+  EXPECT_THROW(alice.compareShard(aliceShard), std::invalid_argument);
+  EXPECT_THROW(bobCompare.get(), std::invalid_argument);
+}
+
+} // namespace fbpcf::billionaire_problem
@@ -3,7 +3,19 @@
 #include <sys/types.h>
 #include <type_traits>
 #include "fbpcf/frontend/mpcGame.h"
+#include <cmath>
+#include <limits>
+#include <map>
+#include <optional>
+#include <stdexcept>
+#include <string>
 #include <tuple>
+#include <vector>
+
+#include "./GroupBySpec.h"
+#include "./PartialAggregates.h"
+#include "./TraceRecorder.h"
+#include "./ValidationSpec.h"
 
 namespace fbpcf::demographic_metrics {
 
@@ -13,10 +25,16 @@ class DemographicMetricsGame : public frontend::MpcGame<schedulerId> {
       schedulerId>::template SecUnsignedInt<32, true>;
   using SecBool = typename frontend::MpcGame<
       schedulerId>::template SecBit<true>;
+  using SecUnsignedInt64 = typename frontend::MpcGame<
+      schedulerId>::template SecUnsignedInt<64, true>;
   using SecUnsignedIntSingle = typename frontend::MpcGame<
       schedulerId>::template SecUnsignedInt<32, false>;
   using PubValue = typename fbpcf::frontend::MpcGame<
       schedulerId>::template PubUnsignedInt<32, false>;
+  using PubUnsignedInt = typename frontend::MpcGame<
+      schedulerId>::template PubUnsignedInt<32, true>;
+  using PubUnsignedInt64 = typename frontend::MpcGame<
+      schedulerId>::template PubUnsignedInt<64, true>;
 
 
 public:
@@ -24,12 +42,161 @@ public:
         std::unique_ptr<scheduler::IScheduler> scheduler)
         : frontend::MpcGame<schedulerId>(std::move(scheduler)) {}
 
+    // Secret columns are cached per shard: between beginShard and endShard
+    // every column is secret-input and combined (aliceShare + bobShare) once,
+    // however many metrics use it. Without an active shard nothing is cached.
+    // A shard key seen before (e.g. a retried shard) starts from scratch.
+    void beginShard(const std::string& shardKey) {
+        currentShard_ = shardKey;
+        secretColumns_.erase(currentShard_);
+    }
+
+    void endShard() {
+        secretColumns_.erase(currentShard_);
+        currentShard_.clear();
+    }
+
+    // Ends the shard when it goes out of scope, also if a metric throws
+    class ShardScope {
+     public:
+        ShardScope(DemographicMetricsGame& game, const std::string& shardKey)
+            : game_(game) {
+            game_.beginShard(shardKey);
+        }
+
+        ~ShardScope() {
+            game_.endShard();
+        }
+
+        ShardScope(const ShardScope&) = delete;
+        ShardScope& operator=(const ShardScope&) = delete;
+
+     private:
+        DemographicMetricsGame& game_;
+    };
+
+    // Enables trace events for metrics and reveals, pass nullptr to disable
+    void setTraceRecorder(std::shared_ptr<TraceRecorder> traceRecorder) {
+        traceRecorder_ = std::move(traceRecorder);
+    }
+
+    struct MinMaxResult {
+        uint32_t minAge;
+        uint32_t maxAge;
+        uint32_t minWealth;
+        uint32_t maxWealth;
+    };
+
+    // Sums for the covariance and correlation of age and wealth, computed
+    // mod 2^64 since the wealth squares don't fit in 32 bits
+    struct AgeWealthMoments {
+        uint64_t count;
+        uint64_t sumAge;
+        uint64_t sumWealth;
+        uint64_t sumAgeSquared;
+        uint64_t sumWealthSquared;
+        uint64_t sumAgeWealth;
+
+        // 0 without rows
+        double wealthAverage() const {
+            if (count == 0) {
+                return 0;
+            }
+            return (long double)sumWealth / count;
+        }
+
+        // Unbiased estimators, 0 with fewer than two rows (e.g. when all the
+        // rows of a shard fail validation) instead of a NaN the json output
+        // can't hold
+        double wealthVariance() const {
+            if (count < 2) {
+                return 0;
+            }
+            return (sumWealthSquared - (long double)sumWealth * sumWealth / count) /
+                (count - 1);
+        }
+
+        double covariance() const {
+            if (count < 2) {
+                return 0;
+            }
+            return (sumAgeWealth - (long double)sumAge * sumWealth / count) /
+                (count - 1);
+        }
+
+        // Pearson correlation coefficient, 0 if either column is constant
+        double correlation() const {
+            long double n = count;
+            auto covariance = n * sumAgeWealth - (long double)sumAge * sumWealth;
+            auto ageVariance = n * sumAgeSquared - (long double)sumAge * sumAge;
+            auto wealthVariance =
+                n * sumWealthSquared - (long double)sumWealth * sumWealth;
+            if (ageVariance <= 0 || wealthVariance <= 0) {
+                return 0;
+            }
+            return covariance / std::sqrt(ageVariance * wealthVariance);
+        }
+    };
+
+    // Additive shares mod 2^32 of the columns
     struct DemographicInfo {
         std::vector<uint32_t> ageShare;
-        std::vector<bool> genderShare;
+        std::vector<uint32_t> genderShare;
         std::vector<uint32_t> wealthShare;
+        // extra categorical columns by name, for group by
+        std::map<std::string, std::vector<uint32_t>> categoryShares;
+        // the id_ column in plaintext, only loaded for the private join and
+        // never secret-input
+        std::vector<std::string> ids;
     };
 
+    // Per category row counts and sums of a group by, revealed to alice
+    struct GroupAggregates {
+        std::vector<uint64_t> counts;
+        std::vector<uint64_t> sums;
+
+        // 0 for the categories without rows
+        std::vector<double> averages() const {
+            std::vector<double> averages;
+            for (size_t i = 0; i < counts.size(); ++i) {
+                averages.push_back(
+                    counts.at(i) == 0 ? 0 : sums.at(i) / double(counts.at(i)));
+            }
+            return averages;
+        }
+    };
+
+    // Share conversions. The inputs are additive shares mod 2^32 (arithmetic
+    // domain) while the frontend computes on XOR shared bits (boolean
+    // domain). Sums are computed locally in the arithmetic domain, only
+    // comparisons, muxes and products pay for boolean circuits.
+
+    // A2B: one batched 32-bit adder over the shares of both parties
+    SecUnsignedInt a2b(
+        const std::vector<uint32_t>& aliceShares,
+        const std::vector<uint32_t>& bobShares);
+
+    // A2B of 0/1 values: the low bits of their additive shares are already
+    // XOR shares, so no gates are needed
+    SecBool a2bBit(
+        const std::vector<uint32_t>& aliceShares,
+        const std::vector<uint32_t>& bobShares);
+
+    // B2A: bob's random masks become his shares and the value minus the
+    // masks is opened to alice as hers. Each party only gets meaningful
+    // values in its own vector.
+    void b2a(
+        const SecUnsignedInt& value,
+        std::vector<uint32_t>& aliceShares,
+        std::vector<uint32_t>& bobShares);
+
+    // This party's additive share of the sum of a column, without any gates.
+    // One of the two databases is the zero dummy of the other party, so the
+    // sum of both columns is this party's share.
+    static uint32_t arithmeticSum(
+        const std::vector<uint32_t>& aliceShares,
+        const std::vector<uint32_t>& bobShares);
+
     // Returns the average age of the two databases
     float demographicMetricsAverage(
         const DemographicInfo& aliceDatabase,
@@ -40,16 +207,28 @@ public:
         const DemographicInfo& aliceDatabase,
         const DemographicInfo& bobDatabase);
 
-    // Mutates the databases to remove invalid entries
+    // Checks every row against the spec in one batched circuit, the
+    // predicates of all the rules are ANDed into one validity bit per row.
+    // Normally the validity bits are revealed and the databases are mutated
+    // to remove invalid entries. In oblivious mode nothing is revealed: the
+    // validity bits stay secret until endShard, and average, variance,
+    // histogram and partial aggregates only count the valid rows.
+    // Returns the number of rows kept.
     int demographicMetricsValidate(
         DemographicInfo& aliceDatabase,
-        DemographicInfo& bobDatabase);
+        DemographicInfo& bobDatabase,
+        const ValidationSpec& spec = ValidationSpec::defaultSpec());
 
     // Returns multiplication of two secret shared values
     SecUnsignedInt mul(
         const SecUnsignedInt& self,
         const SecUnsignedInt& other);
 
+    // Returns the full 64-bit product of two secret shared values
+    SecUnsignedInt64 mulWide(
+        const SecUnsignedInt& self,
+        const SecUnsignedInt& other);
+
     float demographicMetricsVariance(
         const DemographicInfo& aliceDatabase,
         const DemographicInfo& bobDatabase,
@@ -62,19 +241,251 @@ public:
     long unsigned int aggregateBatch(
         const SecUnsignedInt& inputBatch);
 
+    // Same as aggregateBatch for several batches at once, the batches are
+    // concatenated so all the sums are revealed in the same rounds
+    std::vector<long unsigned int> aggregateBatches(
+        const std::vector<SecUnsignedInt>& inputBatches);
+
+    // Same as aggregateBatches for 64-bit values, the sums are mod 2^64
+    std::vector<uint64_t> aggregateBatches64(
+        const std::vector<SecUnsignedInt64>& inputBatches);
+
+    // Same as aggregateBatches, but the sums are not revealed: returns this
+    // party's additive share (mod 2^32) of every sum
+    std::vector<uint32_t> aggregateBatchesToShares(
+        const std::vector<SecUnsignedInt>& inputBatches,
+        int myPartyId);
+
+    // Same as aggregateBatchesToShares for 64-bit values, the shares are
+    // mod 2^64
+    std::vector<uint64_t> aggregateBatches64ToShares(
+        const std::vector<SecUnsignedInt64>& inputBatches,
+        int myPartyId);
+
+    // Reveals to alice the sums of both parties' additive shares
+    std::vector<long unsigned int> revealShares(
+        const std::vector<uint32_t>& myShares);
+
+    // Same as revealShares for shares mod 2^64
+    std::vector<uint64_t> revealShares64(const std::vector<uint64_t>& myShares);
+
     // Returns the histogram of the two databases
     std::vector<long unsigned int> demographicMetricsHistogram(
         const DemographicInfo& aliceDatabase,
         const DemographicInfo& bobDatabase);
 
+    // Returns this party's shares (mod 2^64) of the row count, sum, sum of
+    // squares and (optionally) histogram of the ages and group counts and
+    // sums, nothing is revealed
+    PartialAggregates demographicMetricsPartialAggregates(
+        const DemographicInfo& aliceDatabase,
+        const DemographicInfo& bobDatabase,
+        int myPartyId,
+        bool histogram,
+        const GroupBySpec& groupBy = GroupBySpec());
+
+    // Returns the row count and sum of the value column for every category
+    // of the group by column. The category of every row is one-hot encoded
+    // once, in a single comparison batched over all the categories, and all
+    // the counts and sums are revealed together.
+    GroupAggregates demographicMetricsGroupBy(
+        const DemographicInfo& aliceDatabase,
+        const DemographicInfo& bobDatabase,
+        const GroupBySpec& groupBy);
+
+    // Reveals to alice the aggregates both parties hold shares of
+    PartialAggregates revealPartialAggregates(
+        const PartialAggregates& myShares);
+
+    // Returns the given quantiles (0.5 for the median) of the ages to both
+    // parties. The bisection only searches up to maxAge, e.g. 8 rounds for
+    // the ages below 200 the default validation keeps.
+    std::vector<uint32_t> demographicMetricsAgePercentiles(
+        const DemographicInfo& aliceDatabase,
+        const DemographicInfo& bobDatabase,
+        const std::vector<double>& quantiles,
+        int myPartyId,
+        uint32_t maxAge = std::numeric_limits<uint32_t>::max());
+
+    // Same as demographicMetricsAgePercentiles for the wealth, over the full
+    // 32-bit domain
+    std::vector<uint32_t> demographicMetricsWealthPercentiles(
+        const DemographicInfo& aliceDatabase,
+        const DemographicInfo& bobDatabase,
+        const std::vector<double>& quantiles,
+        int myPartyId);
+
+    // Returns the sums of age, wealth and their squares and products to
+    // alice. All three products are evaluated in one multiplication over the
+    // concatenated columns and all the sums are revealed together.
+    AgeWealthMoments demographicMetricsAgeWealthMoments(
+        const DemographicInfo& aliceDatabase,
+        const DemographicInfo& bobDatabase);
+
+    // Returns the smallest and largest age and wealth to both parties, only
+    // these four values are revealed
+    MinMaxResult demographicMetricsMinMax(
+        const DemographicInfo& aliceDatabase,
+        const DemographicInfo& bobDatabase);
+
+    // Returns true to both parties if they called this with the same value,
+    // without revealing the values
+    bool publicValuesMatch(uint32_t value);
+
  private:
-    class SecDemographicInfo {
-    public:
-        SecDemographicInfo(const DemographicInfo& database, int partyId);
-        SecUnsignedInt ageShare;
-        SecBool genderShare;
-        SecUnsignedInt wealthShare;
+    std::shared_ptr<TraceRecorder> traceRecorder_;
+
+    // The share vectors (alice's, bob's and their size) a cached column was
+    // combined from. Both parties run the same code on their own databases,
+    // so they agree on when a column has to be combined again.
+    using ColumnSource = std::tuple<const uint32_t*, const uint32_t*, size_t>;
+
+    static ColumnSource columnSource(
+        const std::vector<uint32_t>& aliceShares,
+        const std::vector<uint32_t>& bobShares) {
+        return {aliceShares.data(), bobShares.data(), aliceShares.size()};
+    }
+
+    // Combined secret columns of one shard, filled in on first use
+    struct SecColumns {
+        std::optional<SecUnsignedInt> age;
+        std::optional<SecBool> gender;
+        std::optional<SecUnsignedInt> wealth;
+        ColumnSource ageSource;
+        ColumnSource genderSource;
+        ColumnSource wealthSource;
+        // set by an oblivious validation
+        std::optional<SecBool> valid;
     };
+
+    SecUnsignedInt getSecAge(
+        const DemographicInfo& aliceDatabase,
+        const DemographicInfo& bobDatabase);
+
+    SecBool getSecGender(
+        const DemographicInfo& aliceDatabase,
+        const DemographicInfo& bobDatabase);
+
+    SecUnsignedInt getSecWealth(
+        const DemographicInfo& aliceDatabase,
+        const DemographicInfo& bobDatabase);
+
+    // Column by name, the gender as a 32-bit value so it can be range
+    // checked
+    SecUnsignedInt getSecColumn(
+        const std::string& column,
+        const DemographicInfo& aliceDatabase,
+        const DemographicInfo& bobDatabase);
+
+    // One validity bit per row for the rules of the spec, nullopt if the
+    // rules don't restrict any value
+    std::optional<SecBool> validityBits(
+        const ValidationSpec& spec,
+        const DemographicInfo& aliceDatabase,
+        const DemographicInfo& bobDatabase);
+
+    // Validity of the rows of the current shard if it was validated
+    // obliviously
+    std::optional<SecBool> getSecValid() const {
+        auto columns = secretColumns_.find(currentShard_);
+        return columns == secretColumns_.end() ? std::nullopt
+                                               : columns->second.valid;
+    }
+
+    // Columns other than the age may be left empty if no metric uses them
+    static void checkColumnLoaded(
+        const std::vector<uint32_t>& column,
+        const DemographicInfo& database,
+        const std::string& name) {
+        if (column.size() != database.ageShare.size()) {
+            throw std::invalid_argument(
+                "The " + name + " column was not loaded for this metric");
+        }
+    }
+
+    // Zeroes the rows an oblivious validation found invalid
+    SecUnsignedInt maskInvalid(const SecUnsignedInt& value);
+
+    // Metrics that can't exclude secret invalid rows
+    void checkNotOblivious(const std::string& metric) const {
+        if (getSecValid()) {
+            throw std::invalid_argument(
+                metric + " is not supported with oblivious validation");
+        }
+    }
+
+    // Drops the columns of the current shard, e.g. after validation removed
+    // rows from the databases
+    void invalidateShard() {
+        secretColumns_.erase(currentShard_);
+    }
+
+    // Opens the batches masked by bob to alice, and sums the masked shares
+    // (known to alice) and the masks (known to bob) of every batch
+    void openMaskedSums(
+        const std::vector<SecUnsignedInt>& inputBatches,
+        std::vector<uint32_t>& shareSums,
+        std::vector<uint32_t>& masksSums);
+
+    // Same as openMaskedSums for 64-bit values
+    void openMaskedSums64(
+        const std::vector<SecUnsignedInt64>& inputBatches,
+        std::vector<uint64_t>& shareSums,
+        std::vector<uint64_t>& masksSums);
+
+    // One 0/1 batch per histogram bin of the ages
+    std::vector<SecUnsignedInt> histogramBins(const SecUnsignedInt& secAge);
+
+    // Count batches (0/1 per row) of every category followed by the sum
+    // batches (value or 0 per row) of every category, widened to 64 bits:
+    // a group's sum of 32-bit wealth wraps around mod 2^32 after a handful
+    // of rows
+    std::vector<SecUnsignedInt64> groupBatches(
+        const GroupBySpec& groupBy,
+        const DemographicInfo& aliceDatabase,
+        const DemographicInfo& bobDatabase);
+
+    // Binary search for the smallest value v with count(x <= v) >= rank,
+    // over [0, 2^bitWidth). Each round compares every row against the pivot
+    // of every quantile in one batch and aggregates the counts to shares,
+    // only the result of comparing the count with the rank is opened.
+    std::vector<uint32_t> percentiles(
+        const SecUnsignedInt& secValues,
+        const std::vector<double>& quantiles,
+        int bitWidth,
+        int myPartyId);
+
+    // Tournament reduction to the smallest (or largest) value of the batch:
+    // every layer compares the first half of the batch with the second half
+    // and keeps the winner of each pair, so n values take log2(n) layers of
+    // comparators instead of n sequential ones
+    SecUnsignedInt tournament(SecUnsignedInt values, bool keepMax);
+
+    // A batch of a public number. Unlike a secret-input vector it needs no
+    // input, and comparing, subtracting or muxing with it takes the cheaper
+    // constant circuits (XOR and AND with public bits are free).
+    static PubUnsignedInt constant(uint32_t value, size_t batchSize) {
+        return PubUnsignedInt(std::vector<uint32_t>(batchSize, value));
+    }
+
+    // Same as constant for 64-bit values
+    static PubUnsignedInt64 constant64(uint64_t value, size_t batchSize) {
+        return PubUnsignedInt64(std::vector<uint64_t>(batchSize, value));
+    }
+
+    // 1 where the condition holds and 0 elsewhere, a mux of two constants
+    SecUnsignedInt indicator(const SecBool& condition);
+
+    // Zero-extends a batch to 64 bits, no gates needed
+    SecUnsignedInt64 widen(const SecUnsignedInt& value);
+
+    // Random masks mod 2^32 (or 2^64) expanded from a fresh seed, used by bob
+    // to hide the opened shares in aggregateBatch
+    template <typename T = uint32_t>
+    std::vector<T> generateMasks(size_t size);
+
+    std::string currentShard_;
+    std::map<std::string, SecColumns> secretColumns_;
 };
 
 } // namespace fbpcf::demographic_metrics
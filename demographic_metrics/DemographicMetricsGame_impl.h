@@ -1,7 +1,15 @@
 #pragma once
 
+#include <emmintrin.h>
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <limits>
 #include <type_traits>
 #include "./DemographicMetricsGame.h"
+#include "./MaskExpansion.h"
+#include "./SimdReduce.h"
+#include "fbpcf/engine/util/AesPrg.h"
 #include "fbpcf/frontend/mpcGame.h"
 #include <folly/Random.h>
 
@@ -12,9 +20,23 @@ float
 DemographicMetricsGame<schedulerId>::demographicMetricsAverage(
     const DemographicInfo& aliceDatabase,
     const DemographicInfo& bobDatabase) {
+  TraceScope traceScope(traceRecorder_, "average", "metric");
   int alicePartyId = 0;
   int bobPartyId = 1;
 
+  if (auto secValid = getSecValid()) {
+    // the row count is secret as well, both sums are revealed together
+    auto sums = aggregateBatches(
+        {maskInvalid(getSecAge(aliceDatabase, bobDatabase)),
+         indicator(*secValid)});
+    XLOG(INFO) << "secSum: " << sums.at(0) << ", validRows: " << sums.at(1);
+    if (sums.at(1) == 0) {
+      // no row passed validation
+      return 0;
+    }
+    return sums.at(0)/float(sums.at(1));
+  }
+
   // the mpc function defined for the game
 
   // calculate the sums on transposed batch vector
@@ -35,7 +57,10 @@ DemographicMetricsGame<schedulerId>::demographicMetricsAverage(
     secSum = secSum + secBobSum.at(i) + secAliceSum.at(i);
   }
   
-  auto pubAgeResult = secSum.openToParty(alicePartyId);
+  auto pubAgeResult = [&] {
+    TraceScope openScope(traceRecorder_, "openToParty", "reveal");
+    return secSum.openToParty(alicePartyId);
+  }();
   XLOG(INFO) << "secSum: " << pubAgeResult.getValue();
 
   return pubAgeResult.getValue()/float(aliceDatabase.ageShare.size());
@@ -46,13 +71,72 @@ float
 DemographicMetricsGame<schedulerId>::demographicMetricsAverageSecretShared(
     const DemographicInfo& aliceDatabase,
     const DemographicInfo& bobDatabase) {
+  TraceScope traceScope(traceRecorder_, "averageSecretShared", "metric");
+
+  if (getSecValid()) {
+    // invalid rows can only be excluded inside the circuit
+    return demographicMetricsAverage(aliceDatabase, bobDatabase);
+  }
+
+  // the sum stays in the arithmetic domain, only the two local sums are
+  // combined and revealed
+  auto mySum = arithmeticSum(aliceDatabase.ageShare, bobDatabase.ageShare);
+  return revealShares({mySum}).at(0)/float(aliceDatabase.ageShare.size());
+}
+
+template <int schedulerId>
+typename DemographicMetricsGame<schedulerId>::SecUnsignedInt
+DemographicMetricsGame<schedulerId>::a2b(
+    const std::vector<uint32_t>& aliceShares,
+    const std::vector<uint32_t>& bobShares) {
   int alicePartyId = 0;
   int bobPartyId = 1;
 
-  SecDemographicInfo secAliceDatabase(aliceDatabase, alicePartyId);
-  SecDemographicInfo secBobDatabase(bobDatabase, bobPartyId);
+  return SecUnsignedInt(aliceShares, alicePartyId) +
+      SecUnsignedInt(bobShares, bobPartyId);
+}
+
+template <int schedulerId>
+typename DemographicMetricsGame<schedulerId>::SecBool
+DemographicMetricsGame<schedulerId>::a2bBit(
+    const std::vector<uint32_t>& aliceShares,
+    const std::vector<uint32_t>& bobShares) {
+  int alicePartyId = 0;
+  int bobPartyId = 1;
 
-  return aggregateBatch(secAliceDatabase.ageShare + secBobDatabase.ageShare)/float(aliceDatabase.ageShare.size());
+  std::vector<bool> aliceBits(aliceShares.size());
+  std::vector<bool> bobBits(bobShares.size());
+  for (size_t i = 0; i < aliceShares.size(); ++i) {
+    aliceBits[i] = aliceShares[i] & 1;
+  }
+  for (size_t i = 0; i < bobShares.size(); ++i) {
+    bobBits[i] = bobShares[i] & 1;
+  }
+
+  // the low bit of a sum is the XOR of the low bits
+  return SecBool(aliceBits, alicePartyId) ^ SecBool(bobBits, bobPartyId);
+}
+
+template <int schedulerId>
+void DemographicMetricsGame<schedulerId>::b2a(
+    const SecUnsignedInt& value,
+    std::vector<uint32_t>& aliceShares,
+    std::vector<uint32_t>& bobShares) {
+  int alicePartyId = 0;
+  int bobPartyId = 1;
+
+  bobShares = generateMasks(value.getBatchSize());
+  TraceScope openScope(traceRecorder_, "openToParty", "reveal");
+  aliceShares = (value - SecUnsignedInt(bobShares, bobPartyId))
+                    .openToParty(alicePartyId)
+                    .getValue();
+}
+
+template <int schedulerId>
+uint32_t DemographicMetricsGame<schedulerId>::arithmeticSum(
+    const std::vector<uint32_t>& aliceShares,
+    const std::vector<uint32_t>& bobShares) {
+  return sumMod32(aliceShares) + sumMod32(bobShares);
 }
 
 template <int schedulerId>
@@ -80,6 +164,60 @@ DemographicMetricsGame<schedulerId>::mul(
   return rst;
 }
 
+template <int schedulerId>
+typename DemographicMetricsGame<schedulerId>::SecUnsignedInt
+DemographicMetricsGame<schedulerId>::indicator(const SecBool& condition) {
+  auto batchSize = condition.getBatchSize();
+  return constant(0, batchSize).mux(condition, constant(1, batchSize));
+}
+
+template <int schedulerId>
+typename DemographicMetricsGame<schedulerId>::SecUnsignedInt
+DemographicMetricsGame<schedulerId>::maskInvalid(const SecUnsignedInt& value) {
+  auto secValid = getSecValid();
+  if (!secValid) {
+    return value;
+  }
+  return constant(0, value.getBatchSize()).mux(*secValid, value);
+}
+
+template <int schedulerId>
+typename DemographicMetricsGame<schedulerId>::SecUnsignedInt64
+DemographicMetricsGame<schedulerId>::widen(const SecUnsignedInt& value) {
+  // a secret zero without a secret input: both sides of the mux are public,
+  // so it costs no AND gates
+  auto zero = constant64(0, value.getBatchSize());
+  SecUnsignedInt64 widened = zero.mux(value[0], zero);
+  for (int8_t i = 0; i < 32; i++) {
+    widened[i] = value[i];
+  }
+  return widened;
+}
+
+template <int schedulerId>
+typename DemographicMetricsGame<schedulerId>::SecUnsignedInt64
+DemographicMetricsGame<schedulerId>::mulWide(
+    const SecUnsignedInt& self,
+    const SecUnsignedInt& other) {
+  auto zero = constant64(0, self.getBatchSize());
+  SecUnsignedInt64 multiplicand = widen(self);
+  SecUnsignedInt64 rst = zero.mux(other[0], multiplicand);
+
+  // same shift-and-add as mul, the multiplier only has 32 bits so 32
+  // additions of 64 bits give the full product
+  for (int8_t i = 1; i < 32; i++) {
+    for (int8_t j = 63; j > 0; j--) {
+      multiplicand[j] = multiplicand[j-1];
+    }
+    // clear the last bit, XOR with itself needs no gates
+    multiplicand[0] = multiplicand[0] ^ multiplicand[0];
+
+    rst = rst + zero.mux(other[i], multiplicand);
+  }
+
+  return rst;
+}
+
 template <int schedulerId>
 float
 DemographicMetricsGame<schedulerId>::demographicMetricsVariance(
@@ -87,20 +225,29 @@ DemographicMetricsGame<schedulerId>::demographicMetricsVariance(
     const DemographicInfo& bobDatabase,
     float mean 
     ) {
-  int alicePartyId = 0;
-  int bobPartyId = 1;
-
-  SecDemographicInfo secAliceDatabase(aliceDatabase, alicePartyId);
-  SecDemographicInfo secBobDatabase(bobDatabase, bobPartyId);
+  TraceScope traceScope(traceRecorder_, "variance", "metric");
 
-  auto secSum = secAliceDatabase.ageShare + secBobDatabase.ageShare;
+  auto secSum = getSecAge(aliceDatabase, bobDatabase);
 
-  auto secDiff = secSum - SecUnsignedInt(std::vector<uint32_t>(secSum.getBatchSize(), mean), alicePartyId);
-  auto secRes = mul(secDiff, secDiff);
+  auto secDiff = secSum - constant(mean, secSum.getBatchSize());
+  auto secRes = maskInvalid(mul(secDiff, secDiff));
 
-  auto pubResSum = aggregateBatch(secRes);
+  float numRows = aliceDatabase.ageShare.size();
+  long unsigned int pubResSum;
+  if (auto secValid = getSecValid()) {
+    auto sums = aggregateBatches({secRes, indicator(*secValid)});
+    pubResSum = sums.at(0);
+    numRows = sums.at(1);
+  } else {
+    pubResSum = aggregateBatch(secRes);
+  }
 
-  auto varianceEstimation = pubResSum/float(aliceDatabase.ageShare.size() - 1); // unbiased estimator
+  // unbiased estimator, 0 with fewer than two (valid) rows instead of inf
+  if (numRows < 2) {
+    XLOG(INFO) << "varianceEstimation: 0 (" << numRows << " rows)";
+    return 0;
+  }
+  auto varianceEstimation = pubResSum/float(numRows - 1);
 
   XLOG(INFO) << "varianceEstimation: " << varianceEstimation;
   return varianceEstimation;
@@ -109,104 +256,291 @@ DemographicMetricsGame<schedulerId>::demographicMetricsVariance(
 template <int schedulerId>
 int DemographicMetricsGame<schedulerId>::demographicMetricsValidate(
     DemographicInfo& aliceDatabase,
-    DemographicInfo& bobDatabase) {
+    DemographicInfo& bobDatabase,
+    const ValidationSpec& spec) {
+  TraceScope traceScope(traceRecorder_, "validate", "metric");
   int alicePartyId = 0;
   int bobPartyId = 1;
 
-  SecDemographicInfo secAliceDatabase(aliceDatabase, alicePartyId);
-  SecDemographicInfo secBobDatabase(bobDatabase, bobPartyId);
-
-  // New vector to store the valid entries
-  std::vector<uint32_t> validAgeAlice = {};
-  std::vector<uint32_t> validAgeBob = {};
-
-  std::vector<bool> validGenderAlice = {};
-  std::vector<bool> validGenderBob = {};
-
-  std::vector<uint32_t> validWealthAlice = {};
-  std::vector<uint32_t> validWealthBob = {};
+  // create a vector of bools (1 if row is valid, 0 otherwise)
+  auto secValid = validityBits(spec, aliceDatabase, bobDatabase);
+  if (!secValid) {
+    // the rules don't restrict anything, every row is valid
+    return aliceDatabase.ageShare.size();
+  }
 
-  // input validation
-  auto secAge = secAliceDatabase.ageShare + secBobDatabase.ageShare;
+  if (spec.oblivious) {
+    if (currentShard_.empty()) {
+      throw std::invalid_argument(
+          "Oblivious validation needs an active shard to keep the validity in");
+    }
+    // nothing is revealed, the metrics of this shard mask the invalid rows
+    secretColumns_[currentShard_].valid = *secValid;
+    return aliceDatabase.ageShare.size();
+  }
 
-  // create a vector of bools (1 if row is valid, 0 otherwise)
-  auto secValid = (secAge < SecUnsignedInt(std::vector<uint32_t>(aliceDatabase.ageShare.size(), 200), 0));
   // reveal the validity vector, only valid vals will be used in aggregation
-  auto validA = secValid.openToParty(alicePartyId).getValue();
-  auto validB = secValid.openToParty(bobPartyId).getValue();
-  
-  // should be symmetric for both parties (all 0 for valid vector of other party)
-  for (size_t i = 0; i < validA.size(); ++i) {
-    if(validA.at(i)){
-      validAgeAlice.push_back(aliceDatabase.ageShare.at(i));
-      validAgeBob.push_back(bobDatabase.ageShare.at(i));
-      validGenderAlice.push_back(aliceDatabase.genderShare.at(i));
-      validGenderBob.push_back(bobDatabase.genderShare.at(i));
-      validWealthAlice.push_back(aliceDatabase.wealthShare.at(i));
-      validWealthBob.push_back(bobDatabase.wealthShare.at(i));
-    }
+  std::vector<bool> validA;
+  std::vector<bool> validB;
+  {
+    TraceScope openScope(traceRecorder_, "openToParty", "reveal");
+    validA = secValid->openToParty(alicePartyId).getValue();
+    validB = secValid->openToParty(bobPartyId).getValue();
   }
-  // we don't know which party are we, so we do it for both
-  for (size_t i = 0; i < validB.size(); ++i) {
-    if(validB.at(i)){
-      validAgeAlice.push_back(aliceDatabase.ageShare.at(i));
-      validAgeBob.push_back(bobDatabase.ageShare.at(i));
-      validGenderAlice.push_back(aliceDatabase.genderShare.at(i));
-      validGenderBob.push_back(bobDatabase.genderShare.at(i));
-      validWealthAlice.push_back(aliceDatabase.wealthShare.at(i));
-      validWealthBob.push_back(bobDatabase.wealthShare.at(i));
+
+  // we don't know which party are we, the valid vector of the other party
+  // is all 0. Columns the caller did not load are empty and stay empty.
+  auto keepValidRows = [&validA, &validB](std::vector<uint32_t>& column) {
+    if (column.size() != validA.size()) {
+      return;
+    }
+    size_t kept = 0;
+    for (size_t i = 0; i < column.size(); ++i) {
+      if (validA.at(i) || validB.at(i)) {
+        column[kept++] = column[i];
+      }
+    }
+    column.resize(kept);
+  };
+  for (auto* database : {&aliceDatabase, &bobDatabase}) {
+    keepValidRows(database->ageShare);
+    keepValidRows(database->genderShare);
+    keepValidRows(database->wealthShare);
+    for (auto& category : database->categoryShares) {
+      keepValidRows(category.second);
     }
   }
 
-  aliceDatabase.ageShare = validAgeAlice;
-  aliceDatabase.genderShare = validGenderAlice;
-  aliceDatabase.wealthShare = validWealthAlice;
-
-  bobDatabase.ageShare = validAgeBob;
-  bobDatabase.genderShare = validGenderBob;
-  bobDatabase.wealthShare = validWealthBob;
+  // the cached columns still hold the invalid rows
+  invalidateShard();
 
   // Return valid database size
-  return validAgeAlice.size();
+  return aliceDatabase.ageShare.size();
+}
+
+template <int schedulerId>
+std::optional<typename DemographicMetricsGame<schedulerId>::SecBool>
+DemographicMetricsGame<schedulerId>::validityBits(
+    const ValidationSpec& spec,
+    const DemographicInfo& aliceDatabase,
+    const DemographicInfo& bobDatabase) {
+  auto batchSize = aliceDatabase.ageShare.size();
+  // starts from the first predicate, every bit is computed from the shares
+  std::optional<SecBool> secValid;
+  auto require = [&secValid](const SecBool& predicate) {
+    secValid = secValid ? *secValid & predicate : predicate;
+  };
+
+  for (const auto& rule : spec.rules) {
+    auto secColumn = getSecColumn(rule.column, aliceDatabase, bobDatabase);
+
+    // comparisons against the full range of uint32_t are always true
+    if (rule.min > 0) {
+      require(!(secColumn < constant(rule.min, batchSize)));
+    }
+    if (rule.max < std::numeric_limits<uint32_t>::max()) {
+      require(secColumn < constant(rule.max + 1, batchSize));
+    }
+    if (!rule.allowed.empty()) {
+      auto secAllowed = secColumn == constant(rule.allowed.at(0), batchSize);
+      for (size_t i = 1; i < rule.allowed.size(); ++i) {
+        secAllowed = secAllowed |
+            (secColumn == constant(rule.allowed.at(i), batchSize));
+      }
+      require(secAllowed);
+    }
+  }
+  return secValid;
 }
 
 template<int schedulerId> 
 long unsigned int DemographicMetricsGame<schedulerId>::aggregateBatch(
     const SecUnsignedInt& inputBatch){
+  return aggregateBatches({inputBatch}).at(0);
+}
+
+template <int schedulerId>
+std::vector<long unsigned int>
+DemographicMetricsGame<schedulerId>::aggregateBatches(
+    const std::vector<SecUnsignedInt>& inputBatches) {
   int alicePartyId = 0;
   int bobPartyId = 1;
 
-  // create mask for bob
-  auto masks = vector<uint32_t>();
+  std::vector<uint32_t> shareSums;
+  std::vector<uint32_t> masksSums;
+  openMaskedSums(inputBatches, shareSums, masksSums);
 
-  for(size_t i = 0; i < inputBatch.getBatchSize(); ++i){
-    // basically doing calculations mod 2^32, so the mask 
-    // is taken at random from this space
-    masks.push_back(folly::Random::secureRand32());
+  // make the mask sums public
+  std::vector<uint32_t> masksSumsPublic;
+  {
+    TraceScope openScope(traceRecorder_, "openToParty", "reveal");
+    masksSumsPublic = SecUnsignedInt(masksSums, bobPartyId).openToParty(alicePartyId).getValue();
   }
-  auto secMasks = SecUnsignedInt(masks, bobPartyId);
-  auto pubInputShares = (inputBatch - secMasks).openToParty(alicePartyId).getValue();
 
-  // calculate the sum of masked shares
-  uint32_t shareSum = 0;
-  for (size_t i = 0; i < pubInputShares.size(); ++i) {
-    shareSum += pubInputShares.at(i);
+  // calculate the sums
+  std::vector<long unsigned int> sums;
+  for (size_t i = 0; i < inputBatches.size(); ++i) {
+    uint32_t sum = shareSums.at(i) + masksSumsPublic.at(i);
+    XLOG(DBG) << "shareSum: " << shareSums.at(i) << ", masksSum: "
+              << masksSums.at(i) << ", sum: " << sum;
+    sums.push_back(sum);
   }
-  XLOG(DBG) << "shareSum: " << shareSum;
+  return sums;
+}
 
-  uint32_t masksSum = 0;
-  for (size_t i = 0; i < masks.size(); ++i) {
-    masksSum += masks.at(i);
+template <int schedulerId>
+std::vector<uint64_t>
+DemographicMetricsGame<schedulerId>::aggregateBatches64(
+    const std::vector<SecUnsignedInt64>& inputBatches) {
+  int alicePartyId = 0;
+  int bobPartyId = 1;
+
+  std::vector<uint64_t> shareSums;
+  std::vector<uint64_t> masksSums;
+  openMaskedSums64(inputBatches, shareSums, masksSums);
+
+  std::vector<uint64_t> masksSumsPublic;
+  {
+    TraceScope openScope(traceRecorder_, "openToParty", "reveal");
+    masksSumsPublic = SecUnsignedInt64(masksSums, bobPartyId).openToParty(alicePartyId).getValue();
+  }
+
+  std::vector<uint64_t> sums;
+  for (size_t i = 0; i < inputBatches.size(); ++i) {
+    sums.push_back(shareSums.at(i) + masksSumsPublic.at(i));
+  }
+  return sums;
+}
+
+template <int schedulerId>
+std::vector<uint64_t>
+DemographicMetricsGame<schedulerId>::aggregateBatches64ToShares(
+    const std::vector<SecUnsignedInt64>& inputBatches,
+    int myPartyId) {
+  int alicePartyId = 0;
+
+  std::vector<uint64_t> shareSums;
+  std::vector<uint64_t> masksSums;
+  openMaskedSums64(inputBatches, shareSums, masksSums);
+  return myPartyId == alicePartyId ? shareSums : masksSums;
+}
+
+template <int schedulerId>
+void DemographicMetricsGame<schedulerId>::openMaskedSums64(
+    const std::vector<SecUnsignedInt64>& inputBatches,
+    std::vector<uint64_t>& shareSums,
+    std::vector<uint64_t>& masksSums) {
+  int alicePartyId = 0;
+  int bobPartyId = 1;
+
+  std::vector<uint32_t> batchSizes;
+  for (const auto& inputBatch : inputBatches) {
+    batchSizes.push_back(inputBatch.getBatchSize());
   }
-  XLOG(DBG) << "masksSum: " << masksSum;
 
-  // make the mask sum public
-  auto maskSumPublic = SecUnsignedIntSingle(masksSum, bobPartyId).openToParty(alicePartyId).getValue();
+  auto combinedBatch = inputBatches.size() == 1
+      ? inputBatches.at(0)
+      : inputBatches.at(0).batchingWith(std::vector<SecUnsignedInt64>(
+            inputBatches.begin() + 1, inputBatches.end()));
+
+  // same protocol as openMaskedSums, with masks mod 2^64
+  auto masks = generateMasks<uint64_t>(combinedBatch.getBatchSize());
+  std::vector<uint64_t> pubInputShares;
+  {
+    TraceScope openScope(traceRecorder_, "openToParty", "reveal");
+    pubInputShares = (combinedBatch - SecUnsignedInt64(masks, bobPartyId))
+                         .openToParty(alicePartyId)
+                         .getValue();
+  }
 
-  // calculate the sum
-  uint32_t sum = shareSum + maskSumPublic;
-  XLOG(DBG) << "sum: " << sum;
-  return sum;
+  shareSums = segmentedSumMod64(pubInputShares, batchSizes);
+  masksSums = segmentedSumMod64(masks, batchSizes);
+}
+
+template <int schedulerId>
+std::vector<uint32_t>
+DemographicMetricsGame<schedulerId>::aggregateBatchesToShares(
+    const std::vector<SecUnsignedInt>& inputBatches,
+    int myPartyId) {
+  int alicePartyId = 0;
+
+  std::vector<uint32_t> shareSums;
+  std::vector<uint32_t> masksSums;
+  openMaskedSums(inputBatches, shareSums, masksSums);
+
+  // sum = shareSum + masksSum, alice knows the first and bob the second
+  return myPartyId == alicePartyId ? shareSums : masksSums;
+}
+
+template <int schedulerId>
+std::vector<long unsigned int>
+DemographicMetricsGame<schedulerId>::revealShares(
+    const std::vector<uint32_t>& myShares) {
+  int alicePartyId = 0;
+  int bobPartyId = 1;
+
+  // each party only provides the input it owns, the other value is ignored
+  auto secSums = SecUnsignedInt(myShares, alicePartyId) +
+      SecUnsignedInt(myShares, bobPartyId);
+
+  TraceScope openScope(traceRecorder_, "openToParty", "reveal");
+  auto pubSums = secSums.openToParty(alicePartyId).getValue();
+  return std::vector<long unsigned int>(pubSums.begin(), pubSums.end());
+}
+
+template <int schedulerId>
+std::vector<uint64_t> DemographicMetricsGame<schedulerId>::revealShares64(
+    const std::vector<uint64_t>& myShares) {
+  int alicePartyId = 0;
+  int bobPartyId = 1;
+
+  auto secSums = SecUnsignedInt64(myShares, alicePartyId) +
+      SecUnsignedInt64(myShares, bobPartyId);
+
+  TraceScope openScope(traceRecorder_, "openToParty", "reveal");
+  return secSums.openToParty(alicePartyId).getValue();
+}
+
+template <int schedulerId>
+void DemographicMetricsGame<schedulerId>::openMaskedSums(
+    const std::vector<SecUnsignedInt>& inputBatches,
+    std::vector<uint32_t>& shareSums,
+    std::vector<uint32_t>& masksSums) {
+  int alicePartyId = 0;
+  int bobPartyId = 1;
+
+  std::vector<uint32_t> batchSizes;
+  for (const auto& inputBatch : inputBatches) {
+    batchSizes.push_back(inputBatch.getBatchSize());
+  }
+
+  // all the batches are opened together, so aggregating k batches costs
+  // the same reveal rounds as a single one
+  auto combinedBatch = inputBatches.size() == 1
+      ? inputBatches.at(0)
+      : inputBatches.at(0).batchingWith(std::vector<SecUnsignedInt>(
+            inputBatches.begin() + 1, inputBatches.end()));
+
+  // alice's shares are the opened values masked by bob, bob's are the masks
+  std::vector<uint32_t> pubInputShares;
+  std::vector<uint32_t> masks;
+  b2a(combinedBatch, pubInputShares, masks);
+
+  // calculate the sums of masked shares and of the masks for every batch
+  shareSums = segmentedSumMod32(pubInputShares, batchSizes);
+  masksSums = segmentedSumMod32(masks, batchSizes);
+}
+
+template <int schedulerId>
+template <typename T>
+std::vector<T> DemographicMetricsGame<schedulerId>::generateMasks(
+    size_t size) {
+  // basically doing calculations mod 2^32, so the masks are taken at random
+  // from this space. A single CSPRNG draw seeds an AES-CTR prg which expands
+  // into all the masks at once, instead of a secureRand32() call per row
+  fbpcf::engine::util::AesPrg prg(_mm_set_epi64x(
+      folly::Random::secureRand64(), folly::Random::secureRand64()));
+  return expandMasks<T>(prg, size);
 }
 
 template<int schedulerId> 
@@ -214,14 +548,21 @@ std::vector<long unsigned int>
 DemographicMetricsGame<schedulerId>::demographicMetricsHistogram(
     const DemographicInfo& aliceDatabase,
     const DemographicInfo& bobDatabase) {
-  int alicePartyId = 0;
-  int bobPartyId = 1;
+  TraceScope traceScope(traceRecorder_, "histogram", "metric");
 
-  SecDemographicInfo secAliceDatabase(aliceDatabase, alicePartyId);
-  SecDemographicInfo secBobDatabase(bobDatabase, bobPartyId);
+  // all the bins are revealed at once
+  auto pubAliceHistogram =
+      aggregateBatches(histogramBins(getSecAge(aliceDatabase, bobDatabase)));
+  for(long unsigned int i = 0; i < pubAliceHistogram.size(); ++i){
+    XLOG(INFO) << "pubAliceHistogram[" << i << "]: " << pubAliceHistogram[i];
+  }
+  return pubAliceHistogram;
+}
 
-  std::vector<uint32_t> validAgeAlice = aliceDatabase.ageShare;
-  std::vector<uint32_t> validAgeBob = bobDatabase.ageShare;
+template <int schedulerId>
+std::vector<typename DemographicMetricsGame<schedulerId>::SecUnsignedInt>
+DemographicMetricsGame<schedulerId>::histogramBins(const SecUnsignedInt& secAge) {
+  auto numRows = secAge.getBatchSize();
 
   // the mpc function defined for the game
   std::vector<SecUnsignedInt> secAliceHistogram;
@@ -229,37 +570,454 @@ DemographicMetricsGame<schedulerId>::demographicMetricsHistogram(
   // histogram bin boundaries
   std::vector<uint32_t> x = {25, 40, 50, 60, 75};
 
-  // probably can be done in a more optimized way
-  auto secAge = secAliceDatabase.ageShare + secBobDatabase.ageShare;
-
-  auto zero = SecUnsignedInt(std::vector<uint32_t>(validAgeAlice.size(), 0), alicePartyId);
-  auto one = SecUnsignedInt(std::vector<uint32_t>(validAgeAlice.size(), 1), alicePartyId);
-
   // calculate histogram vectors, they will have to be aggregated later
-  secAliceHistogram.push_back(zero.mux(secAge < SecUnsignedInt(std::vector<uint32_t>(validAgeAlice.size(), x[0]), alicePartyId), one));
+  secAliceHistogram.push_back(maskInvalid(indicator(secAge < constant(x[0], numRows))));
   for (long unsigned int i = 1; i < x.size(); ++i) {
-    auto binStart = SecUnsignedInt(std::vector<uint32_t>(validAgeAlice.size(), x[i-1]), alicePartyId);
-    auto binEnd = SecUnsignedInt(std::vector<uint32_t>(validAgeAlice.size(), x[i]), alicePartyId);
-    secAliceHistogram.push_back(zero.mux((secAge >= binStart) & (secAge < binEnd), one));
+    auto binStart = constant(x[i-1], numRows);
+    auto binEnd = constant(x[i], numRows);
+    secAliceHistogram.push_back(maskInvalid(indicator((secAge >= binStart) & (secAge < binEnd))));
   }
-  secAliceHistogram.push_back(zero.mux(secAge >= SecUnsignedInt(std::vector<uint32_t>(validAgeAlice.size(), x[x.size() - 1]), alicePartyId), one));
+  secAliceHistogram.push_back(maskInvalid(indicator(secAge >= constant(x[x.size() - 1], numRows))));
 
-  std::vector<long unsigned int> pubAliceHistogram;
+  return secAliceHistogram;
+}
 
-  // probably can be done much faster
-  for(long unsigned int i = 0; i < secAliceHistogram.size(); ++i){
-    pubAliceHistogram.push_back(aggregateBatch(secAliceHistogram.at(i)));
-    XLOG(INFO) << "pubAliceHistogram[" << i << "]: " << pubAliceHistogram[i];
+template <int schedulerId>
+PartialAggregates
+DemographicMetricsGame<schedulerId>::demographicMetricsPartialAggregates(
+    const DemographicInfo& aliceDatabase,
+    const DemographicInfo& bobDatabase,
+    int myPartyId,
+    bool histogram,
+    const GroupBySpec& groupBy) {
+  TraceScope traceScope(traceRecorder_, "partialAggregates", "metric");
+  int alicePartyId = 0;
+
+  auto secAge = getSecAge(aliceDatabase, bobDatabase);
+  auto secValid = getSecValid();
+  auto secValidAge = maskInvalid(secAge);
+
+  // the shares are mod 2^64, so the sum of squares doesn't wrap around
+  // after a few million rows and the shares of many shards can be merged
+  std::vector<SecUnsignedInt64> batches = {
+      mulWide(secValidAge, secAge), widen(secValidAge)};
+  if (secValid) {
+    // the count of the valid rows has to come from the circuit too
+    batches.push_back(widen(indicator(*secValid)));
   }
-  return pubAliceHistogram;
+  size_t numBins = 0;
+  if (histogram) {
+    auto bins = histogramBins(secAge);
+    numBins = bins.size();
+    for (const auto& bin : bins) {
+      batches.push_back(widen(bin));
+    }
+  }
+  if (groupBy.enabled()) {
+    auto groups = groupBatches(groupBy, aliceDatabase, bobDatabase);
+    batches.insert(batches.end(), groups.begin(), groups.end());
+  }
+  auto shares = aggregateBatches64ToShares(batches, myPartyId);
+  auto firstBin = shares.begin() + 2;
+
+  PartialAggregates myShares;
+  myShares.sumOfSquares = shares.at(0);
+  myShares.sum = shares.at(1);
+  if (secValid) {
+    myShares.count = shares.at(2);
+    ++firstBin;
+  } else {
+    // the row count is public, alice holds all of it
+    myShares.count = myPartyId == alicePartyId ? aliceDatabase.ageShare.size() : 0;
+  }
+  myShares.histogram.assign(firstBin, firstBin + numBins);
+  auto firstGroup = firstBin + numBins;
+  myShares.groupCounts.assign(firstGroup, firstGroup + groupBy.numCategories);
+  myShares.groupSums.assign(firstGroup + groupBy.numCategories, shares.end());
+  return myShares;
+}
+
+template <int schedulerId>
+typename DemographicMetricsGame<schedulerId>::GroupAggregates
+DemographicMetricsGame<schedulerId>::demographicMetricsGroupBy(
+    const DemographicInfo& aliceDatabase,
+    const DemographicInfo& bobDatabase,
+    const GroupBySpec& groupBy) {
+  TraceScope traceScope(traceRecorder_, "groupBy", "metric");
+
+  auto sums = aggregateBatches64(groupBatches(groupBy, aliceDatabase, bobDatabase));
+
+  GroupAggregates groups;
+  groups.counts.assign(sums.begin(), sums.begin() + groupBy.numCategories);
+  groups.sums.assign(sums.begin() + groupBy.numCategories, sums.end());
+  for (uint32_t i = 0; i < groupBy.numCategories; ++i) {
+    XLOG(INFO) << "group " << i << ": count " << groups.counts.at(i)
+               << ", sum " << groups.sums.at(i);
+  }
+  return groups;
+}
+
+template <int schedulerId>
+std::vector<typename DemographicMetricsGame<schedulerId>::SecUnsignedInt64>
+DemographicMetricsGame<schedulerId>::groupBatches(
+    const GroupBySpec& groupBy,
+    const DemographicInfo& aliceDatabase,
+    const DemographicInfo& bobDatabase) {
+  auto secCategory = getSecColumn(groupBy.column, aliceDatabase, bobDatabase);
+  auto secValue = getSecColumn(groupBy.valueColumn, aliceDatabase, bobDatabase);
+  uint32_t numRows = secCategory.getBatchSize();
+  auto numCategories = groupBy.numCategories;
+
+  // the columns are repeated once per category, so the one-hot encoding and
+  // the muxes are one batched circuit each
+  auto repeat = [numCategories](const auto& batch) {
+    using Batch = std::decay_t<decltype(batch)>;
+    return numCategories == 1
+        ? batch
+        : batch.batchingWith(std::vector<Batch>(numCategories - 1, batch));
+  };
+  std::vector<uint32_t> categories;
+  categories.reserve(size_t(numRows) * numCategories);
+  for (uint32_t category = 0; category < numCategories; ++category) {
+    categories.insert(categories.end(), numRows, category);
+  }
+
+  auto secOneHot = repeat(secCategory) == PubUnsignedInt(categories);
+  if (auto secValid = getSecValid()) {
+    secOneHot = secOneHot & repeat(*secValid);
+  }
+  auto numGroupRows = secOneHot.getBatchSize();
+  auto secCounts = indicator(secOneHot);
+  auto secSums = constant(0, numGroupRows).mux(secOneHot, repeat(secValue));
+
+  auto groupSizes = std::make_shared<std::vector<uint32_t>>(numCategories, numRows);
+  std::vector<SecUnsignedInt64> batches;
+  for (const auto& batch : secCounts.unbatching(groupSizes)) {
+    batches.push_back(widen(batch));
+  }
+  for (const auto& batch : secSums.unbatching(groupSizes)) {
+    batches.push_back(widen(batch));
+  }
+  return batches;
+}
+
+template <int schedulerId>
+PartialAggregates
+DemographicMetricsGame<schedulerId>::revealPartialAggregates(
+    const PartialAggregates& myShares) {
+  std::vector<uint64_t> shares = {
+      myShares.count, myShares.sum, myShares.sumOfSquares};
+  shares.insert(shares.end(), myShares.histogram.begin(), myShares.histogram.end());
+  shares.insert(shares.end(), myShares.groupCounts.begin(), myShares.groupCounts.end());
+  shares.insert(shares.end(), myShares.groupSums.begin(), myShares.groupSums.end());
+
+  auto values = revealShares64(shares);
+
+  PartialAggregates aggregates;
+  aggregates.count = values.at(0);
+  aggregates.sum = values.at(1);
+  aggregates.sumOfSquares = values.at(2);
+  auto next = values.begin() + 3;
+  aggregates.histogram.assign(next, next + myShares.histogram.size());
+  next += myShares.histogram.size();
+  aggregates.groupCounts.assign(next, next + myShares.groupCounts.size());
+  next += myShares.groupCounts.size();
+  aggregates.groupSums.assign(next, values.end());
+  return aggregates;
+}
+
+template <int schedulerId>
+std::vector<uint32_t>
+DemographicMetricsGame<schedulerId>::demographicMetricsAgePercentiles(
+    const DemographicInfo& aliceDatabase,
+    const DemographicInfo& bobDatabase,
+    const std::vector<double>& quantiles,
+    int myPartyId,
+    uint32_t maxAge) {
+  TraceScope traceScope(traceRecorder_, "agePercentiles", "metric");
+  checkNotOblivious("Percentiles");
+  // enough bits for every age up to maxAge
+  int bitWidth = 1;
+  while (bitWidth < 32 && (maxAge >> bitWidth) != 0) {
+    ++bitWidth;
+  }
+  return percentiles(
+      getSecAge(aliceDatabase, bobDatabase), quantiles, bitWidth, myPartyId);
+}
+
+template <int schedulerId>
+std::vector<uint32_t>
+DemographicMetricsGame<schedulerId>::demographicMetricsWealthPercentiles(
+    const DemographicInfo& aliceDatabase,
+    const DemographicInfo& bobDatabase,
+    const std::vector<double>& quantiles,
+    int myPartyId) {
+  TraceScope traceScope(traceRecorder_, "wealthPercentiles", "metric");
+  checkNotOblivious("Percentiles");
+  return percentiles(
+      getSecWealth(aliceDatabase, bobDatabase), quantiles, 32, myPartyId);
+}
+
+template <int schedulerId>
+std::vector<uint32_t> DemographicMetricsGame<schedulerId>::percentiles(
+    const SecUnsignedInt& secValues,
+    const std::vector<double>& quantiles,
+    int bitWidth,
+    int myPartyId) {
+  int alicePartyId = 0;
+  int bobPartyId = 1;
+  auto numRows = secValues.getBatchSize();
+
+  // the rank of a quantile is public, it only depends on the row count
+  std::vector<uint32_t> ranks;
+  for (auto quantile : quantiles) {
+    ranks.push_back(std::min<uint64_t>(
+        std::max<uint64_t>(std::ceil(quantile * numRows), 1), numRows));
+  }
+  auto pubRanks = PubUnsignedInt(ranks);
+
+  std::vector<uint64_t> low(quantiles.size(), 0);
+  std::vector<uint64_t> high(quantiles.size(), (uint64_t(1) << bitWidth) - 1);
+
+  // the intervals have power of two sizes, so they all shrink to a single
+  // value after bitWidth rounds
+  for (int round = 0; round < bitWidth; ++round) {
+    std::vector<uint32_t> pivots;
+    std::vector<SecUnsignedInt> belowPivot;
+    for (size_t i = 0; i < quantiles.size(); ++i) {
+      // low < high, so pivot + 1 still fits in 32 bits
+      uint32_t pivot = low[i] + (high[i] - low[i]) / 2;
+      pivots.push_back(pivot);
+      belowPivot.push_back(indicator(secValues < constant(pivot + 1, numRows)));
+    }
+
+    // the counts stay secret shared, both parties only learn which half
+    // every quantile is in, which the result reveals anyway
+    auto myCounts = aggregateBatchesToShares(belowPivot, myPartyId);
+    auto secEnough = (SecUnsignedInt(myCounts, alicePartyId) +
+                      SecUnsignedInt(myCounts, bobPartyId)) >= pubRanks;
+
+    std::vector<bool> enoughA;
+    std::vector<bool> enoughB;
+    {
+      TraceScope openScope(traceRecorder_, "openToParty", "reveal");
+      enoughA = secEnough.openToParty(alicePartyId).getValue();
+      enoughB = secEnough.openToParty(bobPartyId).getValue();
+    }
+
+    for (size_t i = 0; i < quantiles.size(); ++i) {
+      // we don't know which party are we, the other result is always false
+      if (enoughA.at(i) || enoughB.at(i)) {
+        high[i] = pivots[i];
+      } else {
+        low[i] = uint64_t(pivots[i]) + 1;
+      }
+    }
+  }
+  return std::vector<uint32_t>(low.begin(), low.end());
 }
 
 template <int schedulerId>
-DemographicMetricsGame<schedulerId>::SecDemographicInfo::SecDemographicInfo(
-  const DemographicInfo& database, int partyId)
-    : ageShare(database.ageShare, partyId),
-      genderShare(database.genderShare, partyId),
-      wealthShare(database.wealthShare, partyId) {}
+typename DemographicMetricsGame<schedulerId>::AgeWealthMoments
+DemographicMetricsGame<schedulerId>::demographicMetricsAgeWealthMoments(
+    const DemographicInfo& aliceDatabase,
+    const DemographicInfo& bobDatabase) {
+  TraceScope traceScope(traceRecorder_, "ageWealthMoments", "metric");
+  checkNotOblivious("Covariance");
+  auto numRows = static_cast<uint32_t>(aliceDatabase.ageShare.size());
+
+  auto secAge = getSecAge(aliceDatabase, bobDatabase);
+  auto secWealth = getSecWealth(aliceDatabase, bobDatabase);
+
+  // [age, wealth, age] * [age, wealth, wealth] in a single multiplication,
+  // so the three products take the rounds of one
+  auto secProducts = mulWide(
+      secAge.batchingWith(std::vector<SecUnsignedInt>{secWealth, secAge}),
+      secAge.batchingWith(std::vector<SecUnsignedInt>{secWealth, secWealth}));
+  auto products = secProducts.unbatching(
+      std::make_shared<std::vector<uint32_t>>(
+          std::vector<uint32_t>{numRows, numRows, numRows}));
+
+  auto sums = aggregateBatches64(
+      {widen(secAge), widen(secWealth), products.at(0), products.at(1), products.at(2)});
+
+  AgeWealthMoments moments{
+      numRows, sums.at(0), sums.at(1), sums.at(2), sums.at(3), sums.at(4)};
+  XLOG(INFO) << "sumWealth: " << moments.sumWealth
+             << ", sumWealthSquared: " << moments.sumWealthSquared
+             << ", sumAgeWealth: " << moments.sumAgeWealth;
+  return moments;
+}
+
+template <int schedulerId>
+typename DemographicMetricsGame<schedulerId>::MinMaxResult
+DemographicMetricsGame<schedulerId>::demographicMetricsMinMax(
+    const DemographicInfo& aliceDatabase,
+    const DemographicInfo& bobDatabase) {
+  TraceScope traceScope(traceRecorder_, "minMax", "metric");
+  checkNotOblivious("Min/max");
+  int alicePartyId = 0;
+  int bobPartyId = 1;
+
+  if (aliceDatabase.ageShare.empty()) {
+    return MinMaxResult{0, 0, 0, 0};
+  }
+
+  auto secAge = getSecAge(aliceDatabase, bobDatabase);
+  auto secWealth = getSecWealth(aliceDatabase, bobDatabase);
+
+  // the four tournaments don't depend on each other, so the lazy scheduler
+  // runs their layers in the same rounds
+  auto secResults = tournament(secAge, false).batchingWith(std::vector<SecUnsignedInt>{
+      tournament(secAge, true),
+      tournament(secWealth, false),
+      tournament(secWealth, true)});
+
+  std::vector<uint32_t> resultsA;
+  std::vector<uint32_t> resultsB;
+  {
+    TraceScope openScope(traceRecorder_, "openToParty", "reveal");
+    resultsA = secResults.openToParty(alicePartyId).getValue();
+    resultsB = secResults.openToParty(bobPartyId).getValue();
+  }
+
+  // we don't know which party are we, the other result is always 0
+  std::vector<uint32_t> results;
+  for (size_t i = 0; i < resultsA.size(); ++i) {
+    results.push_back(resultsA.at(i) | resultsB.at(i));
+  }
+  XLOG(INFO) << "minAge: " << results.at(0) << ", maxAge: " << results.at(1)
+             << ", minWealth: " << results.at(2)
+             << ", maxWealth: " << results.at(3);
+  return MinMaxResult{results.at(0), results.at(1), results.at(2), results.at(3)};
+}
+
+template <int schedulerId>
+typename DemographicMetricsGame<schedulerId>::SecUnsignedInt
+DemographicMetricsGame<schedulerId>::tournament(
+    SecUnsignedInt values,
+    bool keepMax) {
+  while (values.getBatchSize() > 1) {
+    uint32_t half = values.getBatchSize() / 2;
+    // an odd value out gets a bye to the next layer
+    auto sizes = std::make_shared<std::vector<uint32_t>>(
+        std::vector<uint32_t>{half, half});
+    if (values.getBatchSize() % 2 == 1) {
+      sizes->push_back(1);
+    }
+    auto parts = values.unbatching(sizes);
+
+    const auto& first = parts.at(0);
+    const auto& second = parts.at(1);
+    auto winners = keepMax ? first.mux(first < second, second)
+                           : first.mux(second < first, second);
+
+    values = parts.size() == 3
+        ? winners.batchingWith(std::vector<SecUnsignedInt>{parts.at(2)})
+        : winners;
+  }
+  return values;
+}
+
+template <int schedulerId>
+bool DemographicMetricsGame<schedulerId>::publicValuesMatch(uint32_t value) {
+  int alicePartyId = 0;
+  int bobPartyId = 1;
+
+  // each party only provides the input it owns, the other value is ignored
+  auto secEqual = SecUnsignedIntSingle(value, alicePartyId) ==
+      SecUnsignedIntSingle(value, bobPartyId);
+
+  TraceScope openScope(traceRecorder_, "openToParty", "reveal");
+  auto equalA = secEqual.openToParty(alicePartyId).getValue();
+  auto equalB = secEqual.openToParty(bobPartyId).getValue();
+
+  // we don't know which party are we, the other result is always false
+  return equalA || equalB;
+}
+
+template <int schedulerId>
+typename DemographicMetricsGame<schedulerId>::SecUnsignedInt
+DemographicMetricsGame<schedulerId>::getSecAge(
+    const DemographicInfo& aliceDatabase,
+    const DemographicInfo& bobDatabase) {
+  if (currentShard_.empty()) {
+    return a2b(aliceDatabase.ageShare, bobDatabase.ageShare);
+  }
+
+  auto& columns = secretColumns_[currentShard_];
+  auto source = columnSource(aliceDatabase.ageShare, bobDatabase.ageShare);
+  if (!columns.age || columns.ageSource != source) {
+    columns.age = a2b(aliceDatabase.ageShare, bobDatabase.ageShare);
+    columns.ageSource = source;
+  }
+  return *columns.age;
+}
+
+template <int schedulerId>
+typename DemographicMetricsGame<schedulerId>::SecBool
+DemographicMetricsGame<schedulerId>::getSecGender(
+    const DemographicInfo& aliceDatabase,
+    const DemographicInfo& bobDatabase) {
+  checkColumnLoaded(aliceDatabase.genderShare, aliceDatabase, "gender");
+  if (currentShard_.empty()) {
+    return a2bBit(aliceDatabase.genderShare, bobDatabase.genderShare);
+  }
+
+  auto& columns = secretColumns_[currentShard_];
+  auto source = columnSource(aliceDatabase.genderShare, bobDatabase.genderShare);
+  if (!columns.gender || columns.genderSource != source) {
+    columns.gender = a2bBit(aliceDatabase.genderShare, bobDatabase.genderShare);
+    columns.genderSource = source;
+  }
+  return *columns.gender;
+}
+
+template <int schedulerId>
+typename DemographicMetricsGame<schedulerId>::SecUnsignedInt
+DemographicMetricsGame<schedulerId>::getSecWealth(
+    const DemographicInfo& aliceDatabase,
+    const DemographicInfo& bobDatabase) {
+  checkColumnLoaded(aliceDatabase.wealthShare, aliceDatabase, "wealth");
+  if (currentShard_.empty()) {
+    return a2b(aliceDatabase.wealthShare, bobDatabase.wealthShare);
+  }
+
+  auto& columns = secretColumns_[currentShard_];
+  auto source = columnSource(aliceDatabase.wealthShare, bobDatabase.wealthShare);
+  if (!columns.wealth || columns.wealthSource != source) {
+    columns.wealth = a2b(aliceDatabase.wealthShare, bobDatabase.wealthShare);
+    columns.wealthSource = source;
+  }
+  return *columns.wealth;
+}
+
+template <int schedulerId>
+typename DemographicMetricsGame<schedulerId>::SecUnsignedInt
+DemographicMetricsGame<schedulerId>::getSecColumn(
+    const std::string& column,
+    const DemographicInfo& aliceDatabase,
+    const DemographicInfo& bobDatabase) {
+  if (column == "age") {
+    return getSecAge(aliceDatabase, bobDatabase);
+  } else if (column == "wealth") {
+    return getSecWealth(aliceDatabase, bobDatabase);
+  } else if (column == "gender") {
+    checkColumnLoaded(aliceDatabase.genderShare, aliceDatabase, "gender");
+    // the full share rather than the cached bit, so values other than 0/1
+    // can be rejected
+    return a2b(aliceDatabase.genderShare, bobDatabase.genderShare);
+  }
+
+  auto aliceCategory = aliceDatabase.categoryShares.find(column);
+  auto bobCategory = bobDatabase.categoryShares.find(column);
+  if (aliceCategory != aliceDatabase.categoryShares.end() &&
+      bobCategory != bobDatabase.categoryShares.end()) {
+    checkColumnLoaded(aliceCategory->second, aliceDatabase, column);
+    return a2b(aliceCategory->second, bobCategory->second);
+  }
+  throw std::invalid_argument("Unknown column: " + column);
+}
 
 template <int schedulerId, bool usingBatch = true>
 using PubBit =
@@ -270,4 +1028,4 @@ using SecBit =
     typename fbpcf::frontend::MpcGame<schedulerId>::template SecBit<usingBatch>;
 
 
-} // namespace fbpcf::demographic_metrics
\ No newline at end of file
+} // namespace fbpcf::demographic_metrics
@@ -0,0 +1,59 @@
+#pragma once
+
+#include <cstdint>
+#include <stdexcept>
+#include <string>
+
+namespace fbpcf::demographic_metrics {
+
+/**
+ * Grouping of the rows by a small-cardinality categorical column, e.g. a
+ * region code or an age band, for the per group count, sum and average of a
+ * value column ("age" or "wealth").
+ *
+ * Categories are the values 0 .. numCategories - 1 of the column, rows with
+ * other values are in no group. Text form: "column:numCategories", e.g.
+ * "region:16".
+ */
+struct GroupBySpec {
+  std::string column;
+  uint32_t numCategories = 0;
+  std::string valueColumn = "age";
+
+  bool enabled() const {
+    return numCategories > 0;
+  }
+
+  static GroupBySpec parse(
+      const std::string& text,
+      const std::string& valueColumn = "age") {
+    GroupBySpec spec;
+    spec.valueColumn = valueColumn;
+    if (text.empty()) {
+      return spec;
+    }
+
+    auto separator = text.rfind(':');
+    if (separator == std::string::npos || separator == 0) {
+      throw std::invalid_argument(
+          "Group by has to be column:numCategories, got " + text);
+    }
+    spec.column = text.substr(0, separator);
+    spec.numCategories = std::stoul(text.substr(separator + 1));
+    if (spec.numCategories == 0) {
+      throw std::invalid_argument("Group by needs at least one category: " + text);
+    }
+    if (valueColumn != "age" && valueColumn != "wealth") {
+      throw std::invalid_argument("Unknown group value column: " + valueColumn);
+    }
+    return spec;
+  }
+
+  std::string toString() const {
+    return enabled()
+        ? column + ":" + std::to_string(numCategories) + "/" + valueColumn
+        : std::string();
+  }
+};
+
+} // namespace fbpcf::demographic_metrics
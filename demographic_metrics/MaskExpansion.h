@@ -0,0 +1,45 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+#include <glog/logging.h>
+#include "fbpcf/engine/util/IPrg.h"
+
+namespace fbpcf::demographic_metrics {
+
+// IPrg::getRandomBytes takes a uint32_t size, larger requests are split into
+// chunks of at most this many bytes
+constexpr size_t kMaxPrgChunkBytes = size_t(1) << 31;
+
+// Fills size masks with bytes of the prg, chunk by chunk. A truncated draw
+// would leave masks at zero and open the rows they hide, so every byte is
+// checked to be filled.
+template <typename T>
+std::vector<T> expandMasks(
+    engine::util::IPrg& prg,
+    size_t size,
+    size_t maxChunkBytes = kMaxPrgChunkBytes) {
+  // whole masks per chunk
+  auto chunkBytes = std::max(maxChunkBytes / sizeof(T), size_t(1)) * sizeof(T);
+  auto totalBytes = size * sizeof(T);
+
+  std::vector<T> masks(size);
+  auto out = reinterpret_cast<unsigned char*>(masks.data());
+  size_t filled = 0;
+  while (filled < totalBytes) {
+    auto request = std::min(chunkBytes, totalBytes - filled);
+    auto randomBytes = prg.getRandomBytes(static_cast<uint32_t>(request));
+    CHECK_EQ(randomBytes.size(), request)
+        << "The prg returned the wrong number of bytes";
+    std::memcpy(out + filled, randomBytes.data(), request);
+    filled += request;
+  }
+  CHECK_EQ(filled, totalBytes);
+  return masks;
+}
+
+} // namespace fbpcf::demographic_metrics
@@ -0,0 +1,182 @@
+#pragma once
+
+#include <cstdint>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <folly/dynamic.h>
+
+namespace fbpcf::demographic_metrics {
+
+/**
+ * Aggregates of the valid ages of one or more shards: row count, sum, sum of
+ * squares, histogram bin counts and group by counts and sums.
+ *
+ * Before they are revealed every party holds an additive share (mod 2^64) of
+ * each value: alice a masked sum, bob the sum of his masks. Shares of
+ * different shards can be merged locally by adding them, so partial results
+ * can be stored and combined later without either party learning them.
+ * 64 bits hold the sum of squares of any realistic number of rows, unlike
+ * the 32-bit values of the rest of the game.
+ */
+struct PartialAggregates {
+  // Version of the json written by toDynamic. Version 1 (no version key) had
+  // shares mod 2^32, they can't be merged with the current ones. Version 2
+  // didn't record the input and metrics it was calculated for.
+  static constexpr int64_t kVersion = 3;
+
+  uint64_t count = 0;
+  uint64_t sum = 0;
+  uint64_t sumOfSquares = 0;
+  std::vector<uint64_t> histogram;
+  std::vector<uint64_t> groupCounts;
+  std::vector<uint64_t> groupSums;
+
+  // What the aggregates of a stored shard were calculated from, see
+  // checkSource. Not merged, merged aggregates are never stored.
+  std::string inputPath;
+  std::string inputFingerprint;
+  std::string metricsKey;
+
+  // Throws std::invalid_argument unless the aggregates were calculated from
+  // this input path and fingerprint (see getInputFingerprint) for these
+  // metrics. An input without a fingerprint never matches, a rewritten one
+  // can't be told apart from the original.
+  void checkSource(
+      const std::string& path,
+      const std::string& fingerprint,
+      const std::string& metrics) const {
+    if (fingerprint.empty()) {
+      throw std::invalid_argument("The input " + path + " has no fingerprint");
+    }
+    if (path != inputPath) {
+      throw std::invalid_argument(
+          "Calculated from another input " + inputPath);
+    }
+    if (fingerprint != inputFingerprint) {
+      throw std::invalid_argument("The input changed since");
+    }
+    if (metrics != metricsKey) {
+      throw std::invalid_argument(
+          "Calculated for other metrics " + metricsKey);
+    }
+  }
+
+  void merge(const PartialAggregates& other) {
+    count += other.count;
+    sum += other.sum;
+    sumOfSquares += other.sumOfSquares;
+
+    mergeValues(histogram, other.histogram, "histograms with different bins");
+    mergeValues(groupCounts, other.groupCounts, "groups with different categories");
+    mergeValues(groupSums, other.groupSums, "groups with different categories");
+  }
+
+  // Only meaningful once revealed, 0 without rows
+  float average() const {
+    if (count == 0) {
+      return 0;
+    }
+    return sum / double(count);
+  }
+
+  // Per category averages of a group by, only meaningful once revealed. 0
+  // for the categories without rows, most categories of a shard can be
+  // empty.
+  std::vector<float> groupAverages() const {
+    std::vector<float> averages;
+    for (size_t i = 0; i < groupCounts.size(); ++i) {
+      averages.push_back(
+          groupCounts.at(i) == 0 ? 0
+                                 : groupSums.at(i) / double(groupCounts.at(i)));
+    }
+    return averages;
+  }
+
+  // Unbiased estimator, only meaningful once revealed. 0 with fewer than two
+  // rows, where it would be a NaN or divide by 2^64 - 1.
+  float variance() const {
+    if (count < 2) {
+      return 0;
+    }
+    double mean = sum / double(count);
+    return (sumOfSquares - count * mean * mean) / double(count - 1);
+  }
+
+  // Shares are uniform over 2^64, json integers are signed: the values are
+  // stored as their two's complement
+  folly::dynamic toDynamic() const {
+    return folly::dynamic::object("version", kVersion)("count", toInt(count))(
+        "sum", toInt(sum))("sumOfSquares", toInt(sumOfSquares))(
+        "histogram", toArray(histogram))("groupCounts", toArray(groupCounts))(
+        "groupSums", toArray(groupSums))("inputPath", inputPath)(
+        "inputFingerprint", inputFingerprint)("metricsKey", metricsKey);
+  }
+
+  // Throws std::invalid_argument for aggregates stored by another version
+  static PartialAggregates fromDynamic(const folly::dynamic& object) {
+    auto version = object.get_ptr("version");
+    if (!version || version->asInt() != kVersion) {
+      throw std::invalid_argument(
+          "Partial aggregates of version " +
+          (version ? std::to_string(version->asInt()) : std::string("1")) +
+          " can't be used, version " + std::to_string(kVersion) +
+          " is needed");
+    }
+    PartialAggregates aggregates;
+    aggregates.count = object["count"].asInt();
+    aggregates.sum = object["sum"].asInt();
+    aggregates.sumOfSquares = object["sumOfSquares"].asInt();
+    aggregates.histogram = fromArray(object, "histogram");
+    aggregates.groupCounts = fromArray(object, "groupCounts");
+    aggregates.groupSums = fromArray(object, "groupSums");
+    aggregates.inputPath = object["inputPath"].asString();
+    aggregates.inputFingerprint = object["inputFingerprint"].asString();
+    aggregates.metricsKey = object["metricsKey"].asString();
+    return aggregates;
+  }
+
+ private:
+  static int64_t toInt(uint64_t value) {
+    return static_cast<int64_t>(value);
+  }
+
+  static void mergeValues(
+      std::vector<uint64_t>& values,
+      const std::vector<uint64_t>& other,
+      const char* mismatch) {
+    if (values.empty()) {
+      values = other;
+    } else if (!other.empty()) {
+      if (values.size() != other.size()) {
+        throw std::invalid_argument(std::string("Can't merge ") + mismatch);
+      }
+      for (size_t i = 0; i < values.size(); ++i) {
+        values[i] += other[i];
+      }
+    }
+  }
+
+  static folly::dynamic toArray(const std::vector<uint64_t>& values) {
+    auto array = folly::dynamic::array();
+    for (auto value : values) {
+      array.push_back(toInt(value));
+    }
+    return array;
+  }
+
+  static std::vector<uint64_t> fromArray(
+      const folly::dynamic& object,
+      const char* key) {
+    std::vector<uint64_t> values;
+    if (auto array = object.get_ptr(key)) {
+      for (const auto& value : *array) {
+        values.push_back(value.asInt());
+      }
+    }
+    return values;
+  }
+};
+
+} // namespace fbpcf::demographic_metrics
@@ -0,0 +1,279 @@
+#pragma once
+
+#include <immintrin.h>
+#include <cstddef>
+#include <cstdint>
+#include <numeric>
+#include <vector>
+
+#include <glog/logging.h>
+
+namespace fbpcf::demographic_metrics {
+
+/**
+ * Reduction kernels for the plaintext side of the aggregation protocol
+ * (opened shares, masks and local column sums). Every kernel is compiled for
+ * AVX-512, AVX2 and plain x86-64, and the widest one the CPU supports is
+ * picked at runtime, so a generic build still uses the vector units of the
+ * host it runs on. The scalar loop also handles the tail of the vector
+ * kernels.
+ */
+
+enum class SimdLevel { Scalar, Avx2, Avx512 };
+
+// Widest instruction set of the CPU, detected once
+inline SimdLevel getSimdLevel() {
+  static const SimdLevel level = [] {
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f")) {
+      return SimdLevel::Avx512;
+    }
+    if (__builtin_cpu_supports("avx2")) {
+      return SimdLevel::Avx2;
+    }
+    return SimdLevel::Scalar;
+  }();
+  return level;
+}
+
+// Every CPU with AVX-512 has AVX2 as well
+inline bool isSimdLevelSupported(SimdLevel level) {
+  return level <= getSimdLevel();
+}
+
+namespace detail {
+
+template <typename Sum, typename Value>
+inline Sum sumScalar(const Value* data, size_t i, size_t size, Sum sum) {
+  for (; i < size; ++i) {
+    sum += data[i];
+  }
+  return sum;
+}
+
+// Horizontal sums of the lanes. The lanes are added with vector adds, which
+// wrap around, and the last two 64-bit lanes as unsigned values: the
+// reduce_add intrinsics and adding the signed lanes overflow signed integers.
+__attribute__((target("avx2"))) inline uint32_t reduceAdd32(__m256i acc) {
+  __m128i half = _mm_add_epi32(
+      _mm256_castsi256_si128(acc), _mm256_extracti128_si256(acc, 1));
+  half = _mm_add_epi32(half, _mm_shuffle_epi32(half, _MM_SHUFFLE(1, 0, 3, 2)));
+  half = _mm_add_epi32(half, _mm_shuffle_epi32(half, _MM_SHUFFLE(2, 3, 0, 1)));
+  return _mm_cvtsi128_si32(half);
+}
+
+__attribute__((target("avx2"))) inline uint64_t reduceAdd64(__m256i acc) {
+  __m128i half = _mm_add_epi64(
+      _mm256_castsi256_si128(acc), _mm256_extracti128_si256(acc, 1));
+  return uint64_t(_mm_cvtsi128_si64(half)) +
+      uint64_t(_mm_extract_epi64(half, 1));
+}
+
+__attribute__((target("avx512f"))) inline uint32_t reduceAdd32(__m512i acc) {
+  return reduceAdd32(_mm256_add_epi32(
+      _mm512_castsi512_si256(acc), _mm512_extracti64x4_epi64(acc, 1)));
+}
+
+__attribute__((target("avx512f"))) inline uint64_t reduceAdd64(__m512i acc) {
+  return reduceAdd64(_mm256_add_epi64(
+      _mm512_castsi512_si256(acc), _mm512_extracti64x4_epi64(acc, 1)));
+}
+
+__attribute__((target("avx512f"))) inline uint32_t sumMod32Avx512(
+    const uint32_t* data,
+    size_t size) {
+  size_t i = 0;
+  __m512i acc0 = _mm512_setzero_si512();
+  __m512i acc1 = _mm512_setzero_si512();
+  for (; i + 32 <= size; i += 32) {
+    acc0 = _mm512_add_epi32(acc0, _mm512_loadu_si512(data + i));
+    acc1 = _mm512_add_epi32(acc1, _mm512_loadu_si512(data + i + 16));
+  }
+  uint32_t sum = reduceAdd32(_mm512_add_epi32(acc0, acc1));
+  return sumScalar(data, i, size, sum);
+}
+
+__attribute__((target("avx2"))) inline uint32_t sumMod32Avx2(
+    const uint32_t* data,
+    size_t size) {
+  size_t i = 0;
+  // independent accumulators hide the latency of the adds
+  __m256i acc0 = _mm256_setzero_si256();
+  __m256i acc1 = _mm256_setzero_si256();
+  __m256i acc2 = _mm256_setzero_si256();
+  __m256i acc3 = _mm256_setzero_si256();
+  for (; i + 32 <= size; i += 32) {
+    acc0 = _mm256_add_epi32(acc0, _mm256_loadu_si256((const __m256i*)(data + i)));
+    acc1 = _mm256_add_epi32(acc1, _mm256_loadu_si256((const __m256i*)(data + i + 8)));
+    acc2 = _mm256_add_epi32(acc2, _mm256_loadu_si256((const __m256i*)(data + i + 16)));
+    acc3 = _mm256_add_epi32(acc3, _mm256_loadu_si256((const __m256i*)(data + i + 24)));
+  }
+  uint32_t sum = reduceAdd32(_mm256_add_epi32(
+      _mm256_add_epi32(acc0, acc1), _mm256_add_epi32(acc2, acc3)));
+  return sumScalar(data, i, size, sum);
+}
+
+__attribute__((target("avx512f"))) inline uint64_t sumWiden64Avx512(
+    const uint32_t* data,
+    size_t size) {
+  size_t i = 0;
+  __m512i acc0 = _mm512_setzero_si512();
+  __m512i acc1 = _mm512_setzero_si512();
+  for (; i + 16 <= size; i += 16) {
+    acc0 = _mm512_add_epi64(
+        acc0, _mm512_cvtepu32_epi64(_mm256_loadu_si256((const __m256i*)(data + i))));
+    acc1 = _mm512_add_epi64(
+        acc1, _mm512_cvtepu32_epi64(_mm256_loadu_si256((const __m256i*)(data + i + 8))));
+  }
+  uint64_t sum = reduceAdd64(_mm512_add_epi64(acc0, acc1));
+  return sumScalar(data, i, size, sum);
+}
+
+__attribute__((target("avx2"))) inline uint64_t sumWiden64Avx2(
+    const uint32_t* data,
+    size_t size) {
+  size_t i = 0;
+  __m256i acc0 = _mm256_setzero_si256();
+  __m256i acc1 = _mm256_setzero_si256();
+  for (; i + 8 <= size; i += 8) {
+    acc0 = _mm256_add_epi64(
+        acc0, _mm256_cvtepu32_epi64(_mm_loadu_si128((const __m128i*)(data + i))));
+    acc1 = _mm256_add_epi64(
+        acc1, _mm256_cvtepu32_epi64(_mm_loadu_si128((const __m128i*)(data + i + 4))));
+  }
+  uint64_t sum = reduceAdd64(_mm256_add_epi64(acc0, acc1));
+  return sumScalar(data, i, size, sum);
+}
+
+__attribute__((target("avx512f"))) inline uint64_t sumMod64Avx512(
+    const uint64_t* data,
+    size_t size) {
+  size_t i = 0;
+  __m512i acc0 = _mm512_setzero_si512();
+  __m512i acc1 = _mm512_setzero_si512();
+  for (; i + 16 <= size; i += 16) {
+    acc0 = _mm512_add_epi64(acc0, _mm512_loadu_si512(data + i));
+    acc1 = _mm512_add_epi64(acc1, _mm512_loadu_si512(data + i + 8));
+  }
+  uint64_t sum = reduceAdd64(_mm512_add_epi64(acc0, acc1));
+  return sumScalar(data, i, size, sum);
+}
+
+__attribute__((target("avx2"))) inline uint64_t sumMod64Avx2(
+    const uint64_t* data,
+    size_t size) {
+  size_t i = 0;
+  __m256i acc0 = _mm256_setzero_si256();
+  __m256i acc1 = _mm256_setzero_si256();
+  for (; i + 8 <= size; i += 8) {
+    acc0 = _mm256_add_epi64(acc0, _mm256_loadu_si256((const __m256i*)(data + i)));
+    acc1 = _mm256_add_epi64(acc1, _mm256_loadu_si256((const __m256i*)(data + i + 4)));
+  }
+  uint64_t sum = reduceAdd64(_mm256_add_epi64(acc0, acc1));
+  return sumScalar(data, i, size, sum);
+}
+
+} // namespace detail
+
+// Sum mod 2^32, i.e. what adding uint32_t shares in a loop gives. The level
+// is only passed to force a kernel, e.g. in tests, it has to be one the CPU
+// supports.
+inline uint32_t sumMod32(
+    const uint32_t* data,
+    size_t size,
+    SimdLevel level = getSimdLevel()) {
+  switch (level) {
+    case SimdLevel::Avx512:
+      return detail::sumMod32Avx512(data, size);
+    case SimdLevel::Avx2:
+      return detail::sumMod32Avx2(data, size);
+    default:
+      return detail::sumScalar(data, 0, size, uint32_t(0));
+  }
+}
+
+// Exact sum of uint32_t values, every value is widened to 64 bits first
+inline uint64_t sumWiden64(
+    const uint32_t* data,
+    size_t size,
+    SimdLevel level = getSimdLevel()) {
+  switch (level) {
+    case SimdLevel::Avx512:
+      return detail::sumWiden64Avx512(data, size);
+    case SimdLevel::Avx2:
+      return detail::sumWiden64Avx2(data, size);
+    default:
+      return detail::sumScalar(data, 0, size, uint64_t(0));
+  }
+}
+
+// Sum mod 2^64 of uint64_t values, e.g. of 64-bit products and their masks
+inline uint64_t sumMod64(
+    const uint64_t* data,
+    size_t size,
+    SimdLevel level = getSimdLevel()) {
+  switch (level) {
+    case SimdLevel::Avx512:
+      return detail::sumMod64Avx512(data, size);
+    case SimdLevel::Avx2:
+      return detail::sumMod64Avx2(data, size);
+    default:
+      return detail::sumScalar(data, 0, size, uint64_t(0));
+  }
+}
+
+inline uint32_t sumMod32(
+    const std::vector<uint32_t>& data,
+    SimdLevel level = getSimdLevel()) {
+  return sumMod32(data.data(), data.size(), level);
+}
+
+inline uint64_t sumWiden64(
+    const std::vector<uint32_t>& data,
+    SimdLevel level = getSimdLevel()) {
+  return sumWiden64(data.data(), data.size(), level);
+}
+
+// Sums mod 2^32 of consecutive segments of data, e.g. of several batches
+// concatenated for a single reveal. The segment sizes must add up to the
+// size of data.
+inline std::vector<uint32_t> segmentedSumMod32(
+    const std::vector<uint32_t>& data,
+    const std::vector<uint32_t>& segmentSizes,
+    SimdLevel level = getSimdLevel()) {
+  CHECK_EQ(
+      std::accumulate(segmentSizes.begin(), segmentSizes.end(), size_t(0)),
+      data.size())
+      << "The segments don't cover the data";
+  std::vector<uint32_t> sums;
+  sums.reserve(segmentSizes.size());
+
+  size_t offset = 0;
+  for (auto segmentSize : segmentSizes) {
+    sums.push_back(sumMod32(data.data() + offset, segmentSize, level));
+    offset += segmentSize;
+  }
+  return sums;
+}
+
+// Same as segmentedSumMod32 for 64-bit values
+inline std::vector<uint64_t> segmentedSumMod64(
+    const std::vector<uint64_t>& data,
+    const std::vector<uint32_t>& segmentSizes,
+    SimdLevel level = getSimdLevel()) {
+  CHECK_EQ(
+      std::accumulate(segmentSizes.begin(), segmentSizes.end(), size_t(0)),
+      data.size())
+      << "The segments don't cover the data";
+  std::vector<uint64_t> sums;
+  sums.reserve(segmentSizes.size());
+
+  size_t offset = 0;
+  for (auto segmentSize : segmentSizes) {
+    sums.push_back(sumMod64(data.data() + offset, segmentSize, level));
+    offset += segmentSize;
+  }
+  return sums;
+}
+
+} // namespace fbpcf::demographic_metrics
@@ -0,0 +1,148 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include <folly/dynamic.h>
+#include <folly/json.h>
+#include "fbpcf/io/api/FileIOWrappers.h"
+
+namespace fbpcf::demographic_metrics {
+
+/**
+ * Collects begin/end events in the Chrome trace-event format
+ * (chrome://tracing, Perfetto). Timestamps are wall-clock microseconds since
+ * the unix epoch shifted by the clock offset measured against the other
+ * party, so the traces written by Alice and Bob can be loaded side by side
+ * and lined up: each party is its own "pid" and each thread that records an
+ * event gets its own "tid".
+ *
+ * The recorder is shared between all game threads of a party, so every
+ * method is thread safe.
+ */
+class TraceRecorder {
+ public:
+  explicit TraceRecorder(int party) : party_{party} {}
+
+  // Shift of this party's clock to the other party's, e.g. from
+  // measureClockOffset. Applied to every event when the trace is written, so
+  // it can be set after the first events are recorded.
+  void setClockOffset(int64_t clockOffsetUs, int64_t roundTripUs) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    clockOffsetUs_ = clockOffsetUs;
+    clockRoundTripUs_ = roundTripUs;
+  }
+
+  void begin(const std::string& name, const std::string& category) {
+    record(name, category, 'B');
+  }
+
+  void end(const std::string& name, const std::string& category) {
+    record(name, category, 'E');
+  }
+
+  // Number of begin events of a category, e.g. of "reveal"
+  size_t countBegins(const std::string& category) const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    size_t count = 0;
+    for (const auto& event : events_) {
+      count += event.phase == 'B' && event.category == category;
+    }
+    return count;
+  }
+
+  folly::dynamic toDynamic() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto traceEvents = folly::dynamic::array();
+
+    traceEvents.push_back(folly::dynamic::object("name", "process_name")(
+        "ph", "M")("pid", party_)(
+        "args",
+        folly::dynamic::object("name", party_ == 0 ? "Alice" : "Bob")));
+
+    for (const auto& event : events_) {
+      traceEvents.push_back(folly::dynamic::object("name", event.name)(
+          "cat", event.category)("ph", std::string(1, event.phase))(
+          "ts", event.timestampUs + clockOffsetUs_)("pid", party_)("tid", event.threadId));
+    }
+    return folly::dynamic::object("traceEvents", traceEvents)(
+        "displayTimeUnit", "ms")(
+        "otherData",
+        folly::dynamic::object("party", party_)(
+            "clockOffsetUs", clockOffsetUs_)(
+            "clockRoundTripUs", clockRoundTripUs_));
+  }
+
+  void writeToFile(const std::string& path) const {
+    fbpcf::io::FileIOWrappers::writeFile(path, folly::toJson(toDynamic()));
+  }
+
+ private:
+  struct Event {
+    std::string name;
+    std::string category;
+    char phase;
+    int64_t timestampUs;
+    int64_t threadId;
+  };
+
+  void record(const std::string& name, const std::string& category, char phase) {
+    auto timestampUs = std::chrono::duration_cast<std::chrono::microseconds>(
+                           std::chrono::system_clock::now().time_since_epoch())
+                           .count();
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    // small sequential ids are much easier to read in the viewer than
+    // hashed std::thread::ids
+    auto threadId = threadIds_
+                        .emplace(std::this_thread::get_id(), threadIds_.size())
+                        .first->second;
+    events_.push_back({name, category, phase, timestampUs, threadId});
+  }
+
+  int party_;
+  int64_t clockOffsetUs_ = 0;
+  int64_t clockRoundTripUs_ = 0;
+  mutable std::mutex mutex_;
+  std::unordered_map<std::thread::id, int64_t> threadIds_;
+  std::vector<Event> events_;
+};
+
+// Emits a begin event on construction and the matching end event when it
+// goes out of scope. Does nothing if tracing is disabled (recorder is null).
+class TraceScope {
+ public:
+  TraceScope(
+      std::shared_ptr<TraceRecorder> recorder,
+      std::string name,
+      std::string category)
+      : recorder_{std::move(recorder)},
+        name_{std::move(name)},
+        category_{std::move(category)} {
+    if (recorder_) {
+      recorder_->begin(name_, category_);
+    }
+  }
+
+  ~TraceScope() {
+    if (recorder_) {
+      recorder_->end(name_, category_);
+    }
+  }
+
+  TraceScope(const TraceScope&) = delete;
+  TraceScope& operator=(const TraceScope&) = delete;
+
+ private:
+  std::shared_ptr<TraceRecorder> recorder_;
+  std::string name_;
+  std::string category_;
+};
+
+} // namespace fbpcf::demographic_metrics
@@ -0,0 +1,139 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <limits>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "folly/String.h"
+
+namespace fbpcf::demographic_metrics {
+
+/**
+ * Which rows demographicMetricsValidate keeps. Every rule restricts one
+ * column ("age", "wealth" or "gender") to a range and optionally to a set of
+ * allowed values; a row is valid if it satisfies all the rules.
+ *
+ * Text form, rules separated by commas:
+ *
+ *   age=..199,wealth=0..10000000,gender=0|1
+ *
+ * "min..max" is an inclusive range where either bound may be left out,
+ * "a|b|c" a set of allowed values.
+ */
+struct ValidationRule {
+  std::string column;
+  uint32_t min = 0;
+  uint32_t max = std::numeric_limits<uint32_t>::max();
+  // if not empty, the value has to be one of these
+  std::vector<uint32_t> allowed;
+};
+
+struct ValidationSpec {
+  std::vector<ValidationRule> rules;
+  // keep the validity of every row secret instead of revealing it and
+  // removing the invalid rows
+  bool oblivious = false;
+
+  // The check validation always did: age < 200
+  static ValidationSpec defaultSpec() {
+    ValidationSpec spec;
+    spec.rules.push_back({"age", 0, 199, {}});
+    return spec;
+  }
+
+  static ValidationSpec parse(const std::string& text, bool oblivious = false) {
+    ValidationSpec spec;
+    spec.oblivious = oblivious;
+
+    std::vector<std::string> rules;
+    folly::split(',', text, rules, true);
+    for (const auto& ruleText : rules) {
+      auto separator = ruleText.find('=');
+      if (separator == std::string::npos) {
+        throw std::invalid_argument("Malformed validation rule: " + ruleText);
+      }
+
+      ValidationRule rule;
+      rule.column = folly::trimWhitespace(ruleText.substr(0, separator)).str();
+      if (rule.column != "age" && rule.column != "wealth" &&
+          rule.column != "gender") {
+        throw std::invalid_argument(
+            "Unknown column in validation rule: " + ruleText);
+      }
+
+      auto condition = ruleText.substr(separator + 1);
+      auto range = condition.find("..");
+      if (range != std::string::npos) {
+        auto low = condition.substr(0, range);
+        auto high = condition.substr(range + 2);
+        if (!low.empty()) {
+          rule.min = parseValue(low);
+        }
+        if (!high.empty()) {
+          rule.max = parseValue(high);
+        }
+        if (rule.min > rule.max) {
+          throw std::invalid_argument(
+              "Empty range in validation rule: " + ruleText);
+        }
+      } else {
+        std::vector<std::string> values;
+        folly::split('|', condition, values);
+        for (const auto& value : values) {
+          rule.allowed.push_back(parseValue(value));
+        }
+      }
+      spec.rules.push_back(rule);
+    }
+    return spec;
+  }
+
+  // Largest value of the column a valid row can have, the 32-bit maximum if
+  // no rule bounds it
+  uint32_t maxValue(const std::string& column) const {
+    auto max = std::numeric_limits<uint32_t>::max();
+    for (const auto& rule : rules) {
+      if (rule.column == column) {
+        max = std::min(
+            max,
+            rule.allowed.empty()
+                ? rule.max
+                : *std::max_element(rule.allowed.begin(), rule.allowed.end()));
+      }
+    }
+    return max;
+  }
+
+  // Text form that parses back to the same rules
+  std::string toString() const {
+    std::string text;
+    for (const auto& rule : rules) {
+      if (!text.empty()) {
+        text += ",";
+      }
+      text += rule.column + "=";
+      if (!rule.allowed.empty()) {
+        for (size_t i = 0; i < rule.allowed.size(); ++i) {
+          text += (i > 0 ? "|" : "") + std::to_string(rule.allowed[i]);
+        }
+      } else {
+        text += std::to_string(rule.min) + ".." + std::to_string(rule.max);
+      }
+    }
+    return text;
+  }
+
+ private:
+  static uint32_t parseValue(const std::string& text) {
+    auto value = std::stoull(folly::trimWhitespace(text).str());
+    if (value > std::numeric_limits<uint32_t>::max()) {
+      throw std::out_of_range("Validation bound exceeds 32 bits: " + text);
+    }
+    return value;
+  }
+};
+
+} // namespace fbpcf::demographic_metrics
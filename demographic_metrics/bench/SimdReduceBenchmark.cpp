@@ -0,0 +1,80 @@
+#include <random>
+#include <vector>
+
+#include <gflags/gflags.h>
+#include "folly/Benchmark.h"
+#include "folly/init/Init.h"
+
+#include "../SimdReduce.h"
+
+namespace fbpcf::demographic_metrics {
+
+// 10M rows, the size of our large shards
+const size_t kNumRows = 10'000'000;
+const size_t kNumBins = 6;
+
+const std::vector<uint32_t>& getRows() {
+  static const std::vector<uint32_t> rows = [] {
+    std::mt19937 e(42);
+    std::vector<uint32_t> v(kNumRows);
+    for (auto& item : v) {
+      item = e();
+    }
+    return v;
+  }();
+  return rows;
+}
+
+BENCHMARK(ScalarSumMod32) {
+  uint32_t sum = 0;
+  for (auto item : getRows()) {
+    sum += item;
+  }
+  folly::doNotOptimizeAway(sum);
+}
+
+BENCHMARK_RELATIVE(SimdSumMod32) {
+  folly::doNotOptimizeAway(sumMod32(getRows()));
+}
+
+BENCHMARK_DRAW_LINE();
+
+BENCHMARK(ScalarSumWiden64) {
+  uint64_t sum = 0;
+  for (auto item : getRows()) {
+    sum += item;
+  }
+  folly::doNotOptimizeAway(sum);
+}
+
+BENCHMARK_RELATIVE(SimdSumWiden64) {
+  folly::doNotOptimizeAway(sumWiden64(getRows()));
+}
+
+BENCHMARK_DRAW_LINE();
+
+BENCHMARK(ScalarSegmentedSumMod32) {
+  std::vector<uint32_t> sums(kNumBins);
+  auto binSize = kNumRows / kNumBins;
+  for (size_t bin = 0; bin < kNumBins; ++bin) {
+    for (size_t i = bin * binSize; i < (bin + 1) * binSize; ++i) {
+      sums[bin] += getRows()[i];
+    }
+  }
+  folly::doNotOptimizeAway(sums);
+}
+
+BENCHMARK_RELATIVE(SimdSegmentedSumMod32) {
+  std::vector<uint32_t> binSizes(kNumBins, kNumRows / kNumBins);
+  folly::doNotOptimizeAway(segmentedSumMod32(getRows(), binSizes));
+}
+
+} // namespace fbpcf::demographic_metrics
+
+int main(int argc, char* argv[]) {
+  folly::init(&argc, &argv);
+  gflags::ParseCommandLineFlags(&argc, &argv, true);
+  fbpcf::demographic_metrics::getRows();
+  folly::runBenchmarks();
+  return 0;
+}
@@ -6,6 +6,7 @@
 #include "folly/logging/xlog.h"
 
 #include "./DemographicMetricsGame.h"
+#include "./SimdReduce.h"
 #include "fbpcf/engine/communication/SocketPartyCommunicationAgentFactory.h"
 #include "fbpcf/util/MetricCollector.h"
 
@@ -58,14 +59,14 @@ int main(int argc, char* argv[]) {
   typename fbpcf::demographic_metrics::DemographicMetricsGame<1>::
       DemographicInfo myInfo = {
           .ageShare = std::vector<uint32_t>(size),
-          .genderShare = std::vector<bool>(size),
+          .genderShare = std::vector<uint32_t>(size),
           .wealthShare = std::vector<uint32_t>(size),
       };
 
   typename fbpcf::demographic_metrics::DemographicMetricsGame<1>::
       DemographicInfo dummyInfo = {
           .ageShare = std::vector<uint32_t>(size),
-          .genderShare = std::vector<bool>(size),
+          .genderShare = std::vector<uint32_t>(size),
           .wealthShare = std::vector<uint32_t>(size),
       };
 
@@ -78,8 +79,8 @@ int main(int argc, char* argv[]) {
     // item = std::max(int(45 * std::normal_distribution<float>(0.5, 0.6)(e)), 10);
     item = dist1(e);
   }
-  for (auto item : myInfo.genderShare) { 
-    item = (bool) (rand() % 2);
+  for (auto& item : myInfo.genderShare) {
+    item = rand() % 2;
   }
   for (auto& item : myInfo.wealthShare) {
     item = dist2(e);
@@ -88,10 +89,8 @@ int main(int argc, char* argv[]) {
   myInfo.ageShare.at(1) = 291230;
   myInfo.ageShare.at(5) = 111111;
 
-  auto sum = 0;
-    for (uint32_t i: myInfo.ageShare)
-     sum += i;
-      
+  auto sum = fbpcf::demographic_metrics::sumWiden64(myInfo.ageShare);
+
   XLOG(INFO, "My shares: ", sum);
 
   try {
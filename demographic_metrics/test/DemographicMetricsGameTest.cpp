@@ -0,0 +1,611 @@
+#include "../DemographicMetricsGame.h"
+#include <gtest/gtest.h>
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <future>
+#include <limits>
+#include <memory>
+#include <random>
+#include <string>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "fbpcf/engine/communication/test/AgentFactoryCreationHelper.h"
+#include "fbpcf/scheduler/SchedulerHelper.h"
+#include "fbpcf/test/TestHelper.h"
+
+namespace fbpcf::demographic_metrics {
+
+const bool unsafe = true;
+
+// Plaintext columns of the joint database
+struct Columns {
+  std::vector<uint32_t> age;
+  std::vector<uint32_t> gender;
+  std::vector<uint32_t> wealth;
+  // a categorical column for group by, left out if empty
+  std::vector<uint32_t> region;
+
+  size_t size() const {
+    return age.size();
+  }
+};
+
+// Alice's and Bob's additive shares (mod 2^32) of the columns
+struct SharedColumns {
+  Columns alice;
+  Columns bob;
+};
+
+std::pair<std::vector<uint32_t>, std::vector<uint32_t>> share(
+    const std::vector<uint32_t>& values,
+    std::mt19937_64& e) {
+  std::vector<uint32_t> aliceShares;
+  std::vector<uint32_t> bobShares;
+  for (auto value : values) {
+    uint32_t mask = e();
+    aliceShares.push_back(value - mask);
+    bobShares.push_back(mask);
+  }
+  return {aliceShares, bobShares};
+}
+
+SharedColumns share(const Columns& columns, uint64_t seed) {
+  std::mt19937_64 e(seed);
+  SharedColumns shares;
+  std::tie(shares.alice.age, shares.bob.age) = share(columns.age, e);
+  std::tie(shares.alice.gender, shares.bob.gender) = share(columns.gender, e);
+  std::tie(shares.alice.wealth, shares.bob.wealth) = share(columns.wealth, e);
+  std::tie(shares.alice.region, shares.bob.region) = share(columns.region, e);
+  return shares;
+}
+
+template <typename DemographicInfo>
+DemographicInfo toDemographicInfo(const Columns& columns) {
+  DemographicInfo info;
+  info.ageShare = columns.age;
+  info.genderShare = columns.gender;
+  info.wealthShare = columns.wealth;
+  if (!columns.region.empty()) {
+    info.categoryShares["region"] = columns.region;
+  }
+  return info;
+}
+
+// Calls metric with the databases of both parties the way the app does:
+// this party's shares and an all zero dummy of the other party's
+template <typename Game, typename Metric>
+auto callWithShares(const SharedColumns& shares, int party, Metric metric) {
+  using DemographicInfo = typename Game::DemographicInfo;
+  auto mine =
+      toDemographicInfo<DemographicInfo>(party == 0 ? shares.alice : shares.bob);
+  auto numRows = shares.alice.size();
+  auto dummy = toDemographicInfo<DemographicInfo>(Columns{
+      std::vector<uint32_t>(numRows),
+      std::vector<uint32_t>(numRows),
+      std::vector<uint32_t>(numRows),
+      std::vector<uint32_t>(shares.alice.region.size())});
+  return party == 0 ? metric(mine, dummy) : metric(dummy, mine);
+}
+
+template <int schedulerId, typename Play>
+auto playParty(
+    int party,
+    std::shared_ptr<fbpcf::scheduler::ISchedulerFactory<unsafe>>
+        schedulerFactory,
+    Play play) {
+  auto game = std::make_unique<DemographicMetricsGame<schedulerId>>(
+      schedulerFactory->create());
+  return play(*game, party);
+}
+
+// Runs play(game, party) for both parties, each on a thread with a game of
+// its own, and returns Alice's and Bob's results
+template <typename Play>
+auto playGame(
+    Play play,
+    fbpcf::SchedulerType schedulerType = fbpcf::SchedulerType::NetworkPlaintext,
+    fbpcf::EngineType engineType = fbpcf::EngineType::EngineWithDummyTuple) {
+  auto communicationAgentFactories =
+      engine::communication::getInMemoryAgentFactory(2);
+  auto schedulerFactory0 = fbpcf::getSchedulerFactory<unsafe>(
+      schedulerType, engineType, 0, *communicationAgentFactories[0]);
+  auto schedulerFactory1 = fbpcf::getSchedulerFactory<unsafe>(
+      schedulerType, engineType, 1, *communicationAgentFactories[1]);
+
+  auto bobResult = std::async(std::launch::async, [&]() {
+    return playParty<1>(1, std::move(schedulerFactory1), play);
+  });
+  auto aliceResult = playParty<0>(0, std::move(schedulerFactory0), play);
+  return std::make_pair(aliceResult, bobResult.get());
+}
+
+// The value percentiles searches for: the smallest v with count(x <= v) >=
+// rank
+std::vector<uint32_t> plaintextPercentiles(
+    std::vector<uint32_t> values,
+    const std::vector<double>& quantiles) {
+  std::sort(values.begin(), values.end());
+  std::vector<uint32_t> results;
+  for (auto quantile : quantiles) {
+    uint64_t rank = std::ceil(quantile * values.size());
+    rank = std::min<uint64_t>(std::max<uint64_t>(rank, 1), values.size());
+    results.push_back(values.at(rank - 1));
+  }
+  return results;
+}
+
+void testPercentiles(
+    const Columns& columns,
+    const std::vector<double>& quantiles,
+    uint32_t maxAge,
+    fbpcf::SchedulerType schedulerType = fbpcf::SchedulerType::NetworkPlaintext,
+    fbpcf::EngineType engineType = fbpcf::EngineType::EngineWithDummyTuple) {
+  auto shares = share(columns, columns.size());
+  auto [alice, bob] = playGame(
+      [&](auto& game, int party) {
+        using Game = std::decay_t<decltype(game)>;
+        auto age = callWithShares<Game>(
+            shares, party, [&](const auto& a, const auto& b) {
+              return game.demographicMetricsAgePercentiles(
+                  a, b, quantiles, party, maxAge);
+            });
+        auto wealth = callWithShares<Game>(
+            shares, party, [&](const auto& a, const auto& b) {
+              return game.demographicMetricsWealthPercentiles(
+                  a, b, quantiles, party);
+            });
+        return std::make_pair(age, wealth);
+      },
+      schedulerType,
+      engineType);
+
+  auto expectedAge = plaintextPercentiles(columns.age, quantiles);
+  auto expectedWealth = plaintextPercentiles(columns.wealth, quantiles);
+  // both parties learn the percentiles
+  EXPECT_EQ(alice.first, expectedAge);
+  EXPECT_EQ(bob.first, expectedAge);
+  EXPECT_EQ(alice.second, expectedWealth);
+  EXPECT_EQ(bob.second, expectedWealth);
+}
+
+Columns randomColumns(size_t size, uint32_t maxAge, uint64_t seed) {
+  std::mt19937_64 e(seed);
+  std::uniform_int_distribution<uint32_t> age(0, maxAge);
+  std::uniform_int_distribution<uint32_t> wealth(0, 0xFFFFFFFF);
+  Columns columns;
+  for (size_t i = 0; i < size; ++i) {
+    columns.age.push_back(age(e));
+    columns.gender.push_back(e() % 2);
+    columns.wealth.push_back(wealth(e));
+  }
+  return columns;
+}
+
+TEST(DemographicMetricsGameTest, testPercentiles) {
+  testPercentiles(
+      randomColumns(37, 199, 1), {0, 0.1, 0.25, 0.5, 0.9, 0.99, 1}, 199);
+}
+
+TEST(DemographicMetricsGameTest, testPercentilesWithTies) {
+  Columns columns{
+      {30, 30, 30, 20, 20, 50, 30},
+      {0, 1, 0, 1, 0, 1, 0},
+      {7, 7, 7, 7, 1, 0xFFFFFFFF, 0xFFFFFFFF}};
+  testPercentiles(columns, {0, 0.2, 0.3, 0.5, 0.7, 0.8, 1}, 199);
+}
+
+TEST(DemographicMetricsGameTest, testPercentilesOfASingleRow) {
+  Columns columns{{42}, {1}, {123456789}};
+  testPercentiles(columns, {0, 0.5, 1}, 199);
+}
+
+TEST(DemographicMetricsGameTest, testPercentilesAboveEightBits) {
+  // ages up to a validation bound of 300 need 9 bisection rounds
+  Columns columns{{299, 256, 300, 17, 255}, {0, 0, 0, 0, 0}, {1, 2, 3, 4, 5}};
+  testPercentiles(columns, {0, 0.4, 0.6, 1}, 300);
+  // without validation any 32-bit age
+  columns.age = {0xFFFFFFFF, 70000, 3, 3, 1u << 31};
+  testPercentiles(columns, {0, 0.5, 1}, std::numeric_limits<uint32_t>::max());
+}
+
+TEST(DemographicMetricsGameTest, testPercentilesWithLazySchedulerAndFERRET) {
+  testPercentiles(
+      randomColumns(20, 199, 2),
+      {0, 0.5, 1},
+      199,
+      fbpcf::SchedulerType::Lazy,
+      fbpcf::EngineType::EngineWithTupleFromFERRET);
+}
+
+void testMinMax(const Columns& columns) {
+  auto shares = share(columns, columns.size());
+  auto [alice, bob] = playGame([&](auto& game, int party) {
+    using Game = std::decay_t<decltype(game)>;
+    return callWithShares<Game>(
+        shares, party, [&](const auto& a, const auto& b) {
+          auto result = game.demographicMetricsMinMax(a, b);
+          return std::vector<uint32_t>{
+              result.minAge, result.maxAge, result.minWealth, result.maxWealth};
+        });
+  });
+
+  std::vector<uint32_t> expected = {
+      *std::min_element(columns.age.begin(), columns.age.end()),
+      *std::max_element(columns.age.begin(), columns.age.end()),
+      *std::min_element(columns.wealth.begin(), columns.wealth.end()),
+      *std::max_element(columns.wealth.begin(), columns.wealth.end())};
+  // both parties learn the four values
+  EXPECT_EQ(alice, expected);
+  EXPECT_EQ(bob, expected);
+}
+
+TEST(DemographicMetricsGameTest, testMinMax) {
+  // odd sizes give a value a bye in some layers of the tournament
+  for (size_t size : {2, 7, 16, 33}) {
+    testMinMax(randomColumns(size, 199, size));
+  }
+}
+
+TEST(DemographicMetricsGameTest, testMinMaxWithTies) {
+  testMinMax(Columns{{50, 10, 50, 10, 50}, {0, 0, 0, 0, 0}, {9, 9, 9, 9, 9}});
+}
+
+TEST(DemographicMetricsGameTest, testMinMaxOfASingleRow) {
+  testMinMax(Columns{{42}, {1}, {0xFFFFFFFF}});
+}
+
+void testAgeWealthMoments(const Columns& columns) {
+  auto shares = share(columns, columns.size());
+  auto [alice, bob] = playGame([&](auto& game, int party) {
+    using Game = std::decay_t<decltype(game)>;
+    return callWithShares<Game>(
+        shares, party, [&](const auto& a, const auto& b) {
+          auto moments = game.demographicMetricsAgeWealthMoments(a, b);
+          return std::vector<uint64_t>{
+              moments.count,
+              moments.sumAge,
+              moments.sumWealth,
+              moments.sumAgeSquared,
+              moments.sumWealthSquared,
+              moments.sumAgeWealth};
+        });
+  });
+
+  // mod 2^64, like the game
+  std::vector<uint64_t> expected(6, 0);
+  for (size_t i = 0; i < columns.size(); ++i) {
+    uint64_t age = columns.age[i];
+    uint64_t wealth = columns.wealth[i];
+    expected[0] += 1;
+    expected[1] += age;
+    expected[2] += wealth;
+    expected[3] += age * age;
+    expected[4] += wealth * wealth;
+    expected[5] += age * wealth;
+  }
+  // the sums are revealed to alice
+  EXPECT_EQ(alice, expected);
+  EXPECT_EQ(bob.at(0), columns.size());
+}
+
+TEST(DemographicMetricsGameTest, testAgeWealthMoments) {
+  testAgeWealthMoments(randomColumns(33, 199, 3));
+}
+
+TEST(DemographicMetricsGameTest, testAgeWealthMomentsWithTies) {
+  testAgeWealthMoments(
+      Columns{{20, 20, 20, 20}, {0, 1, 0, 1}, {0xFFFFFFFF, 0xFFFFFFFF, 5, 5}});
+}
+
+TEST(DemographicMetricsGameTest, testAgeWealthMomentsOfASingleRow) {
+  testAgeWealthMoments(Columns{{42}, {1}, {0xFFFFFFFF}});
+}
+
+TEST(DemographicMetricsGameTest, testCovarianceAndCorrelation) {
+  using Moments = DemographicMetricsGame<0>::AgeWealthMoments;
+  // ages 1, 2, 3 and wealth 10, 30, 20
+  Moments moments{3, 6, 60, 14, 1400, 130};
+  EXPECT_DOUBLE_EQ(moments.wealthAverage(), 20);
+  EXPECT_DOUBLE_EQ(moments.wealthVariance(), 100);
+  EXPECT_DOUBLE_EQ(moments.covariance(), 5);
+  EXPECT_DOUBLE_EQ(moments.correlation(), 0.5);
+
+  // no NaN for fewer than two rows or a constant column
+  Moments none{0, 0, 0, 0, 0, 0};
+  EXPECT_EQ(none.wealthAverage(), 0);
+  EXPECT_EQ(none.wealthVariance(), 0);
+  EXPECT_EQ(none.covariance(), 0);
+  EXPECT_EQ(none.correlation(), 0);
+  Moments single{1, 42, 7, 42 * 42, 49, 42 * 7};
+  EXPECT_DOUBLE_EQ(single.wealthAverage(), 7);
+  EXPECT_EQ(single.wealthVariance(), 0);
+  EXPECT_EQ(single.covariance(), 0);
+  EXPECT_EQ(single.correlation(), 0);
+}
+
+// This party's shares in its own slot and zeros in the other party's
+std::pair<std::vector<uint32_t>, std::vector<uint32_t>> sharesOf(
+    int party,
+    const std::vector<uint32_t>& aliceShares,
+    const std::vector<uint32_t>& bobShares) {
+  std::vector<uint32_t> zeros(aliceShares.size());
+  return party == 0 ? std::make_pair(aliceShares, zeros)
+                    : std::make_pair(zeros, bobShares);
+}
+
+void testShareConversions(
+    const std::vector<uint32_t>& values,
+    fbpcf::SchedulerType schedulerType = fbpcf::SchedulerType::NetworkPlaintext,
+    fbpcf::EngineType engineType = fbpcf::EngineType::EngineWithDummyTuple) {
+  std::mt19937_64 e(values.size());
+  auto shares = share(values, e);
+  std::vector<uint32_t> bits;
+  for (auto value : values) {
+    bits.push_back(value & 1);
+  }
+  auto bitShares = share(bits, e);
+
+  auto [alice, bob] = playGame(
+      [&](auto& game, int party) {
+        auto mine = sharesOf(party, shares.first, shares.second);
+        auto secValues = game.a2b(mine.first, mine.second);
+        auto opened = secValues.openToParty(0).getValue();
+
+        auto myBits = sharesOf(party, bitShares.first, bitShares.second);
+        auto openedBits =
+            game.a2bBit(myBits.first, myBits.second).openToParty(0).getValue();
+
+        // back to the arithmetic domain, each party keeps its own shares
+        std::vector<uint32_t> b2aAlice;
+        std::vector<uint32_t> b2aBob;
+        game.b2a(secValues, b2aAlice, b2aBob);
+        return std::make_tuple(
+            opened, openedBits, party == 0 ? b2aAlice : b2aBob);
+      },
+      schedulerType,
+      engineType);
+
+  // a2b and a2bBit, opened to alice
+  EXPECT_EQ(std::get<0>(alice), values);
+  ASSERT_EQ(std::get<1>(alice).size(), values.size());
+  for (size_t i = 0; i < values.size(); ++i) {
+    EXPECT_EQ(std::get<1>(alice)[i], bool(bits[i])) << "bit " << i;
+  }
+
+  // b2a: the new shares add up to the values mod 2^32
+  const auto& aliceNewShares = std::get<2>(alice);
+  const auto& bobNewShares = std::get<2>(bob);
+  ASSERT_EQ(aliceNewShares.size(), values.size());
+  ASSERT_EQ(bobNewShares.size(), values.size());
+  for (size_t i = 0; i < values.size(); ++i) {
+    EXPECT_EQ(uint32_t(aliceNewShares[i] + bobNewShares[i]), values[i])
+        << "row " << i;
+  }
+}
+
+TEST(DemographicMetricsGameTest, testShareConversions) {
+  std::mt19937_64 e(4);
+  std::vector<uint32_t> values;
+  for (int i = 0; i < 31; ++i) {
+    values.push_back(e());
+  }
+  // the carries of the adder at both ends of the domain
+  values.push_back(0);
+  values.push_back(0xFFFFFFFF);
+  values.push_back(0x80000000);
+  testShareConversions(values);
+}
+
+TEST(DemographicMetricsGameTest, testShareConversionsOfASingleValue) {
+  testShareConversions({42});
+  testShareConversions({0xFFFFFFFF});
+}
+
+TEST(DemographicMetricsGameTest, testShareConversionsWithLazySchedulerAndFERRET) {
+  testShareConversions(
+      {0, 1, 2, 199, 0xFFFFFFFE, 0xFFFFFFFF, 12345678},
+      fbpcf::SchedulerType::Lazy,
+      fbpcf::EngineType::EngineWithTupleFromFERRET);
+}
+
+void testGroupBy(const Columns& columns, const GroupBySpec& groupBy) {
+  auto shares = share(columns, columns.size());
+  auto alice = playGame([&](auto& game, int party) {
+    using Game = std::decay_t<decltype(game)>;
+    return callWithShares<Game>(
+        shares, party, [&](const auto& a, const auto& b) {
+          auto groups = game.demographicMetricsGroupBy(a, b, groupBy);
+          // the same batches as shares mod 2^64, revealed afterwards
+          auto partial = game.revealPartialAggregates(
+              game.demographicMetricsPartialAggregates(
+                  a, b, party, false, groupBy));
+          return std::make_tuple(
+              groups.counts,
+              groups.sums,
+              partial.groupCounts,
+              partial.groupSums);
+        });
+  }).first;
+
+  const auto& values =
+      groupBy.valueColumn == "wealth" ? columns.wealth : columns.age;
+  std::vector<uint64_t> counts(groupBy.numCategories, 0);
+  std::vector<uint64_t> sums(groupBy.numCategories, 0);
+  for (size_t i = 0; i < columns.size(); ++i) {
+    // rows of other categories aren't in any group
+    if (columns.region[i] < groupBy.numCategories) {
+      counts[columns.region[i]] += 1;
+      sums[columns.region[i]] += values[i];
+    }
+  }
+  // revealed to alice
+  EXPECT_EQ(std::get<0>(alice), counts);
+  EXPECT_EQ(std::get<1>(alice), sums);
+  EXPECT_EQ(std::get<2>(alice), counts);
+  EXPECT_EQ(std::get<3>(alice), sums);
+}
+
+TEST(DemographicMetricsGameTest, testGroupBy) {
+  auto columns = randomColumns(40, 199, 5);
+  std::mt19937_64 e(5);
+  for (size_t i = 0; i < columns.size(); ++i) {
+    columns.region.push_back(e() % 6);
+  }
+  testGroupBy(columns, GroupBySpec::parse("region:6", "age"));
+}
+
+TEST(DemographicMetricsGameTest, testGroupByWithEmptyCategories) {
+  // category 1 and 3 have no rows, 7 is out of range
+  Columns columns{
+      {20, 30, 40, 50, 60},
+      {0, 1, 0, 1, 0},
+      {0xFFFFFFFF, 0xFFFFFFFF, 0xFFFFFFFF, 5, 6},
+      {0, 0, 2, 7, 0}};
+  // the sum of category 0 is far above 2^32
+  testGroupBy(columns, GroupBySpec::parse("region:4", "wealth"));
+}
+
+TEST(DemographicMetricsGameTest, testGroupByOfASingleCategory) {
+  testGroupBy(
+      Columns{{20, 30}, {0, 1}, {1, 2}, {0, 0}},
+      GroupBySpec::parse("region:1", "age"));
+}
+
+float testVariance(const Columns& columns, float mean) {
+  auto shares = share(columns, columns.size());
+  return playGame([&](auto& game, int party) {
+           using Game = std::decay_t<decltype(game)>;
+           return callWithShares<Game>(
+               shares, party, [&](const auto& a, const auto& b) {
+                 return game.demographicMetricsVariance(a, b, mean);
+               });
+         })
+      .first;
+}
+
+TEST(DemographicMetricsGameTest, testVariance) {
+  EXPECT_FLOAT_EQ(
+      testVariance(Columns{{10, 20, 30}, {0, 0, 0}, {0, 0, 0}}, 20), 100);
+}
+
+TEST(DemographicMetricsGameTest, testVarianceOfASingleRow) {
+  // no unbiased estimate from one row, 0 instead of inf
+  EXPECT_EQ(testVariance(Columns{{42}, {1}, {7}}, 42), 0);
+}
+
+// What the metrics of a validated shard revealed to alice
+struct ValidatedMetrics {
+  int keptRows;
+  float average;
+  float variance;
+  std::vector<long unsigned int> histogram;
+  PartialAggregates partial;
+};
+
+ValidatedMetrics
+testValidation(const Columns& columns, const std::string& rules, bool oblivious) {
+  auto spec = ValidationSpec::parse(rules, oblivious);
+  auto shares = share(columns, columns.size());
+  return playGame([&](auto& game, int party) {
+           using Game = std::decay_t<decltype(game)>;
+           return callWithShares<Game>(shares, party, [&](auto& a, auto& b) {
+             typename Game::ShardScope shard(game, "test");
+             ValidatedMetrics metrics;
+             metrics.keptRows = game.demographicMetricsValidate(a, b, spec);
+             metrics.average = game.demographicMetricsAverage(a, b);
+             metrics.variance = game.demographicMetricsVariance(a, b, 40);
+             metrics.histogram = game.demographicMetricsHistogram(a, b);
+             metrics.partial = game.revealPartialAggregates(
+                 game.demographicMetricsPartialAggregates(a, b, party, true));
+             return metrics;
+           });
+         })
+      .first;
+}
+
+void testValidatedMetrics(
+    const Columns& columns,
+    const std::string& rules,
+    const std::vector<bool>& valid) {
+  // the plaintext metrics of the valid rows
+  uint64_t count = 0;
+  uint64_t sum = 0;
+  uint64_t sumOfSquares = 0;
+  uint64_t squaredDiffs = 0;
+  std::vector<uint64_t> histogram(6, 0);
+  std::vector<uint32_t> binEnds = {25, 40, 50, 60, 75};
+  for (size_t i = 0; i < columns.size(); ++i) {
+    if (!valid.at(i)) {
+      continue;
+    }
+    uint64_t age = columns.age[i];
+    count += 1;
+    sum += age;
+    sumOfSquares += age * age;
+    squaredDiffs += (age - 40) * (age - 40);
+    histogram[std::upper_bound(binEnds.begin(), binEnds.end(), age) -
+              binEnds.begin()] += 1;
+  }
+  float average = count == 0 ? 0 : sum / float(count);
+  float variance = count < 2 ? 0 : squaredDiffs / float(count - 1);
+
+  for (bool oblivious : {false, true}) {
+    auto metrics = testValidation(columns, rules, oblivious);
+    // oblivious validation keeps every row and only masks the invalid ones
+    EXPECT_EQ(metrics.keptRows, int(oblivious ? columns.size() : count))
+        << oblivious;
+    EXPECT_FLOAT_EQ(metrics.average, average) << oblivious;
+    EXPECT_FLOAT_EQ(metrics.variance, variance) << oblivious;
+    EXPECT_EQ(
+        std::vector<uint64_t>(
+            metrics.histogram.begin(), metrics.histogram.end()),
+        histogram)
+        << oblivious;
+    EXPECT_EQ(metrics.partial.count, count) << oblivious;
+    EXPECT_EQ(metrics.partial.sum, sum) << oblivious;
+    EXPECT_EQ(metrics.partial.sumOfSquares, sumOfSquares) << oblivious;
+    EXPECT_EQ(metrics.partial.histogram, histogram) << oblivious;
+  }
+}
+
+TEST(DemographicMetricsGameTest, testValidation) {
+  // invalid: age 250 and 300, gender 2, wealth above 1000
+  Columns columns{
+      {20, 250, 30, 45, 300, 55, 70, 80, 10, 35},
+      {0, 1, 2, 1, 0, 1, 0, 1, 0, 1},
+      {100, 200, 300, 400, 500, 5000, 600, 700, 800, 900}};
+  testValidatedMetrics(
+      columns,
+      "age=..199,gender=0|1,wealth=..1000",
+      {true, false, false, true, false, false, true, true, true, true});
+}
+
+TEST(DemographicMetricsGameTest, testValidationWithLowerBound) {
+  Columns columns{{17, 18, 40, 90}, {0, 1, 0, 1}, {1, 2, 3, 4}};
+  testValidatedMetrics(columns, "age=18..89", {false, true, true, false});
+}
+
+TEST(DemographicMetricsGameTest, testObliviousValidationWithoutValidRows) {
+  // nothing to average over, 0 instead of a NaN
+  auto metrics = testValidation(
+      Columns{{250, 300, 1000}, {0, 1, 0}, {1, 2, 3}}, "age=..199", true);
+  EXPECT_EQ(metrics.keptRows, 3);
+  EXPECT_EQ(metrics.average, 0);
+  EXPECT_EQ(metrics.variance, 0);
+  EXPECT_EQ(metrics.histogram, std::vector<long unsigned int>(6, 0));
+  EXPECT_EQ(metrics.partial.count, 0);
+  EXPECT_EQ(metrics.partial.sum, 0);
+  EXPECT_EQ(metrics.partial.sumOfSquares, 0);
+}
+
+TEST(DemographicMetricsGameTest, testValidationWithoutRestrictions) {
+  // a rule over the whole domain keeps every row
+  Columns columns{{20, 250, 30}, {0, 1, 2}, {1, 2, 3}};
+  testValidatedMetrics(columns, "age=0..", {true, true, true});
+}
+
+} // namespace fbpcf::demographic_metrics
@@ -0,0 +1,45 @@
+#include "../GroupBySpec.h"
+#include <gtest/gtest.h>
+#include <stdexcept>
+
+namespace fbpcf::demographic_metrics {
+
+TEST(GroupBySpecTest, testParse) {
+  auto spec = GroupBySpec::parse("region:16", "wealth");
+  EXPECT_TRUE(spec.enabled());
+  EXPECT_EQ(spec.column, "region");
+  EXPECT_EQ(spec.numCategories, 16);
+  EXPECT_EQ(spec.valueColumn, "wealth");
+  EXPECT_EQ(spec.toString(), "region:16/wealth");
+}
+
+TEST(GroupBySpecTest, testDefaultsToAge) {
+  auto spec = GroupBySpec::parse("age_band:1");
+  EXPECT_EQ(spec.numCategories, 1);
+  EXPECT_EQ(spec.valueColumn, "age");
+}
+
+TEST(GroupBySpecTest, testColumnMayContainSeparator) {
+  // the category count is after the last ':'
+  auto spec = GroupBySpec::parse("a:b:3");
+  EXPECT_EQ(spec.column, "a:b");
+  EXPECT_EQ(spec.numCategories, 3);
+}
+
+TEST(GroupBySpecTest, testEmptySpecIsDisabled) {
+  auto spec = GroupBySpec::parse("");
+  EXPECT_FALSE(spec.enabled());
+  EXPECT_EQ(spec.toString(), "");
+  EXPECT_FALSE(GroupBySpec().enabled());
+}
+
+TEST(GroupBySpecTest, testMalformedSpecs) {
+  EXPECT_THROW(GroupBySpec::parse("region"), std::invalid_argument);
+  EXPECT_THROW(GroupBySpec::parse(":16"), std::invalid_argument);
+  EXPECT_THROW(GroupBySpec::parse("region:"), std::invalid_argument);
+  EXPECT_THROW(GroupBySpec::parse("region:x"), std::invalid_argument);
+  EXPECT_THROW(GroupBySpec::parse("region:0"), std::invalid_argument);
+  EXPECT_THROW(GroupBySpec::parse("region:4", "height"), std::invalid_argument);
+}
+
+} // namespace fbpcf::demographic_metrics
@@ -0,0 +1,50 @@
+#include "../MaskExpansion.h"
+#include <gtest/gtest.h>
+#include <emmintrin.h>
+#include <cstdint>
+#include <vector>
+
+#include "fbpcf/engine/util/AesPrg.h"
+
+namespace fbpcf::demographic_metrics {
+
+template <typename T>
+void expectNoZeroMask(size_t size, size_t maxChunkBytes) {
+  engine::util::AesPrg prg(_mm_set_epi64x(42, size));
+  auto masks = expandMasks<T>(prg, size, maxChunkBytes);
+  ASSERT_EQ(masks.size(), size);
+  // a zero mask (with 2^-32 or 2^-64 odds) means its bytes were never filled
+  for (size_t i = 0; i < size; ++i) {
+    EXPECT_NE(masks[i], 0) << "mask " << i;
+  }
+}
+
+TEST(MaskExpansionTest, testSingleChunk) {
+  expectNoZeroMask<uint32_t>(1000, kMaxPrgChunkBytes);
+  expectNoZeroMask<uint64_t>(1000, kMaxPrgChunkBytes);
+}
+
+TEST(MaskExpansionTest, testMasksPastTheChunkBoundary) {
+  // chunks of 3 masks, the last one partial
+  expectNoZeroMask<uint64_t>(1000, 24);
+  expectNoZeroMask<uint32_t>(1001, 12);
+  // a chunk size that is not a multiple of the mask size is rounded down
+  expectNoZeroMask<uint64_t>(1001, 20);
+  expectNoZeroMask<uint32_t>(999, 1);
+}
+
+TEST(MaskExpansionTest, testChunksAreDistinct) {
+  engine::util::AesPrg prg(_mm_set_epi64x(7, 7));
+  auto masks = expandMasks<uint64_t>(prg, 8, 16);
+  // every chunk continues the prg stream instead of repeating it
+  for (size_t i = 2; i < masks.size(); ++i) {
+    EXPECT_NE(masks[i], masks[i % 2]) << "mask " << i;
+  }
+}
+
+TEST(MaskExpansionTest, testEmpty) {
+  engine::util::AesPrg prg(_mm_set_epi64x(1, 2));
+  EXPECT_TRUE(expandMasks<uint32_t>(prg, 0).empty());
+}
+
+} // namespace fbpcf::demographic_metrics
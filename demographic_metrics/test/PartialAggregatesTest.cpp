@@ -0,0 +1,177 @@
+#include "../PartialAggregates.h"
+#include <gtest/gtest.h>
+#include <folly/json.h>
+#include <cstdint>
+#include <random>
+#include <vector>
+
+namespace fbpcf::demographic_metrics {
+
+PartialAggregates randomShares(std::mt19937_64& e, size_t bins, size_t groups) {
+  PartialAggregates shares;
+  shares.count = e();
+  shares.sum = e();
+  shares.sumOfSquares = e();
+  for (size_t i = 0; i < bins; ++i) {
+    shares.histogram.push_back(e());
+  }
+  for (size_t i = 0; i < groups; ++i) {
+    shares.groupCounts.push_back(e());
+    shares.groupSums.push_back(e());
+  }
+  return shares;
+}
+
+void expectEqual(const PartialAggregates& a, const PartialAggregates& b) {
+  EXPECT_EQ(a.count, b.count);
+  EXPECT_EQ(a.sum, b.sum);
+  EXPECT_EQ(a.sumOfSquares, b.sumOfSquares);
+  EXPECT_EQ(a.histogram, b.histogram);
+  EXPECT_EQ(a.groupCounts, b.groupCounts);
+  EXPECT_EQ(a.groupSums, b.groupSums);
+  EXPECT_EQ(a.inputPath, b.inputPath);
+  EXPECT_EQ(a.inputFingerprint, b.inputFingerprint);
+  EXPECT_EQ(a.metricsKey, b.metricsKey);
+}
+
+TEST(PartialAggregatesTest, testMergedSharesAddUpMod64) {
+  std::mt19937_64 e(42);
+  // alice's and bob's shares of two shards
+  auto alice0 = randomShares(e, 6, 3);
+  auto bob0 = randomShares(e, 6, 3);
+  auto alice1 = randomShares(e, 6, 3);
+  auto bob1 = randomShares(e, 6, 3);
+
+  auto alice = alice0;
+  alice.merge(alice1);
+  auto bob = bob0;
+  bob.merge(bob1);
+
+  EXPECT_EQ(
+      alice.sumOfSquares + bob.sumOfSquares,
+      alice0.sumOfSquares + bob0.sumOfSquares + alice1.sumOfSquares +
+          bob1.sumOfSquares);
+  for (size_t i = 0; i < 6; ++i) {
+    EXPECT_EQ(
+        alice.histogram.at(i) + bob.histogram.at(i),
+        alice0.histogram.at(i) + bob0.histogram.at(i) + alice1.histogram.at(i) +
+            bob1.histogram.at(i));
+  }
+  for (size_t i = 0; i < 3; ++i) {
+    EXPECT_EQ(
+        alice.groupSums.at(i) + bob.groupSums.at(i),
+        alice0.groupSums.at(i) + bob0.groupSums.at(i) + alice1.groupSums.at(i) +
+            bob1.groupSums.at(i));
+  }
+}
+
+TEST(PartialAggregatesTest, testSumOfSquaresDoesNotWrapAt32Bits) {
+  // 10M rows of age 199, the sum of squares is far above 2^32
+  PartialAggregates aggregates;
+  for (int i = 0; i < 10; ++i) {
+    PartialAggregates shard;
+    shard.count = 1'000'000;
+    shard.sum = 199ull * 1'000'000;
+    shard.sumOfSquares = 199ull * 199 * 1'000'000;
+    aggregates.merge(shard);
+  }
+  EXPECT_EQ(aggregates.sumOfSquares, 199ull * 199 * 10'000'000);
+  EXPECT_FLOAT_EQ(aggregates.average(), 199);
+  EXPECT_NEAR(aggregates.variance(), 0, 1e-3);
+}
+
+TEST(PartialAggregatesTest, testFewRowsHaveNoVariance) {
+  PartialAggregates aggregates;
+  EXPECT_EQ(aggregates.average(), 0);
+  EXPECT_EQ(aggregates.variance(), 0);
+
+  aggregates.count = 1;
+  aggregates.sum = 30;
+  aggregates.sumOfSquares = 900;
+  EXPECT_FLOAT_EQ(aggregates.average(), 30);
+  EXPECT_EQ(aggregates.variance(), 0);
+}
+
+TEST(PartialAggregatesTest, testEmptyGroupsAverageToZero) {
+  PartialAggregates aggregates;
+  aggregates.groupCounts = {2, 0, 4};
+  aggregates.groupSums = {10, 0, 2};
+  EXPECT_EQ(aggregates.groupAverages(), std::vector<float>({5, 0, 0.5}));
+}
+
+TEST(PartialAggregatesTest, testMergeIntoEmpty) {
+  std::mt19937_64 e(1);
+  auto shares = randomShares(e, 6, 2);
+  PartialAggregates merged;
+  merged.merge(shares);
+  expectEqual(merged, shares);
+
+  // shares without a histogram leave the bins alone
+  merged.merge(randomShares(e, 0, 2));
+  EXPECT_EQ(merged.histogram, shares.histogram);
+}
+
+TEST(PartialAggregatesTest, testMergeMismatchedSizes) {
+  std::mt19937_64 e(2);
+  auto shares = randomShares(e, 6, 2);
+  EXPECT_THROW(shares.merge(randomShares(e, 5, 2)), std::invalid_argument);
+  EXPECT_THROW(shares.merge(randomShares(e, 6, 3)), std::invalid_argument);
+}
+
+TEST(PartialAggregatesTest, testJsonRoundTrip) {
+  std::mt19937_64 e(3);
+  auto shares = randomShares(e, 6, 4);
+  // shares above 2^63 are stored as negative json integers
+  shares.sum = UINT64_MAX;
+  shares.inputPath = "/data/day1/in_0";
+  shares.inputFingerprint = "1234:5678";
+  shares.metricsKey = "average=1;validation=age=..199";
+  auto parsed = PartialAggregates::fromDynamic(
+      folly::parseJson(folly::toJson(shares.toDynamic())));
+  expectEqual(parsed, shares);
+}
+
+TEST(PartialAggregatesTest, testRejectsOlderVersions) {
+  // the 32-bit shares written before versioning
+  auto unversioned = folly::parseJson(
+      "{\"count\":1,\"sum\":2,\"sumOfSquares\":3,\"histogram\":[]}");
+  EXPECT_THROW(
+      PartialAggregates::fromDynamic(unversioned), std::invalid_argument);
+
+  auto stored = PartialAggregates().toDynamic();
+  stored["version"] = PartialAggregates::kVersion + 1;
+  EXPECT_THROW(PartialAggregates::fromDynamic(stored), std::invalid_argument);
+}
+
+TEST(PartialAggregatesTest, testRejectsOtherSources) {
+  PartialAggregates stored;
+  stored.inputPath = "/data/day1/in_0";
+  stored.inputFingerprint = "1234:5678";
+  stored.metricsKey = "average=1;validation=age=..199";
+  EXPECT_NO_THROW(stored.checkSource(
+      "/data/day1/in_0", "1234:5678", "average=1;validation=age=..199"));
+
+  // same basename in another directory
+  EXPECT_THROW(
+      stored.checkSource(
+          "/data/day2/in_0", "1234:5678", "average=1;validation=age=..199"),
+      std::invalid_argument);
+  // rewritten or appended input
+  EXPECT_THROW(
+      stored.checkSource(
+          "/data/day1/in_0", "1234:9999", "average=1;validation=age=..199"),
+      std::invalid_argument);
+  // other validation spec
+  EXPECT_THROW(
+      stored.checkSource(
+          "/data/day1/in_0", "1234:5678", "average=1;validation=age=..300"),
+      std::invalid_argument);
+  // an input without a fingerprint can't be checked
+  PartialAggregates unfingerprinted;
+  unfingerprinted.inputPath = "gs://bucket/in_0";
+  EXPECT_THROW(
+      unfingerprinted.checkSource("gs://bucket/in_0", "", ""),
+      std::invalid_argument);
+}
+
+} // namespace fbpcf::demographic_metrics
@@ -0,0 +1,157 @@
+#include "../SimdReduce.h"
+#include <gtest/gtest.h>
+#include <cstdint>
+#include <random>
+#include <string>
+#include <vector>
+
+namespace fbpcf::demographic_metrics {
+
+class SimdReduceTest : public ::testing::TestWithParam<SimdLevel> {
+ protected:
+  void SetUp() override {
+    if (!isSimdLevelSupported(GetParam())) {
+      GTEST_SKIP() << "The CPU doesn't support this SIMD level";
+    }
+  }
+
+  // around the widths of the vector bodies (4 to 32 values) and their
+  // scalar tails
+  static std::vector<size_t> sizes() {
+    return {0, 1, 3, 4, 7, 8, 9, 15, 16, 17, 31, 32, 33, 63, 64, 65, 1000};
+  }
+
+  template <typename T>
+  static std::vector<T> randomValues(size_t size) {
+    std::mt19937_64 e(size);
+    std::vector<T> values(size);
+    for (auto& value : values) {
+      value = e();
+    }
+    return values;
+  }
+
+  template <typename Sum, typename T>
+  static Sum scalarSum(const T* data, size_t size) {
+    Sum sum = 0;
+    for (size_t i = 0; i < size; ++i) {
+      sum += data[i];
+    }
+    return sum;
+  }
+};
+
+TEST_P(SimdReduceTest, testSumMod32) {
+  for (auto size : sizes()) {
+    auto values = randomValues<uint32_t>(size);
+    EXPECT_EQ(
+        sumMod32(values, GetParam()),
+        scalarSum<uint32_t>(values.data(), size))
+        << "size " << size;
+  }
+}
+
+TEST_P(SimdReduceTest, testSumWiden64) {
+  for (auto size : sizes()) {
+    auto values = randomValues<uint32_t>(size);
+    EXPECT_EQ(
+        sumWiden64(values, GetParam()),
+        scalarSum<uint64_t>(values.data(), size))
+        << "size " << size;
+  }
+  // far above 2^32
+  std::vector<uint32_t> maxValues(100, 0xFFFFFFFF);
+  EXPECT_EQ(sumWiden64(maxValues, GetParam()), 100ull * 0xFFFFFFFF);
+}
+
+TEST_P(SimdReduceTest, testSumMod64) {
+  for (auto size : sizes()) {
+    auto values = randomValues<uint64_t>(size);
+    EXPECT_EQ(
+        sumMod64(values.data(), size, GetParam()),
+        scalarSum<uint64_t>(values.data(), size))
+        << "size " << size;
+  }
+}
+
+TEST_P(SimdReduceTest, testUnalignedStart) {
+  // the kernels load unaligned, a segment may start anywhere
+  auto values32 = randomValues<uint32_t>(100);
+  auto values64 = randomValues<uint64_t>(100);
+  for (size_t offset = 1; offset < 8; ++offset) {
+    EXPECT_EQ(
+        sumMod32(values32.data() + offset, 67, GetParam()),
+        scalarSum<uint32_t>(values32.data() + offset, 67));
+    EXPECT_EQ(
+        sumWiden64(values32.data() + offset, 67, GetParam()),
+        scalarSum<uint64_t>(values32.data() + offset, 67));
+    EXPECT_EQ(
+        sumMod64(values64.data() + offset, 67, GetParam()),
+        scalarSum<uint64_t>(values64.data() + offset, 67));
+  }
+}
+
+TEST_P(SimdReduceTest, testSegmentedSums) {
+  // odd splits, empty segments and segments across the vector widths
+  std::vector<std::vector<uint32_t>> splits = {
+      {},
+      {0},
+      {1},
+      {33},
+      {7, 0, 31, 1, 33},
+      {3, 5, 17, 65, 0, 9},
+      {1000, 1, 1}};
+  for (const auto& segmentSizes : splits) {
+    size_t total = 0;
+    for (auto segmentSize : segmentSizes) {
+      total += segmentSize;
+    }
+    auto values32 = randomValues<uint32_t>(total);
+    auto values64 = randomValues<uint64_t>(total);
+    auto sums32 = segmentedSumMod32(values32, segmentSizes, GetParam());
+    auto sums64 = segmentedSumMod64(values64, segmentSizes, GetParam());
+    ASSERT_EQ(sums32.size(), segmentSizes.size());
+    ASSERT_EQ(sums64.size(), segmentSizes.size());
+
+    size_t offset = 0;
+    for (size_t i = 0; i < segmentSizes.size(); ++i) {
+      EXPECT_EQ(
+          sums32[i],
+          scalarSum<uint32_t>(values32.data() + offset, segmentSizes[i]))
+          << "segment " << i << " of " << segmentSizes.size();
+      EXPECT_EQ(
+          sums64[i],
+          scalarSum<uint64_t>(values64.data() + offset, segmentSizes[i]))
+          << "segment " << i << " of " << segmentSizes.size();
+      offset += segmentSizes[i];
+    }
+  }
+}
+
+TEST(SimdReduceSegmentsTest, testSegmentsMustCoverTheData) {
+  std::vector<uint32_t> values32(10, 1);
+  std::vector<uint64_t> values64(10, 1);
+  // past the end of the data, and short of it
+  for (std::vector<uint32_t> segmentSizes : {std::vector<uint32_t>{4, 7},
+                                             std::vector<uint32_t>{4, 5}}) {
+    EXPECT_DEATH(segmentedSumMod32(values32, segmentSizes), "cover");
+    EXPECT_DEATH(segmentedSumMod64(values64, segmentSizes), "cover");
+  }
+}
+
+INSTANTIATE_TEST_SUITE_P(
+    SimdLevels,
+    SimdReduceTest,
+    ::testing::Values(SimdLevel::Scalar, SimdLevel::Avx2, SimdLevel::Avx512),
+    [](const ::testing::TestParamInfo<SimdLevel>& info) {
+      switch (info.param) {
+        case SimdLevel::Avx512:
+          return std::string("Avx512");
+        case SimdLevel::Avx2:
+          return std::string("Avx2");
+        default:
+          return std::string("Scalar");
+      }
+    });
+
+} // namespace fbpcf::demographic_metrics
@@ -0,0 +1,129 @@
+#include "../TraceRecorder.h"
+#include <gtest/gtest.h>
+#include <unistd.h>
+#include <atomic>
+#include <filesystem>
+#include <fstream>
+#include <memory>
+#include <set>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include <folly/dynamic.h>
+#include <folly/json.h>
+
+namespace fbpcf::demographic_metrics {
+
+TEST(TraceRecorderTest, testTraceEventShape) {
+  auto recorder = std::make_shared<TraceRecorder>(1);
+  {
+    TraceScope metric(recorder, "average", "metric");
+    TraceScope reveal(recorder, "openToParty", "reveal");
+  }
+  auto trace = recorder->toDynamic();
+
+  EXPECT_EQ(trace["displayTimeUnit"], "ms");
+  const auto& events = trace["traceEvents"];
+  ASSERT_TRUE(events.isArray());
+  ASSERT_EQ(events.size(), 5);
+
+  // the process is named after the party
+  EXPECT_EQ(events[0]["name"], "process_name");
+  EXPECT_EQ(events[0]["ph"], "M");
+  EXPECT_EQ(events[0]["pid"], 1);
+  EXPECT_EQ(events[0]["args"]["name"], "Bob");
+
+  // nested scopes end in reverse order
+  std::vector<std::pair<std::string, std::string>> expected = {
+      {"average", "B"}, {"openToParty", "B"}, {"openToParty", "E"}, {"average", "E"}};
+  int64_t lastTimestamp = 0;
+  for (size_t i = 0; i < expected.size(); ++i) {
+    const auto& event = events[i + 1];
+    EXPECT_EQ(event["name"], expected[i].first) << i;
+    EXPECT_EQ(event["ph"], expected[i].second) << i;
+    EXPECT_EQ(event["cat"], i == 0 || i == 3 ? "metric" : "reveal") << i;
+    EXPECT_EQ(event["pid"], 1) << i;
+    EXPECT_EQ(event["tid"], 0) << i;
+    EXPECT_GE(event["ts"].asInt(), lastTimestamp) << i;
+    lastTimestamp = event["ts"].asInt();
+  }
+  EXPECT_EQ(recorder->countBegins("reveal"), 1);
+  EXPECT_EQ(recorder->countBegins("metric"), 1);
+  EXPECT_EQ(recorder->countBegins("shard"), 0);
+}
+
+TEST(TraceRecorderTest, testClockOffsetIsAppliedToEveryEvent) {
+  TraceRecorder recorder(0);
+  recorder.begin("shard", "shard");
+  recorder.end("shard", "shard");
+  auto before = recorder.toDynamic();
+
+  // set after the events were recorded
+  recorder.setClockOffset(-5000000, 120);
+  auto after = recorder.toDynamic();
+
+  EXPECT_EQ(after["traceEvents"][0]["args"]["name"], "Alice");
+  for (size_t i = 1; i < 3; ++i) {
+    EXPECT_EQ(
+        after["traceEvents"][i]["ts"].asInt(),
+        before["traceEvents"][i]["ts"].asInt() - 5000000);
+  }
+  EXPECT_EQ(after["otherData"]["party"], 0);
+  EXPECT_EQ(after["otherData"]["clockOffsetUs"], -5000000);
+  EXPECT_EQ(after["otherData"]["clockRoundTripUs"], 120);
+}
+
+TEST(TraceRecorderTest, testThreadsGetTheirOwnIds) {
+  auto recorder = std::make_shared<TraceRecorder>(0);
+  { TraceScope scope(recorder, "main", "shard"); }
+  // the workers stay alive until all of them recorded, a finished thread's
+  // std::thread::id may be reused
+  std::atomic<int> recorded = 0;
+  std::vector<std::thread> workers;
+  for (int i = 0; i < 3; ++i) {
+    workers.emplace_back([&]() {
+      TraceScope scope(recorder, "worker", "shard");
+      ++recorded;
+      while (recorded < 3) {
+        std::this_thread::yield();
+      }
+    });
+  }
+  for (auto& worker : workers) {
+    worker.join();
+  }
+
+  std::set<int64_t> tids;
+  auto trace = recorder->toDynamic();
+  const auto& events = trace["traceEvents"];
+  for (size_t i = 1; i < events.size(); ++i) {
+    tids.insert(events[i]["tid"].asInt());
+  }
+  // small sequential ids
+  EXPECT_EQ(tids, std::set<int64_t>({0, 1, 2, 3}));
+}
+
+TEST(TraceRecorderTest, testScopeWithoutRecorder) {
+  // tracing disabled, nothing to record to
+  EXPECT_NO_THROW({ TraceScope scope(nullptr, "average", "metric"); });
+}
+
+TEST(TraceRecorderTest, testWriteToFile) {
+  auto path = std::filesystem::temp_directory_path() /
+      ("trace_recorder_test_" + std::to_string(::getpid()) + ".json");
+  TraceRecorder recorder(0);
+  recorder.begin("average", "metric");
+  recorder.end("average", "metric");
+  recorder.writeToFile(path);
+
+  std::ifstream in(path);
+  std::stringstream content;
+  content << in.rdbuf();
+  std::filesystem::remove(path);
+  EXPECT_EQ(folly::parseJson(content.str()), recorder.toDynamic());
+}
+
+} // namespace fbpcf::demographic_metrics
@@ -0,0 +1,77 @@
+#include "../ValidationSpec.h"
+#include <gtest/gtest.h>
+#include <cstdint>
+#include <limits>
+#include <stdexcept>
+#include <vector>
+
+namespace fbpcf::demographic_metrics {
+
+TEST(ValidationSpecTest, testParseRangesAndSets) {
+  auto spec = ValidationSpec::parse("age=..199, wealth=10..10000000,gender=0|1");
+  ASSERT_EQ(spec.rules.size(), 3);
+  EXPECT_FALSE(spec.oblivious);
+
+  EXPECT_EQ(spec.rules[0].column, "age");
+  EXPECT_EQ(spec.rules[0].min, 0);
+  EXPECT_EQ(spec.rules[0].max, 199);
+  EXPECT_TRUE(spec.rules[0].allowed.empty());
+
+  EXPECT_EQ(spec.rules[1].column, "wealth");
+  EXPECT_EQ(spec.rules[1].min, 10);
+  EXPECT_EQ(spec.rules[1].max, 10000000);
+
+  EXPECT_EQ(spec.rules[2].column, "gender");
+  EXPECT_EQ(spec.rules[2].allowed, std::vector<uint32_t>({0, 1}));
+}
+
+TEST(ValidationSpecTest, testOpenUpperBound) {
+  auto spec = ValidationSpec::parse("wealth=5..", true);
+  ASSERT_EQ(spec.rules.size(), 1);
+  EXPECT_TRUE(spec.oblivious);
+  EXPECT_EQ(spec.rules[0].min, 5);
+  EXPECT_EQ(spec.rules[0].max, std::numeric_limits<uint32_t>::max());
+}
+
+TEST(ValidationSpecTest, testEmptySpecHasNoRules) {
+  EXPECT_TRUE(ValidationSpec::parse("").rules.empty());
+}
+
+TEST(ValidationSpecTest, testToStringParsesBack) {
+  for (const auto& text :
+       {"age=..199", "age=..199,wealth=0..10000000,gender=0|1", "gender=2"}) {
+    auto spec = ValidationSpec::parse(text);
+    auto reparsed = ValidationSpec::parse(spec.toString());
+    EXPECT_EQ(reparsed.toString(), spec.toString()) << text;
+    ASSERT_EQ(reparsed.rules.size(), spec.rules.size());
+  }
+  EXPECT_EQ(ValidationSpec::defaultSpec().toString(), "age=0..199");
+}
+
+TEST(ValidationSpecTest, testMaxValue) {
+  EXPECT_EQ(ValidationSpec::defaultSpec().maxValue("age"), 199);
+  EXPECT_EQ(ValidationSpec::parse("age=..300").maxValue("age"), 300);
+  EXPECT_EQ(ValidationSpec::parse("gender=0|2|1").maxValue("gender"), 2);
+  // the tightest of several rules of a column
+  EXPECT_EQ(ValidationSpec::parse("age=..300,age=..150").maxValue("age"), 150);
+  // unbounded columns
+  EXPECT_EQ(
+      ValidationSpec::parse("age=5..").maxValue("age"),
+      std::numeric_limits<uint32_t>::max());
+  EXPECT_EQ(
+      ValidationSpec::parse("wealth=..10").maxValue("age"),
+      std::numeric_limits<uint32_t>::max());
+}
+
+TEST(ValidationSpecTest, testMalformedRules) {
+  EXPECT_THROW(ValidationSpec::parse("age"), std::invalid_argument);
+  EXPECT_THROW(ValidationSpec::parse("height=..200"), std::invalid_argument);
+  EXPECT_THROW(ValidationSpec::parse("age=x..5"), std::invalid_argument);
+  EXPECT_THROW(ValidationSpec::parse("gender=0|"), std::invalid_argument);
+  // a range no value fits in
+  EXPECT_THROW(ValidationSpec::parse("age=200..10"), std::invalid_argument);
+  EXPECT_NO_THROW(ValidationSpec::parse("age=10..10"));
+  EXPECT_THROW(ValidationSpec::parse("wealth=..4294967296"), std::out_of_range);
+}
+
+} // namespace fbpcf::demographic_metrics
@@ -0,0 +1,120 @@
+#pragma once
+
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <mutex>
+#include <sstream>
+#include <string>
+
+#include <fbpcf/io/api/FileIOWrappers.h>
+#include <folly/dynamic.h>
+#include <folly/hash/Hash.h>
+#include <folly/json.h>
+#include "folly/logging/xlog.h"
+
+namespace fbpcf::demographic_metrics {
+
+/**
+ * Shards a job has finished, so a restarted job only runs the rest.
+ *
+ * Every party keeps its own manifest (a local json file) with one entry per
+ * completed shard: a fingerprint of its input (see getInputFingerprint), its
+ * output path, a hash of the output written there and the metrics it was
+ * calculated for. A shard counts as completed if all four still match, so a
+ * rewritten input is recalculated; inputs without a fingerprint never
+ * count as completed. The parties then agree on every shard before the job
+ * starts, so a shard is only skipped if it completed on both sides.
+ *
+ * The game threads of a job share one manifest, it is rewritten (to a
+ * temporary file that is renamed over it) after every shard.
+ */
+class CheckpointManifest {
+ public:
+  explicit CheckpointManifest(std::string path) : path_(std::move(path)) {
+    if (std::filesystem::exists(path_)) {
+      shards_ = folly::parseJson(fbpcf::io::FileIOWrappers::readFile(path_));
+      XLOG(INFO) << "Loaded " << shards_.size()
+                 << " completed shards from checkpoint manifest " << path_;
+    }
+  }
+
+  bool isCompleted(
+      const std::string& inputPath,
+      const std::string& inputFingerprint,
+      const std::string& outputPath,
+      const std::string& metricsKey) const {
+    if (inputFingerprint.empty()) {
+      return false;
+    }
+    folly::dynamic entry;
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      auto shard = shards_.get_ptr(inputPath);
+      if (!shard) {
+        return false;
+      }
+      entry = *shard;
+    }
+    // entries written before the input fingerprints have none
+    auto recordedInput = entry.get_ptr("input");
+    if (!recordedInput || recordedInput->asString() != inputFingerprint ||
+        entry["output"].asString() != outputPath ||
+        entry["metrics"].asString() != metricsKey) {
+      return false;
+    }
+
+    // the output may have been removed or overwritten since
+    try {
+      return hashOutput(fbpcf::io::FileIOWrappers::readFile(outputPath)) ==
+          entry["hash"].asString();
+    } catch (const std::exception& e) {
+      XLOG(WARNING) << "Recalculating shard " << inputPath
+                    << ", can't read its output: " << e.what();
+      return false;
+    }
+  }
+
+  // inputFingerprint has to be taken before the input was read, so an input
+  // rewritten in the meantime is recalculated by the next run
+  void recordCompleted(
+      const std::string& inputPath,
+      const std::string& inputFingerprint,
+      const std::string& outputPath,
+      const std::string& metricsKey,
+      const std::string& output) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    shards_[inputPath] = folly::dynamic::object("input", inputFingerprint)(
+        "output", outputPath)("hash", hashOutput(output))("metrics", metricsKey);
+
+    auto tmpPath = path_ + ".tmp";
+    {
+      std::ofstream out(tmpPath, std::ios::trunc);
+      out << folly::toPrettyJson(shards_);
+      if (!out) {
+        throw std::runtime_error("Failed to write checkpoint manifest " + tmpPath);
+      }
+    }
+    std::filesystem::rename(tmpPath, path_);
+  }
+
+  static std::string hashOutput(const std::string& output) {
+    std::stringstream ss;
+    ss << std::hex << folly::hash::fnv64(output);
+    return ss.str();
+  }
+
+ private:
+  std::string path_;
+  mutable std::mutex mutex_;
+  folly::dynamic shards_ = folly::dynamic::object();
+};
+
+inline std::string getCheckpointManifestPath(
+    const std::string& checkpointDirectory,
+    int party) {
+  return checkpointDirectory + "/checkpoint_party" + std::to_string(party) +
+      ".json";
+}
+
+} // namespace fbpcf::demographic_metrics
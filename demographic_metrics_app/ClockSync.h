@@ -0,0 +1,70 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <vector>
+
+#include "fbpcf/engine/communication/IPartyCommunicationAgent.h"
+
+namespace fbpcf::demographic_metrics {
+
+// Offset of this party's clock to Alice's, see measureClockOffset
+struct ClockOffset {
+  int64_t offsetUs = 0;
+  // round trip of the ping the offset was taken from, the offset is
+  // accurate to about half of it
+  int64_t roundTripUs = 0;
+};
+
+inline int64_t wallClockUs() {
+  return std::chrono::duration_cast<std::chrono::microseconds>(
+             std::chrono::system_clock::now().time_since_epoch())
+      .count();
+}
+
+/**
+ * Measures how far this party's wall clock is behind Alice's, so the traces
+ * of both parties can be lined up. Alice's clock is the reference, her offset
+ * is 0.
+ *
+ * Bob sends rounds pings and Alice answers each with her clock. Assuming the
+ * answer was taken halfway through the round trip, Bob's offset is Alice's
+ * clock minus the midpoint of the ping; the fastest round trip has the least
+ * queueing and so the tightest bound. Both parties have to call it with the
+ * same rounds on the same agent.
+ */
+inline ClockOffset measureClockOffset(
+    fbpcf::engine::communication::IPartyCommunicationAgent& agent,
+    int party,
+    int rounds = 8) {
+  std::vector<unsigned char> message(sizeof(int64_t));
+  if (party == 0) {
+    for (int i = 0; i < rounds; ++i) {
+      agent.receive(message.size());
+      auto nowUs = wallClockUs();
+      std::memcpy(message.data(), &nowUs, sizeof(nowUs));
+      agent.send(message);
+    }
+    return ClockOffset();
+  }
+
+  ClockOffset best{0, std::numeric_limits<int64_t>::max()};
+  for (int i = 0; i < rounds; ++i) {
+    auto sentUs = wallClockUs();
+    agent.send(message);
+    auto reply = agent.receive(message.size());
+    auto receivedUs = wallClockUs();
+
+    int64_t aliceUs;
+    std::memcpy(&aliceUs, reply.data(), sizeof(aliceUs));
+    auto roundTripUs = receivedUs - sentUs;
+    if (roundTripUs < best.roundTripUs) {
+      best = {aliceUs - (sentUs + roundTripUs / 2), roundTripUs};
+    }
+  }
+  return best;
+}
+
+} // namespace fbpcf::demographic_metrics
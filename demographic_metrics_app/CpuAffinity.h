@@ -0,0 +1,213 @@
+#pragma once
+
+#include <linux/mempolicy.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cctype>
+#include <cerrno>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include <tuple>
+#include <vector>
+
+#include "folly/logging/xlog.h"
+
+namespace fbpcf::demographic_metrics {
+
+/**
+ * Placement of the game threads on multi-socket hosts.
+ *
+ * Game thread i is pinned to the i-th core of a compact order: the cores the
+ * process may run on, grouped by NUMA node, with the first hardware thread of
+ * every physical core before its SMT siblings. Threads started from a pinned
+ * thread inherit its affinity, so the I/O threads of its app (readahead
+ * fetchers, the shard prefetch, decompression) widen theirs to the whole
+ * node with releaseHelperThread instead of sharing the game thread's core.
+ *
+ * The pinned thread also sets a local memory policy, so the pages it touches
+ * first (input columns, batch buffers, masks) are allocated on its own node
+ * even if the process was started with an interleaving policy.
+ */
+struct CpuPlacement {
+  int cpu;
+  int node;
+  int core;
+  // index among the hardware threads of the core
+  int sibling;
+};
+
+namespace detail {
+
+inline int readSysfsInt(const std::string& path, int defaultValue) {
+  std::ifstream in(path);
+  int value;
+  return in >> value ? value : defaultValue;
+}
+
+const std::string kSysfsCpuRoot = "/sys/devices/system/cpu";
+
+// NUMA node of a cpu from its nodeN link in sysfs, 0 without NUMA
+inline int getCpuNode(const std::string& sysfsCpuRoot, int cpu) {
+  std::error_code ec;
+  std::filesystem::directory_iterator entries(
+      sysfsCpuRoot + "/cpu" + std::to_string(cpu), ec);
+  for (; !ec && entries != std::filesystem::directory_iterator();
+       entries.increment(ec)) {
+    auto name = entries->path().filename().string();
+    if (name.size() > 4 && name.compare(0, 4, "node") == 0 &&
+        std::all_of(name.begin() + 4, name.end(), ::isdigit)) {
+      return std::stoi(name.substr(4));
+    }
+  }
+  return 0;
+}
+
+} // namespace detail
+
+// The given cpus in the order game threads are placed, with the topology
+// read from sysfsCpuRoot. Missing topology files count as a core of its own
+// on node 0.
+inline std::vector<CpuPlacement> getCompactCpuOrder(
+    const std::vector<int>& allowedCpus,
+    const std::string& sysfsCpuRoot = detail::kSysfsCpuRoot) {
+  std::vector<CpuPlacement> cpus;
+  for (auto cpu : allowedCpus) {
+    auto topology =
+        sysfsCpuRoot + "/cpu" + std::to_string(cpu) + "/topology/";
+    auto package = detail::readSysfsInt(topology + "physical_package_id", 0);
+    auto core = detail::readSysfsInt(topology + "core_id", cpu);
+    // packages are folded into the core so it is unique per node
+    cpus.push_back(
+        {cpu, detail::getCpuNode(sysfsCpuRoot, cpu), package * 65536 + core, 0});
+  }
+
+  // number the hardware threads of every core in cpu order
+  std::sort(cpus.begin(), cpus.end(), [](const auto& a, const auto& b) {
+    return std::tie(a.node, a.core, a.cpu) < std::tie(b.node, b.core, b.cpu);
+  });
+  for (size_t i = 1; i < cpus.size(); ++i) {
+    if (cpus[i].node == cpus[i - 1].node && cpus[i].core == cpus[i - 1].core) {
+      cpus[i].sibling = cpus[i - 1].sibling + 1;
+    }
+  }
+
+  std::sort(cpus.begin(), cpus.end(), [](const auto& a, const auto& b) {
+    return std::tie(a.node, a.sibling, a.core) <
+        std::tie(b.node, b.sibling, b.core);
+  });
+  return cpus;
+}
+
+// The cores this process may run on, in the order game threads are placed
+inline std::vector<CpuPlacement> getCompactCpuOrder() {
+  cpu_set_t allowed;
+  CPU_ZERO(&allowed);
+  if (sched_getaffinity(0, sizeof(allowed), &allowed) != 0) {
+    return {};
+  }
+  std::vector<int> allowedCpus;
+  for (int cpu = 0; cpu < CPU_SETSIZE; ++cpu) {
+    if (CPU_ISSET(cpu, &allowed)) {
+      allowedCpus.push_back(cpu);
+    }
+  }
+  return getCompactCpuOrder(allowedCpus);
+}
+
+// The compact order of the cores the process may run on, taken once before
+// the first game thread is pinned
+inline const std::vector<CpuPlacement>& getProcessCpuOrder() {
+  static const auto order = getCompactCpuOrder();
+  return order;
+}
+
+// Pins the calling thread to the core of game thread threadIndex and makes
+// its allocations node-local. Failures are logged, the thread keeps running
+// unpinned.
+inline void pinGameThread(int threadIndex) {
+  const auto& order = getProcessCpuOrder();
+  if (order.empty()) {
+    XLOG(WARNING) << "No cores to pin game thread " << threadIndex << " to";
+    return;
+  }
+  // with more threads than cores the order wraps around
+  const auto& placement = order.at(threadIndex % order.size());
+
+  cpu_set_t cpuSet;
+  CPU_ZERO(&cpuSet);
+  CPU_SET(placement.cpu, &cpuSet);
+  auto rc = pthread_setaffinity_np(pthread_self(), sizeof(cpuSet), &cpuSet);
+  if (rc != 0) {
+    XLOGF(
+        WARNING,
+        "Failed to pin game thread {} to cpu {}: {}",
+        threadIndex,
+        placement.cpu,
+        std::strerror(rc));
+    return;
+  }
+
+  // glibc has no wrapper for set_mempolicy, libnuma is not needed for it
+  if (syscall(SYS_set_mempolicy, MPOL_LOCAL, nullptr, 0) != 0) {
+    XLOGF(
+        WARNING,
+        "Failed to set a local memory policy for game thread {}: {}",
+        threadIndex,
+        std::strerror(errno));
+  }
+  XLOGF(
+      INFO,
+      "Pinned game thread {} to cpu {} on node {}",
+      threadIndex,
+      placement.cpu,
+      placement.node);
+}
+
+// Called at the start of a helper thread: if it inherited the single core of
+// a pinned game thread, it may run on every core of that core's node
+// instead. The node-local memory policy is kept. Threads of unpinned game
+// threads are left alone.
+inline void releaseHelperThread() {
+  cpu_set_t current;
+  CPU_ZERO(&current);
+  if (sched_getaffinity(0, sizeof(current), &current) != 0 ||
+      CPU_COUNT(&current) != 1) {
+    return;
+  }
+  int pinnedCpu = 0;
+  while (!CPU_ISSET(pinnedCpu, &current)) {
+    ++pinnedCpu;
+  }
+
+  int node = -1;
+  for (const auto& placement : getProcessCpuOrder()) {
+    if (placement.cpu == pinnedCpu) {
+      node = placement.node;
+    }
+  }
+  cpu_set_t nodeSet;
+  CPU_ZERO(&nodeSet);
+  for (const auto& placement : getProcessCpuOrder()) {
+    if (placement.node == node) {
+      CPU_SET(placement.cpu, &nodeSet);
+    }
+  }
+  if (CPU_COUNT(&nodeSet) <= 1) {
+    return;
+  }
+  auto rc = pthread_setaffinity_np(pthread_self(), sizeof(nodeSet), &nodeSet);
+  if (rc != 0) {
+    XLOGF(
+        WARNING,
+        "Failed to release helper thread from cpu {}: {}",
+        pinnedCpu,
+        std::strerror(rc));
+  }
+}
+
+} // namespace fbpcf::demographic_metrics
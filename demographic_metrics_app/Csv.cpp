@@ -52,8 +52,15 @@ bool readCsv(
     std::function<
         void(const std::vector<std::string>&, const std::vector<std::string>&)>
         readLine,
-    std::function<void(const std::vector<std::string>&)> processHeader) {
-  auto inlineReader = std::make_unique<fbpcf::io::FileReader>(fileName);
+    std::function<void(const std::vector<std::string>&)> processHeader,
+    const ReadaheadOptions& readahead) {
+  auto inlineReader = openInputReader(fileName, readahead);
+  // .gz and .zst inputs are decompressed while they are parsed
+  auto compression = getCompression(fileName);
+  if (compression != Compression::None) {
+    inlineReader = std::make_unique<DecompressingReader>(
+        std::move(inlineReader), compression);
+  }
   auto inlineBufferedReader =
       std::make_unique<fbpcf::io::BufferedReader>(std::move(inlineReader));
 
@@ -65,6 +72,10 @@ bool readCsv(
     // Split on commas, but if it looks like we're reading an array
     // like `[1, 2, 3]`, take the whole array
     line = inlineBufferedReader->readLine();
+    // files written with a trailing newline end with an empty line
+    if (line.empty()) {
+      continue;
+    }
     auto parts = splitByComma(line, true);
     readLine(header, parts);
   }
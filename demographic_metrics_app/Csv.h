@@ -5,6 +5,9 @@
 
 #include <re2/re2.h>
 
+#include "./DecompressingReader.h"
+#include "./ReadaheadReader.h"
+
 namespace fbpcf::demographic_metrics {
 
 // Split an input string into component pieces given a delimiter
@@ -25,7 +28,8 @@ bool readCsv(
         const std::vector<std::string>& header,
         const std::vector<std::string>& parts)> readLine,
     std::function<void(const std::vector<std::string>&)> processHeader =
-        [](auto) {});
+        [](auto) {},
+    const ReadaheadOptions& readahead = ReadaheadOptions());
 
 bool writeCsv(
     const std::string& fileName,
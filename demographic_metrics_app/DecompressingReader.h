@@ -0,0 +1,280 @@
+#pragma once
+
+#include <zlib.h>
+#include <zstd.h>
+#include <condition_variable>
+#include <cstring>
+#include <deque>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "fbpcf/io/api/IReaderCloser.h"
+
+#include "./CpuAffinity.h"
+
+namespace fbpcf::demographic_metrics {
+
+/**
+ * On the fly decompression of .gz and .zst inputs.
+ *
+ * A DecompressingReader wraps the reader of the compressed file (a
+ * FileReader or a ReadaheadReader) and decompresses on a thread of its own
+ * into a few blocks ahead of the parser, so reading, decompressing and
+ * parsing run in parallel. Concatenated gzip members (e.g. from pigz) and
+ * zstd frames are decompressed one after the other.
+ */
+enum class Compression { None, Gzip, Zstd };
+
+inline Compression getCompression(const std::string& path) {
+  auto endsWith = [&path](const std::string& suffix) {
+    return path.size() >= suffix.size() &&
+        path.compare(path.size() - suffix.size(), suffix.size(), suffix) == 0;
+  };
+  if (endsWith(".gz")) {
+    return Compression::Gzip;
+  }
+  if (endsWith(".zst")) {
+    return Compression::Zstd;
+  }
+  return Compression::None;
+}
+
+// Streaming gzip or zstd decompression state
+class StreamDecompressor {
+ public:
+  explicit StreamDecompressor(Compression compression)
+      : compression_(compression) {
+    if (compression_ == Compression::Gzip) {
+      std::memset(&zlib_, 0, sizeof(zlib_));
+      // 15 + 32: largest window, and accept gzip as well as zlib headers
+      if (inflateInit2(&zlib_, 15 + 32) != Z_OK) {
+        throw std::runtime_error("Failed to initialize gzip decompression");
+      }
+    } else {
+      zstd_ = ZSTD_createDStream();
+      if (!zstd_) {
+        throw std::runtime_error("Failed to initialize zstd decompression");
+      }
+    }
+  }
+
+  ~StreamDecompressor() {
+    if (compression_ == Compression::Gzip) {
+      inflateEnd(&zlib_);
+    } else {
+      ZSTD_freeDStream(zstd_);
+    }
+  }
+
+  StreamDecompressor(const StreamDecompressor&) = delete;
+  StreamDecompressor& operator=(const StreamDecompressor&) = delete;
+
+  // Decompresses from in + inPos into out + outPos, advancing both
+  void decompress(
+      const char* in,
+      size_t inSize,
+      size_t& inPos,
+      char* out,
+      size_t outSize,
+      size_t& outPos) {
+    // no new member or frame to start
+    if (!inMember_ && inPos == inSize) {
+      return;
+    }
+    if (compression_ == Compression::Gzip) {
+      zlib_.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(in + inPos));
+      zlib_.avail_in = inSize - inPos;
+      zlib_.next_out = reinterpret_cast<Bytef*>(out + outPos);
+      zlib_.avail_out = outSize - outPos;
+      auto rc = inflate(&zlib_, Z_NO_FLUSH);
+      inPos = inSize - zlib_.avail_in;
+      outPos = outSize - zlib_.avail_out;
+      if (rc == Z_STREAM_END) {
+        // the next member starts with a fresh header
+        inflateReset(&zlib_);
+        inMember_ = false;
+      } else if (rc == Z_OK || rc == Z_BUF_ERROR) {
+        inMember_ = true;
+      } else {
+        throw std::runtime_error(
+            std::string("Corrupt gzip input: ") + (zlib_.msg ? zlib_.msg : ""));
+      }
+    } else {
+      ZSTD_inBuffer input{in, inSize, inPos};
+      ZSTD_outBuffer output{out, outSize, outPos};
+      auto rc = ZSTD_decompressStream(zstd_, &output, &input);
+      if (ZSTD_isError(rc)) {
+        throw std::runtime_error(
+            std::string("Corrupt zstd input: ") + ZSTD_getErrorName(rc));
+      }
+      inPos = input.pos;
+      outPos = output.pos;
+      // 0 means a frame was completed and flushed
+      inMember_ = rc != 0;
+    }
+  }
+
+  // False in the middle of a gzip member or zstd frame, i.e. if the input
+  // ended here it was truncated
+  bool atBoundary() const {
+    return !inMember_;
+  }
+
+ private:
+  Compression compression_;
+  z_stream zlib_;
+  ZSTD_DStream* zstd_ = nullptr;
+  bool inMember_ = false;
+};
+
+class DecompressingReader final : public fbpcf::io::IReaderCloser {
+ public:
+  DecompressingReader(
+      std::unique_ptr<fbpcf::io::IReaderCloser> compressed,
+      Compression compression)
+      : compressed_(std::move(compressed)), decompressor_(compression) {
+    worker_ = std::thread([this]() {
+      releaseHelperThread();
+      decompressAll();
+    });
+  }
+
+  ~DecompressingReader() override {
+    close();
+  }
+
+  size_t read(std::vector<char>& buf) override {
+    size_t done = 0;
+    while (done < buf.size() && !eof()) {
+      if (cursor_ == current_.size()) {
+        nextBlock();
+        continue;
+      }
+      auto count = std::min(buf.size() - done, current_.size() - cursor_);
+      std::memcpy(buf.data() + done, current_.data() + cursor_, count);
+      cursor_ += count;
+      done += count;
+    }
+    return done;
+  }
+
+  bool eof() override {
+    if (cursor_ < current_.size()) {
+      return false;
+    }
+    std::unique_lock<std::mutex> lock(mutex_);
+    changed_.wait(lock, [this]() {
+      return !blocks_.empty() || finished_ || error_;
+    });
+    return blocks_.empty() && finished_ && !error_;
+  }
+
+  int close() override {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      closed_ = true;
+    }
+    changed_.notify_all();
+    if (worker_.joinable()) {
+      worker_.join();
+      compressed_->close();
+    }
+    return 0;
+  }
+
+ private:
+  static constexpr size_t kBlockSize = 1 << 20;
+  static constexpr size_t kMaxBlocks = 4;
+
+  void nextBlock() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    changed_.wait(lock, [this]() { return !blocks_.empty() || error_; });
+    if (error_) {
+      std::rethrow_exception(error_);
+    }
+    current_ = std::move(blocks_.front());
+    blocks_.pop_front();
+    cursor_ = 0;
+    lock.unlock();
+    changed_.notify_all();
+  }
+
+  // Runs on the worker thread until the input is decompressed
+  void decompressAll() {
+    try {
+      std::vector<char> in(kBlockSize);
+      size_t inSize = 0;
+      size_t inPos = 0;
+      bool inputDone = false;
+
+      while (true) {
+        std::vector<char> out(kBlockSize);
+        size_t outPos = 0;
+        while (outPos < out.size()) {
+          if (inPos == inSize && !inputDone) {
+            inputDone = compressed_->eof();
+            inSize = inputDone ? 0 : compressed_->read(in);
+            inPos = 0;
+          }
+          auto inBefore = inPos;
+          auto outBefore = outPos;
+          decompressor_.decompress(
+              in.data(), inSize, inPos, out.data(), out.size(), outPos);
+          // nothing left to consume or flush
+          if (inputDone && inPos == inBefore && outPos == outBefore) {
+            break;
+          }
+        }
+        out.resize(outPos);
+
+        std::unique_lock<std::mutex> lock(mutex_);
+        changed_.wait(lock, [this]() {
+          return closed_ || blocks_.size() < kMaxBlocks;
+        });
+        if (closed_) {
+          return;
+        }
+        if (!out.empty()) {
+          blocks_.push_back(std::move(out));
+        }
+        if (inputDone && outPos < kBlockSize) {
+          if (!decompressor_.atBoundary()) {
+            throw std::runtime_error("Compressed input is truncated");
+          }
+          finished_ = true;
+          lock.unlock();
+          changed_.notify_all();
+          return;
+        }
+        lock.unlock();
+        changed_.notify_all();
+      }
+    } catch (const std::exception&) {
+      std::lock_guard<std::mutex> lock(mutex_);
+      error_ = std::current_exception();
+    }
+    changed_.notify_all();
+  }
+
+  std::unique_ptr<fbpcf::io::IReaderCloser> compressed_;
+  StreamDecompressor decompressor_;
+  std::thread worker_;
+
+  std::mutex mutex_;
+  std::condition_variable changed_;
+  std::deque<std::vector<char>> blocks_;
+  bool finished_ = false;
+  bool closed_ = false;
+  std::exception_ptr error_;
+
+  // block the parser is reading, only touched by the parser thread
+  std::vector<char> current_;
+  size_t cursor_ = 0;
+};
+
+} // namespace fbpcf::demographic_metrics
@@ -2,6 +2,7 @@
 
 #include <cstdlib>
 #include <filesystem>
+#include <sstream>
 #include <string>
 #include "folly/logging/xlog.h"
 #include <folly/dynamic.h>
@@ -11,6 +12,12 @@
 #include "fbpcf/engine/communication/IPartyCommunicationAgentFactory.h"
 #include "fbpcf/scheduler/SchedulerHelper.h"
 #include "../demographic_metrics/DemographicMetricsGame.h"
+#include "./CheckpointManifest.h"
+#include "./ClockSync.h"
+#include "./PrivateJoin.h"
+#include "./ReadaheadReader.h"
+#include "./Sampling.h"
+#include "./TupleStore.h"
 
 namespace fbpcf::demographic_metrics {
 
@@ -34,6 +41,152 @@ struct SchedulerStatistics {
     }
 };
 
+// Columns of the input files the metrics use, the others are neither parsed
+// nor secret-input. The age column is always read, its size is the row
+// count of a shard.
+struct InputColumns {
+    bool wealth = true;
+    bool gender = true;
+    // categorical columns, loaded as is
+    std::vector<std::string> categories;
+    bool ids = false;
+};
+
+// Which metrics to calculate for every shard
+struct MetricsSelection {
+    bool validate = true;
+    bool average = false;
+    bool variance = false;
+    bool histogram = false;
+    // smallest and largest age and wealth
+    bool minMax = false;
+    // wealth average and variance, age/wealth covariance and correlation
+    bool covariance = false;
+    // quantiles of age and wealth, e.g. 0.5 and 0.9
+    std::vector<double> percentiles;
+    // rows the validation keeps, and whether their validity is revealed
+    ValidationSpec validationSpec = ValidationSpec::defaultSpec();
+    // per category count, sum and average of a column
+    GroupBySpec groupBy;
+    // align the rows of the parties by id_ with a private join instead of
+    // relying on row i of both inputs being the same id
+    bool joinOnId = false;
+    // approximate mode, see Sampling.h: the share of rows the metrics are
+    // calculated on (1 for all), the seed both parties sample with and the
+    // confidence level of the reported intervals
+    double sampleRate = 1;
+    uint64_t sampleSeed = 0;
+    double confidence = 0.95;
+
+    bool sampled() const {
+        return sampleRate < 1;
+    }
+
+    bool anyMetric() const {
+        return average || variance || histogram || minMax || covariance ||
+            !percentiles.empty() || groupBy.enabled();
+    }
+
+    InputColumns inputColumns() const {
+        InputColumns columns;
+        columns.wealth = minMax || covariance || !percentiles.empty();
+        columns.gender = false;
+        columns.ids = joinOnId;
+        if (validate) {
+            for (const auto& rule : validationSpec.rules) {
+                columns.wealth = columns.wealth || rule.column == "wealth";
+                columns.gender = columns.gender || rule.column == "gender";
+            }
+        }
+        if (groupBy.enabled()) {
+            for (const auto& column : {groupBy.column, groupBy.valueColumn}) {
+                if (column == "wealth") {
+                    columns.wealth = true;
+                } else if (column == "gender") {
+                    columns.gender = true;
+                } else if (column != "age") {
+                    columns.categories.push_back(column);
+                }
+            }
+        }
+        return columns;
+    }
+
+    // Tells apart outputs calculated with different selections
+    std::string toString() const {
+        std::stringstream ss;
+        ss << "average=" << average << ";variance=" << variance
+           << ";histogram=" << histogram << ";minMax=" << minMax
+           << ";covariance=" << covariance << ";percentiles=";
+        for (auto quantile : percentiles) {
+            ss << quantile << ",";
+        }
+        if (validate) {
+            ss << ";validation=" << validationSpec.toString()
+               << (validationSpec.oblivious ? ";oblivious" : "");
+        }
+        if (groupBy.enabled()) {
+            ss << ";groupBy=" << groupBy.toString();
+        }
+        if (joinOnId) {
+            ss << ";joinOnId";
+        }
+        if (sampled()) {
+            ss << ";sample=" << sampleRate << "/" << sampleSeed << "/"
+               << confidence;
+        }
+        return ss.str();
+    }
+};
+
+// Optional features of the game threads, set from the command line
+struct AppOptions {
+    std::shared_ptr<TraceRecorder> traceRecorder;
+    // offline phase output, see TupleStore.h
+    std::string tupleDirectory;
+    // if set, the threads only calculate shares of the partial aggregates
+    // of their shards, and the aggregates of the whole job are revealed once
+    // and written here instead of the per shard outputs
+    std::string summaryOutputPath;
+    // incremental mode: the partial aggregates of every shard are stored
+    // here and reused by later runs instead of recomputing the shard
+    std::string stateDirectory;
+    // pin every game thread to its own core, see CpuAffinity.h
+    bool pinThreads = false;
+    // completed shards of restarted jobs are skipped, shared by all the
+    // game threads of a party
+    std::shared_ptr<CheckpointManifest> checkpointManifest;
+    // streaming reads of the input files, see ReadaheadReader.h
+    ReadaheadOptions readahead;
+    // read the next shard of a game thread while the current one runs
+    bool prefetchNextShard = false;
+};
+
+// Formats a list result as "[1, 2, 3]"
+template <typename T>
+std::string formatList(const std::vector<T>& values) {
+    std::stringstream ss;
+    ss << "[";
+    for (size_t i = 0; i < values.size(); ++i) {
+        ss << values[i];
+        if (i != values.size() - 1) {
+            ss << ", ";
+        }
+    }
+    ss << "]";
+    return ss.str();
+}
+
+// Formats confidence intervals as "[[1, 2], [3, 4]]"
+inline std::string formatIntervals(
+    const std::vector<ConfidenceInterval>& intervals) {
+    std::vector<std::string> formatted;
+    for (const auto& interval : intervals) {
+        formatted.push_back(formatList(interval.toVector()));
+    }
+    return formatList(formatted);
+}
+
 template <int schedulerId>
 class DemographicMetricsApp {
     using DemographicInfo = 
@@ -60,20 +213,68 @@ class DemographicMetricsApp {
             startFileIndex_(startFileIndex),
             numbFiles_(numFiles) {};
 
-        void run(
-            bool validate = true,
-            bool average = true,
-            bool variance = false,
-            bool histogram = false
-        );
+        // Calculates the metrics for every shard assigned to this app,
+        // the engine is released after each shard
+        void run(const MetricsSelection& metrics);
+
+        // Calculates the metrics for a job of a long-lived app (daemon mode),
+        // the scheduler and engine stay alive for the next job
+        void runJob(
+            const std::vector<std::string>& inputPaths,
+            const std::vector<std::string>& outputPaths,
+            const MetricsSelection& metrics);
+
+        // Merges this party's shares of the partial aggregates of every
+        // shard, see getPartialAggregates. Nothing is revealed.
+        void runPartialAggregates(const MetricsSelection& metrics);
+
+        // Reveals to alice the aggregates both parties hold shares of
+        PartialAggregates revealPartialAggregates(
+            const PartialAggregates& myShares);
+
+        // Returns true if the other party called this with the same value
+        bool agreesWithPeer(const std::string& value);
+
+        std::string calculateMetrics(
+            const std::string& inputPath,
+            const MetricsSelection& metrics);
+
+        std::string calculateMetrics(
+            DemographicInfo myInput,
+            const std::string& shardKey,
+            const MetricsSelection& metrics);
+
+        // Calculates the metrics of a single shard and returns the gates and
+        // traffic it took, used by the cost estimator
+        SchedulerStatistics measureShard(
+            const DemographicInfo& input,
+            const MetricsSelection& metrics);
+
+        // This party's shares of the aggregates of one shard
+        PartialAggregates calculatePartialAggregates(
+            const std::string& inputPath,
+            const MetricsSelection& metrics);
+
+        // Text output of aggregates revealed by revealPartialAggregates
+        static std::string formatAggregates(
+            const PartialAggregates& aggregates,
+            const MetricsSelection& metrics);
+
+        // Zero shares standing in for the other party's input
+        static DemographicInfo getDummyInput(
+            size_t numRows,
+            const InputColumns& columns = InputColumns());
 
         void addFromCSV(
             const std::vector<std::string>& header,
             const std::vector<std::string>& parts,
-            DemographicInfo& demographicInfo);
+            DemographicInfo& demographicInfo,
+            const InputColumns& columns);
 
+        // Columns that are not selected are left empty
         DemographicInfo getInputData(
-            const std::string& inputPath);
+            const std::string& inputPath,
+            const InputColumns& columns = InputColumns());
 
         void putOutputData(
             const std::string& output,
@@ -82,7 +283,79 @@ class DemographicMetricsApp {
         SchedulerStatistics getSchedulerStatistics() {
             return schedulerStatistics_;
         }
+
+        // Takes AND tuples from a store written by the offline phase, if the
+        // file does not exist tuples are generated online as usual
+        void setTupleStorePath(const std::string& tupleStorePath) {
+            tupleStorePath_ = tupleStorePath;
+        }
+
+        // Makes run() calculate partial aggregates instead of the per shard
+        // metrics, which are stored in stateDirectory if it is not empty
+        void setPartialAggregatesOnly(const std::string& stateDirectory) {
+            partialAggregatesOnly_ = true;
+            stateDirectory_ = stateDirectory;
+        }
+
+        // This party's shares of the merged aggregates of the shards run()
+        // calculated in partial aggregates mode
+        const PartialAggregates& getPartialAggregates() const {
+            return partialAggregates_;
+        }
+
+        // Evaluates the circuit in plaintext (still exchanging the messages
+        // with the other party), to measure the costs of a job without the
+        // cryptography. Has to be set before the first shard.
+        void setPlaintextScheduler(bool usePlaintextScheduler) {
+            usePlaintextScheduler_ = usePlaintextScheduler;
+        }
+
+        // Skips the shards of run() the manifest has as completed on both
+        // sides, and records every shard run() completes
+        void setCheckpointManifest(
+            std::shared_ptr<CheckpointManifest> checkpointManifest) {
+            checkpointManifest_ = std::move(checkpointManifest);
+        }
+
+        // Streams the inputs with readahead, and if prefetchNextShard is
+        // set run() reads the next shard while calculating the current one
+        void setReadahead(
+            const ReadaheadOptions& readahead,
+            bool prefetchNextShard) {
+            readahead_ = readahead;
+            prefetchNextShard_ = prefetchNextShard;
+        }
+
+        // Records shard, metric and reveal events, pass nullptr to disable
+        void setTraceRecorder(std::shared_ptr<TraceRecorder> traceRecorder) {
+            traceRecorder_ = std::move(traceRecorder);
+        }
+
+        // Measures the clock offset to the other party and sets it on the
+        // trace recorder. The other party's app has to call it at the same
+        // point whether or not either party traces, it's enough to do it on
+        // one game thread.
+        void syncTraceClock();
     private:   
+        // Lazily creates the scheduler and the game, the game is then
+        // reused by every following shard and job
+        DemographicMetricsGame<schedulerId>& getGame();
+
+        void updateSchedulerStatistics();
+
+        // Keeps the rows of a shard both parties have an id_ of, ordered so
+        // that they line up with the other party's rows, see PrivateJoin.h
+        DemographicInfo joinOnId(DemographicInfo myInput);
+
+        // Keeps the sampled rows of a shard if metrics are sampled, after
+        // checking the other party samples with the same rate and seed
+        void sampleInput(DemographicInfo& myInput, const MetricsSelection& metrics);
+
+        // Keeps the given rows of every loaded column, in the given order
+        static void selectRows(
+            DemographicInfo& input,
+            const std::vector<size_t>& rows);
+
         int party_;
         std::unique_ptr<fbpcf::engine::communication::IPartyCommunicationAgentFactory>
             communicationAgentFactory_;
@@ -93,6 +366,19 @@ class DemographicMetricsApp {
         long unsigned int startFileIndex_;
         int numbFiles_;
         SchedulerStatistics schedulerStatistics_;
+        std::shared_ptr<TraceRecorder> traceRecorder_;
+        std::string tupleStorePath_;
+        bool usePlaintextScheduler_ = false;
+        bool partialAggregatesOnly_ = false;
+        std::string stateDirectory_;
+        PartialAggregates partialAggregates_;
+        std::shared_ptr<CheckpointManifest> checkpointManifest_;
+        ReadaheadOptions readahead_;
+        bool prefetchNextShard_ = false;
+        std::unique_ptr<DemographicMetricsGame<schedulerId>> game_;
+        // created by the first join, used by every following one
+        std::unique_ptr<fbpcf::engine::communication::IPartyCommunicationAgent>
+            joinAgent_;
 };
 
 } // namespace demographic_metrics
@@ -1,6 +1,11 @@
+#include <algorithm>
 #include <fbpcf/io/api/FileIOWrappers.h>
 #include <fbpcf/scheduler/LazySchedulerFactory.h>
 #include <fbpcf/scheduler/NetworkPlaintextSchedulerFactory.h>
+#include <folly/json.h>
+#include <future>
+#include <limits>
+#include <optional>
 #include <vector>
 
 #include "./DemographicMetricsApp.h"
@@ -9,81 +14,145 @@
 namespace fbpcf::demographic_metrics {
 
 template <int schedulerId>
-void DemographicMetricsApp<schedulerId>::run(
-  bool validate,
-  bool average,
-  bool variance,
-  bool histogram
-) {
-  std::unique_ptr<fbpcf::scheduler::IScheduler> scheduler = fbpcf::scheduler::getLazySchedulerFactoryWithRealEngine(
+DemographicMetricsGame<schedulerId>& DemographicMetricsApp<schedulerId>::getGame() {
+  if (game_) {
+    return *game_;
+  }
+
+  std::unique_ptr<fbpcf::scheduler::IScheduler> scheduler;
+  if (usePlaintextScheduler_) {
+    XLOG(INFO) << "Using the network plaintext scheduler";
+    scheduler = fbpcf::scheduler::getNetworkPlaintextSchedulerFactory<false>(
+            party_, *communicationAgentFactory_, metricCollector_)
+            ->create();
+  } else if (tupleStoresMatch(
+                 *communicationAgentFactory_->create(1 - party_, "tuple_store"),
+                 party_,
+                 tupleStorePath_)) {
+    XLOG(INFO) << "Using precomputed tuples from " << tupleStorePath_;
+    scheduler = getLazySchedulerFactoryWithPrecomputedTuples(
+            party_, *communicationAgentFactory_, metricCollector_, tupleStorePath_)
+            ->create();
+  } else {
+    scheduler = fbpcf::scheduler::getLazySchedulerFactoryWithRealEngine(
             party_, *communicationAgentFactory_, metricCollector_)
             ->create();
+  }
 
-  auto game = DemographicMetricsGame<schedulerId>(std::move(scheduler));
+  game_ = std::make_unique<DemographicMetricsGame<schedulerId>>(std::move(scheduler));
+  game_->setTraceRecorder(traceRecorder_);
 
   XLOG(INFO, "Scheduler created successfully");
+  return *game_;
+}
 
-  for (size_t i = startFileIndex_; i < startFileIndex_ + numbFiles_; ++i) {
-    try {
-      CHECK_LT(i, inputPaths_.size()) << "File index exceeds number of files.";
-      std::string output;
-      auto myInput = getInputData(inputPaths_.at(i));
+template <int schedulerId>
+void DemographicMetricsApp<schedulerId>::run(const MetricsSelection& metrics) {
+  if (partialAggregatesOnly_) {
+    runPartialAggregates(metrics);
+    return;
+  }
 
-      auto numRows = myInput.ageShare.size();
-      XLOG(INFO) << "Have " << numRows << " values in inputData.";
-      std::stringstream ss;
+  // the parties agree on the completed shards before the first one runs, a
+  // shard is skipped only if it completed on both sides
+  auto metricsKey = metrics.toString();
+  std::vector<bool> completed(numbFiles_, false);
+  std::vector<std::string> inputFingerprints(numbFiles_);
+  if (checkpointManifest_) {
+    for (size_t i = startFileIndex_;
+         i < startFileIndex_ + numbFiles_ && i < inputPaths_.size();
+         ++i) {
+      auto& fingerprint = inputFingerprints[i - startFileIndex_];
+      try {
+        fingerprint = getInputFingerprint(inputPaths_.at(i));
+      } catch (const std::exception& e) {
+        XLOG(WARNING) << "No fingerprint of " << inputPaths_.at(i)
+                      << ", it won't be checkpointed: " << e.what();
+      }
+      auto done = checkpointManifest_->isCompleted(
+          inputPaths_.at(i), fingerprint, outputPaths_.at(i), metricsKey);
+      completed[i - startFileIndex_] =
+          agreesWithPeer(std::to_string(done)) && done;
+    }
+  }
 
-      DemographicInfo dummyInput = {
-          .ageShare = std::vector<uint32_t>(numRows),
-          .genderShare = std::vector<bool>(numRows),
-          .wealthShare = std::vector<uint32_t>(numRows),
-      };
+  std::vector<size_t> pending;
+  for (size_t i = startFileIndex_; i < startFileIndex_ + numbFiles_; ++i) {
+    if (completed[i - startFileIndex_]) {
+      XLOG(INFO) << "Skipping completed shard " << inputPaths_.at(i);
+    } else {
+      pending.push_back(i);
+    }
+  }
 
-      if (validate)
-      {
-        auto validateResult = party_ == 0
-            ? game.demographicMetricsValidate(myInput, dummyInput)
-            : game.demographicMetricsValidate(dummyInput, myInput);
-        ss << "validateResult: " << validateResult << std::endl;
+  // with prefetching the next shard is parsed while this one is calculated,
+  // otherwise the read is deferred until the shard starts (and runs on the
+  // game thread, which keeps its core)
+  auto readInput = [this, columns = metrics.inputColumns()](size_t i) {
+    if (!prefetchNextShard_) {
+      return std::async(std::launch::deferred, [this, i, columns]() {
+        return getInputData(inputPaths_.at(i), columns);
+      });
+    }
+    return std::async(std::launch::async, [this, i, columns]() {
+      releaseHelperThread();
+      return getInputData(inputPaths_.at(i), columns);
+    });
+  };
+  std::future<DemographicInfo> nextInput;
+
+  for (size_t p = 0; p < pending.size(); ++p) {
+    auto i = pending.at(p);
+    try {
+      CHECK_LT(i, inputPaths_.size()) << "File index exceeds number of files.";
+      auto myInput = nextInput.valid() ? nextInput.get() : readInput(i).get();
+      if (p + 1 < pending.size() && pending.at(p + 1) < inputPaths_.size()) {
+        nextInput = readInput(pending.at(p + 1));
       }
-      
-      float averageResult = 0;
-      if (average || variance)
-      {
-        averageResult = party_ == 0
-            ? game.demographicMetricsAverageSecretShared(myInput, dummyInput)
-            : game.demographicMetricsAverageSecretShared(dummyInput, myInput);
-        ss << "averageResult: " << averageResult << std::endl;
+      if (metrics.joinOnId) {
+        myInput = joinOnId(std::move(myInput));
       }
 
-      if (variance)
+      std::string output;
       {
-        auto varianceResult = party_ == 0
-            ? game.demographicMetricsVariance(myInput, dummyInput, averageResult)
-            : game.demographicMetricsVariance(dummyInput, myInput, averageResult);
-        ss << "varianceResult: " << varianceResult << std::endl;
+        TraceScope shardScope(
+            traceRecorder_, "shard " + inputPaths_.at(i), "shard");
+        output = calculateMetrics(std::move(myInput), inputPaths_.at(i), metrics);
       }
-
-      if (histogram)
-      {
-        auto histogramResult = party_ == 0
-            ? game.demographicMetricsHistogram(myInput, dummyInput)
-            : game.demographicMetricsHistogram(dummyInput, myInput);
-        ss << "histogramResult: [";
-
-        for (long unsigned int i = 0; i < histogramResult.size(); ++i) {
-          ss << histogramResult[i];
-          if (i != histogramResult.size() - 1) {
-            ss << ", ";
-          }
-        }
-
-        ss << "]" << std::endl;
+      putOutputData(output, outputPaths_.at(i));
+      auto& fingerprint = inputFingerprints[i - startFileIndex_];
+      if (checkpointManifest_ && !fingerprint.empty()) {
+        checkpointManifest_->recordCompleted(
+            inputPaths_.at(i), fingerprint, outputPaths_.at(i), metricsKey, output);
       }
+    } catch (const std::exception& e) {
+      XLOGF(
+          ERR,
+          "Error: Exception caught in CalculatorApp run.\n \t error msg: {} \n \t input shard: {}.",
+          e.what(),
+          inputPaths_.at(i));
+      std::exit(1);
+    }
 
-      XLOG(INFO) << "done calculating";    
+    updateSchedulerStatistics();
+    fbpcf::scheduler::SchedulerKeeper<schedulerId>::deleteEngine();
+  }
+}
 
-      putOutputData(ss.str(), outputPaths_.at(i));
+template <int schedulerId>
+void DemographicMetricsApp<schedulerId>::runPartialAggregates(
+    const MetricsSelection& metrics) {
+  if (!stateDirectory_.empty()) {
+    std::filesystem::create_directories(stateDirectory_);
+  }
+
+  // the shares of all the shards are added up locally, so only the final
+  // aggregates are ever revealed
+  for (size_t i = startFileIndex_; i < startFileIndex_ + numbFiles_; ++i) {
+    try {
+      CHECK_LT(i, inputPaths_.size()) << "File index exceeds number of files.";
+      partialAggregates_.merge(
+          calculatePartialAggregates(inputPaths_.at(i), metrics));
     } catch (const std::exception& e) {
       XLOGF(
           ERR,
@@ -92,51 +161,561 @@ void DemographicMetricsApp<schedulerId>::run(
           inputPaths_.at(i));
       std::exit(1);
     }
+  }
 
-    auto gateStatistics =
-          fbpcf::scheduler::SchedulerKeeper<schedulerId>::getGateStatistics();
-      XLOGF(
-          INFO,
-          "Non-free gate count = {}, Free gate count = {}",
-          gateStatistics.first,
-          gateStatistics.second);
+  // unlike run() the engine is released once, after the last shard
+  updateSchedulerStatistics();
+  fbpcf::scheduler::SchedulerKeeper<schedulerId>::deleteEngine();
+}
 
-      auto trafficStatistics =
-          fbpcf::scheduler::SchedulerKeeper<schedulerId>::getTrafficStatistics();
-      XLOGF(
-          INFO,
-          "Sent network traffic = {}, Received network traffic = {}",
-          trafficStatistics.first,
-          trafficStatistics.second);
-
-      schedulerStatistics_.nonFreeGates = gateStatistics.first;
-      schedulerStatistics_.freeGates = gateStatistics.second;
-      schedulerStatistics_.sentNetwork = trafficStatistics.first;
-      schedulerStatistics_.receivedNetwork = trafficStatistics.second;
-      fbpcf::scheduler::SchedulerKeeper<schedulerId>::deleteEngine();
-      schedulerStatistics_.details = metricCollector_->collectMetrics();
+template <int schedulerId>
+PartialAggregates DemographicMetricsApp<schedulerId>::revealPartialAggregates(
+    const PartialAggregates& myShares) {
+  auto aggregates = getGame().revealPartialAggregates(myShares);
+  updateSchedulerStatistics();
+  return aggregates;
+}
+
+template <int schedulerId>
+PartialAggregates DemographicMetricsApp<schedulerId>::calculatePartialAggregates(
+    const std::string& inputPath,
+    const MetricsSelection& metrics) {
+  auto statePath = stateDirectory_.empty()
+      ? std::string()
+      : (std::filesystem::path(stateDirectory_) /
+         (std::filesystem::path(inputPath).filename().string() + ".state"))
+            .string();
+
+  // a state is only used for the same input (path and fingerprint) and
+  // metrics it was calculated for, e.g. a rewritten input or another
+  // validation spec or group by is recalculated. So is a state of an older
+  // version, and the state is overwritten.
+  std::string fingerprint;
+  std::optional<PartialAggregates> stored;
+  if (!statePath.empty()) {
+    try {
+      fingerprint = getInputFingerprint(inputPath);
+    } catch (const std::exception& e) {
+      XLOG(WARNING) << "No fingerprint of " << inputPath
+                    << ", its partial aggregates won't be reused: " << e.what();
+    }
+  }
+  if (!statePath.empty() && std::filesystem::exists(statePath)) {
+    try {
+      stored = PartialAggregates::fromDynamic(
+          folly::parseJson(fbpcf::io::FileIOWrappers::readFile(statePath)));
+      stored->checkSource(inputPath, fingerprint, metrics.toString());
+    } catch (const std::invalid_argument& e) {
+      XLOG(WARNING) << "Ignoring stored partial aggregates " << statePath
+                    << ": " << e.what();
+      stored.reset();
+    }
+  }
+
+  // both parties have to skip the same shards, if only one of them has a
+  // usable state the shard is recalculated on both sides
+  if (!statePath.empty() &&
+      agreesWithPeer(std::to_string(stored.has_value())) && stored) {
+    XLOG(INFO) << "Using stored partial aggregates " << statePath;
+    return *stored;
+  }
+
+  auto& game = getGame();
+  TraceScope shardScope(traceRecorder_, "shard " + inputPath, "shard");
+
+  auto myInput = getInputData(inputPath, metrics.inputColumns());
+  if (metrics.joinOnId) {
+    myInput = joinOnId(std::move(myInput));
+  }
+  sampleInput(myInput, metrics);
+  auto dummyInput =
+      getDummyInput(myInput.ageShare.size(), metrics.inputColumns());
+  PartialAggregates myShares;
+  {
+    typename DemographicMetricsGame<schedulerId>::ShardScope gameShard(
+        game, inputPath);
+
+    if (metrics.validate) {
+      auto validateResult = party_ == 0
+          ? game.demographicMetricsValidate(
+                myInput, dummyInput, metrics.validationSpec)
+          : game.demographicMetricsValidate(
+                dummyInput, myInput, metrics.validationSpec);
+      XLOG(INFO) << "validateResult: " << validateResult;
+    }
+
+    myShares = party_ == 0
+        ? game.demographicMetricsPartialAggregates(
+              myInput, dummyInput, party_, metrics.histogram, metrics.groupBy)
+        : game.demographicMetricsPartialAggregates(
+              dummyInput, myInput, party_, metrics.histogram, metrics.groupBy);
+  }
+
+  if (!statePath.empty()) {
+    myShares.inputPath = inputPath;
+    myShares.inputFingerprint = fingerprint;
+    myShares.metricsKey = metrics.toString();
+    XLOG(INFO) << "Storing partial aggregates " << statePath;
+    fbpcf::io::FileIOWrappers::writeFile(
+        statePath, folly::toJson(myShares.toDynamic()));
+  }
+  return myShares;
+}
+
+template <int schedulerId>
+std::string DemographicMetricsApp<schedulerId>::formatAggregates(
+    const PartialAggregates& aggregates,
+    const MetricsSelection& metrics) {
+  std::stringstream ss;
+  // sampled counts and sums are scaled up to estimates of the full data
+  auto rate = metrics.sampleRate;
+  auto z = getZScore(metrics.confidence);
+  if (metrics.sampled()) {
+    ss << "sampleRate: " << rate << std::endl;
+    ss << "sampledCount: " << aggregates.count << std::endl;
+    ss << "countResult: " << scaleCount(aggregates.count, rate) << std::endl;
+    ss << "countInterval: "
+       << formatList(countInterval(aggregates.count, rate, z).toVector())
+       << std::endl;
+  } else {
+    ss << "countResult: " << aggregates.count << std::endl;
+  }
+  if (metrics.average || metrics.variance) {
+    ss << "averageResult: " << aggregates.average() << std::endl;
+    if (metrics.sampled()) {
+      auto interval = meanInterval(
+          aggregates.average(), aggregates.variance(), aggregates.count, rate, z);
+      ss << "averageInterval: " << formatList(interval.toVector()) << std::endl;
+    }
+  }
+  if (metrics.variance) {
+    ss << "varianceResult: " << aggregates.variance() << std::endl;
+    if (metrics.sampled()) {
+      auto interval =
+          varianceInterval(aggregates.variance(), aggregates.count, rate, z);
+      ss << "varianceInterval: " << formatList(interval.toVector()) << std::endl;
+    }
+  }
+  if (metrics.histogram) {
+    if (metrics.sampled()) {
+      auto [estimates, intervals] = scaleCounts(aggregates.histogram, rate, z);
+      ss << "histogramResult: " << formatList(estimates) << std::endl;
+      ss << "histogramInterval: " << formatIntervals(intervals) << std::endl;
+    } else {
+      ss << "histogramResult: " << formatList(aggregates.histogram) << std::endl;
+    }
+  }
+  if (metrics.groupBy.enabled()) {
+    auto groupAverages = aggregates.groupAverages();
+    if (metrics.sampled()) {
+      auto [counts, intervals] = scaleCounts(aggregates.groupCounts, rate, z);
+      std::vector<double> sums;
+      for (auto sum : aggregates.groupSums) {
+        sums.push_back(scaleCount(sum, rate));
       }
+      ss << "groupCountResult: " << formatList(counts) << std::endl;
+      ss << "groupCountInterval: " << formatIntervals(intervals) << std::endl;
+      ss << "groupSumResult: " << formatList(sums) << std::endl;
+    } else {
+      ss << "groupCountResult: " << formatList(aggregates.groupCounts) << std::endl;
+      ss << "groupSumResult: " << formatList(aggregates.groupSums) << std::endl;
+    }
+    ss << "groupAverageResult: " << formatList(groupAverages) << std::endl;
+  }
+  return ss.str();
+}
+
+template <int schedulerId>
+typename DemographicMetricsApp<schedulerId>::DemographicInfo
+DemographicMetricsApp<schedulerId>::getDummyInput(
+    size_t numRows,
+    const InputColumns& columns) {
+  DemographicInfo dummyInput{
+      .ageShare = std::vector<uint32_t>(numRows),
+      .genderShare = std::vector<uint32_t>(columns.gender ? numRows : 0),
+      .wealthShare = std::vector<uint32_t>(columns.wealth ? numRows : 0),
+  };
+  for (const auto& category : columns.categories) {
+    dummyInput.categoryShares[category] = std::vector<uint32_t>(numRows);
+  }
+  return dummyInput;
+}
+
+template <int schedulerId>
+SchedulerStatistics DemographicMetricsApp<schedulerId>::measureShard(
+    const DemographicInfo& input,
+    const MetricsSelection& metrics) {
+  calculateMetrics(input, "sample", metrics);
+  updateSchedulerStatistics();
+  return schedulerStatistics_;
+}
+
+template <int schedulerId>
+void DemographicMetricsApp<schedulerId>::runJob(
+    const std::vector<std::string>& inputPaths,
+    const std::vector<std::string>& outputPaths,
+    const MetricsSelection& metrics) {
+  CHECK_EQ(inputPaths.size(), outputPaths.size())
+      << "Job has unequal number of input and output files";
+
+  // unlike run() the engine is kept alive, the next job reuses it
+  for (size_t i = 0; i < inputPaths.size(); ++i) {
+    putOutputData(calculateMetrics(inputPaths.at(i), metrics), outputPaths.at(i));
+  }
+  updateSchedulerStatistics();
+}
+
+template <int schedulerId>
+bool DemographicMetricsApp<schedulerId>::agreesWithPeer(const std::string& value) {
+  return getGame().publicValuesMatch(
+      static_cast<uint32_t>(std::hash<std::string>{}(value)));
+}
+
+template <int schedulerId>
+void DemographicMetricsApp<schedulerId>::syncTraceClock() {
+  // a plain agent of its own, the pings must not queue behind game traffic.
+  // The sync runs even without tracing, the other party may trace alone and
+  // would wait forever for the pings.
+  auto agent = communicationAgentFactory_->create(1 - party_, "trace_clock");
+  auto clockOffset = measureClockOffset(*agent, party_);
+  if (!traceRecorder_) {
+    return;
+  }
+  XLOGF(
+      INFO,
+      "Trace clock offset to the other party: {} us (round trip {} us)",
+      clockOffset.offsetUs,
+      clockOffset.roundTripUs);
+  traceRecorder_->setClockOffset(clockOffset.offsetUs, clockOffset.roundTripUs);
+}
+
+template <int schedulerId>
+std::string DemographicMetricsApp<schedulerId>::calculateMetrics(
+    const std::string& inputPath,
+    const MetricsSelection& metrics) {
+  TraceScope shardScope(traceRecorder_, "shard " + inputPath, "shard");
+  auto myInput = getInputData(inputPath, metrics.inputColumns());
+  if (metrics.joinOnId) {
+    myInput = joinOnId(std::move(myInput));
+  }
+  return calculateMetrics(std::move(myInput), inputPath, metrics);
+}
+
+template <int schedulerId>
+typename DemographicMetricsApp<schedulerId>::DemographicInfo
+DemographicMetricsApp<schedulerId>::joinOnId(DemographicInfo myInput) {
+  TraceScope traceScope(traceRecorder_, "privateJoin", "metric");
+  if (myInput.ids.size() != myInput.ageShare.size()) {
+    throw std::invalid_argument("The private join needs an id_ column");
+  }
+  if (!joinAgent_) {
+    joinAgent_ = communicationAgentFactory_->create(1 - party_, "private_join");
+  }
+  selectRows(myInput, privateJoin(*joinAgent_, party_, myInput.ids));
+  myInput.ids.clear();
+  return myInput;
+}
+
+template <int schedulerId>
+void DemographicMetricsApp<schedulerId>::sampleInput(
+    DemographicInfo& myInput,
+    const MetricsSelection& metrics) {
+  if (!metrics.sampled()) {
+    return;
+  }
+  // different seeds would pair up shares of different rows
+  if (!agreesWithPeer(
+          std::to_string(metrics.sampleRate) + "/" +
+          std::to_string(metrics.sampleSeed))) {
+    throw std::invalid_argument(
+        "The parties sample with different --sample_rate or --sample_seed");
+  }
+  auto numRows = myInput.ageShare.size();
+  selectRows(
+      myInput, sampleRows(numRows, metrics.sampleRate, metrics.sampleSeed));
+  XLOG(INFO) << "Sampled " << myInput.ageShare.size() << " of " << numRows
+             << " rows";
+}
+
+template <int schedulerId>
+void DemographicMetricsApp<schedulerId>::selectRows(
+    DemographicInfo& input,
+    const std::vector<size_t>& rows) {
+  // columns that were not loaded stay empty
+  auto selectColumn = [&rows](auto& column) {
+    if (column.empty()) {
+      return;
+    }
+    std::remove_reference_t<decltype(column)> selected;
+    selected.reserve(rows.size());
+    for (auto row : rows) {
+      selected.push_back(std::move(column.at(row)));
+    }
+    column = std::move(selected);
+  };
+  selectColumn(input.ageShare);
+  selectColumn(input.genderShare);
+  selectColumn(input.wealthShare);
+  for (auto& category : input.categoryShares) {
+    selectColumn(category.second);
+  }
+  selectColumn(input.ids);
+}
+
+template <int schedulerId>
+std::string DemographicMetricsApp<schedulerId>::calculateMetrics(
+    DemographicInfo myInput,
+    const std::string& shardKey,
+    const MetricsSelection& metrics) {
+  auto& game = getGame();
+
+  XLOG(INFO) << "Have " << myInput.ageShare.size() << " values in inputData.";
+  std::stringstream ss;
+
+  // the sample is taken before anything is secret-input, counts and sums of
+  // the sample are scaled up to estimates of the full shard
+  auto rate = metrics.sampleRate;
+  auto z = getZScore(metrics.confidence);
+  if (metrics.sampled()) {
+    sampleInput(myInput, metrics);
+    ss << "sampleRate: " << rate << std::endl;
+    ss << "sampledRows: " << myInput.ageShare.size() << std::endl;
+  }
+  auto numRows = myInput.ageShare.size();
+
+  // every column is secret-input once for all the metrics of this shard
+  typename DemographicMetricsGame<schedulerId>::ShardScope gameShard(
+      game, shardKey);
+
+  auto dummyInput = getDummyInput(numRows, metrics.inputColumns());
+
+  // rows of the (sampled) shard the metrics run on
+  double count = numRows;
+  if (metrics.validate)
+  {
+    auto validateResult = party_ == 0
+        ? game.demographicMetricsValidate(
+              myInput, dummyInput, metrics.validationSpec)
+        : game.demographicMetricsValidate(
+              dummyInput, myInput, metrics.validationSpec);
+    count = validateResult;
+    ss << "validateResult: " << validateResult << std::endl;
+  }
+  if (metrics.sampled()) {
+    ss << "countResult: " << scaleCount(count, rate) << std::endl;
+    ss << "countInterval: "
+       << formatList(countInterval(count, rate, z).toVector()) << std::endl;
+  }
+
+  // the interval of a sampled average needs the variance
+  float averageResult = 0;
+  float varianceResult = 0;
+  bool sampledAverage = metrics.sampled() && metrics.average;
+  if (metrics.average || metrics.variance)
+  {
+    averageResult = party_ == 0
+        ? game.demographicMetricsAverageSecretShared(myInput, dummyInput)
+        : game.demographicMetricsAverageSecretShared(dummyInput, myInput);
+    ss << "averageResult: " << averageResult << std::endl;
+  }
+
+  if (metrics.variance || sampledAverage)
+  {
+    varianceResult = party_ == 0
+        ? game.demographicMetricsVariance(myInput, dummyInput, averageResult)
+        : game.demographicMetricsVariance(dummyInput, myInput, averageResult);
+  }
+  if (metrics.sampled() && (metrics.average || metrics.variance)) {
+    auto interval = meanInterval(averageResult, varianceResult, count, rate, z);
+    ss << "averageInterval: " << formatList(interval.toVector()) << std::endl;
+  }
+  if (metrics.variance)
+  {
+    ss << "varianceResult: " << varianceResult << std::endl;
+    if (metrics.sampled()) {
+      auto interval = varianceInterval(varianceResult, count, rate, z);
+      ss << "varianceInterval: " << formatList(interval.toVector()) << std::endl;
+    }
+  }
+
+  if (metrics.histogram)
+  {
+    auto histogramResult = party_ == 0
+        ? game.demographicMetricsHistogram(myInput, dummyInput)
+        : game.demographicMetricsHistogram(dummyInput, myInput);
+    if (metrics.sampled()) {
+      auto [estimates, intervals] = scaleCounts(histogramResult, rate, z);
+      ss << "histogramResult: " << formatList(estimates) << std::endl;
+      ss << "histogramInterval: " << formatIntervals(intervals) << std::endl;
+    } else {
+      ss << "histogramResult: " << formatList(histogramResult) << std::endl;
+    }
+  }
+
+  if (metrics.covariance)
+  {
+    auto moments = party_ == 0
+        ? game.demographicMetricsAgeWealthMoments(myInput, dummyInput)
+        : game.demographicMetricsAgeWealthMoments(dummyInput, myInput);
+    ss << "wealthAverageResult: " << moments.wealthAverage() << std::endl;
+    ss << "wealthVarianceResult: " << moments.wealthVariance() << std::endl;
+    ss << "covarianceResult: " << moments.covariance() << std::endl;
+    ss << "correlationResult: " << moments.correlation() << std::endl;
+    if (metrics.sampled()) {
+      auto wealthInterval = meanInterval(
+          moments.wealthAverage(), moments.wealthVariance(), moments.count, rate, z);
+      auto correlation = correlationInterval(moments.correlation(), moments.count, z);
+      ss << "wealthAverageInterval: " << formatList(wealthInterval.toVector())
+         << std::endl;
+      ss << "correlationInterval: " << formatList(correlation.toVector())
+         << std::endl;
+    }
+  }
+
+  if (metrics.minMax)
+  {
+    auto minMaxResult = party_ == 0
+        ? game.demographicMetricsMinMax(myInput, dummyInput)
+        : game.demographicMetricsMinMax(dummyInput, myInput);
+    ss << "minAgeResult: " << minMaxResult.minAge << std::endl;
+    ss << "maxAgeResult: " << minMaxResult.maxAge << std::endl;
+    ss << "minWealthResult: " << minMaxResult.minWealth << std::endl;
+    ss << "maxWealthResult: " << minMaxResult.maxWealth << std::endl;
+  }
+
+  if (!metrics.percentiles.empty())
+  {
+    // a sampled quantile is bounded by two more quantiles of the sample,
+    // searched for together with it
+    auto quantiles = metrics.percentiles;
+    if (metrics.sampled()) {
+      for (auto quantile : metrics.percentiles) {
+        auto bounds = quantileBounds(quantile, count, z);
+        quantiles.push_back(bounds.first);
+        quantiles.push_back(bounds.second);
+      }
+    }
+    // without validation any 32-bit age can be left
+    auto maxAge = metrics.validate ? metrics.validationSpec.maxValue("age")
+                                   : std::numeric_limits<uint32_t>::max();
+    auto agePercentiles = party_ == 0
+        ? game.demographicMetricsAgePercentiles(
+              myInput, dummyInput, quantiles, party_, maxAge)
+        : game.demographicMetricsAgePercentiles(
+              dummyInput, myInput, quantiles, party_, maxAge);
+    auto wealthPercentiles = party_ == 0
+        ? game.demographicMetricsWealthPercentiles(myInput, dummyInput, quantiles, party_)
+        : game.demographicMetricsWealthPercentiles(dummyInput, myInput, quantiles, party_);
+
+    auto numQuantiles = metrics.percentiles.size();
+    auto splitIntervals = [numQuantiles](std::vector<uint32_t>& values) {
+      std::vector<ConfidenceInterval> intervals;
+      for (size_t i = 0; i < numQuantiles; ++i) {
+        intervals.push_back(
+            {double(values.at(numQuantiles + 2 * i)),
+             double(values.at(numQuantiles + 2 * i + 1))});
+      }
+      values.resize(numQuantiles);
+      return intervals;
+    };
+    if (metrics.sampled()) {
+      auto ageIntervals = splitIntervals(agePercentiles);
+      auto wealthIntervals = splitIntervals(wealthPercentiles);
+      ss << "agePercentilesResult: " << formatList(agePercentiles) << std::endl;
+      ss << "agePercentilesInterval: " << formatIntervals(ageIntervals) << std::endl;
+      ss << "wealthPercentilesResult: " << formatList(wealthPercentiles) << std::endl;
+      ss << "wealthPercentilesInterval: " << formatIntervals(wealthIntervals)
+         << std::endl;
+    } else {
+      ss << "agePercentilesResult: " << formatList(agePercentiles) << std::endl;
+      ss << "wealthPercentilesResult: " << formatList(wealthPercentiles) << std::endl;
+    }
+  }
+
+  if (metrics.groupBy.enabled())
+  {
+    auto groups = party_ == 0
+        ? game.demographicMetricsGroupBy(myInput, dummyInput, metrics.groupBy)
+        : game.demographicMetricsGroupBy(dummyInput, myInput, metrics.groupBy);
+    if (metrics.sampled()) {
+      auto [counts, intervals] = scaleCounts(groups.counts, rate, z);
+      std::vector<double> sums;
+      for (auto sum : groups.sums) {
+        sums.push_back(scaleCount(sum, rate));
+      }
+      ss << "groupCountResult: " << formatList(counts) << std::endl;
+      ss << "groupCountInterval: " << formatIntervals(intervals) << std::endl;
+      ss << "groupSumResult: " << formatList(sums) << std::endl;
+    } else {
+      ss << "groupCountResult: " << formatList(groups.counts) << std::endl;
+      ss << "groupSumResult: " << formatList(groups.sums) << std::endl;
+    }
+    ss << "groupAverageResult: " << formatList(groups.averages()) << std::endl;
+  }
+
+  XLOG(INFO) << "done calculating";
+  return ss.str();
+}
+
+template <int schedulerId>
+void DemographicMetricsApp<schedulerId>::updateSchedulerStatistics() {
+  auto gateStatistics =
+      fbpcf::scheduler::SchedulerKeeper<schedulerId>::getGateStatistics();
+  XLOGF(
+      INFO,
+      "Non-free gate count = {}, Free gate count = {}",
+      gateStatistics.first,
+      gateStatistics.second);
+
+  auto trafficStatistics =
+      fbpcf::scheduler::SchedulerKeeper<schedulerId>::getTrafficStatistics();
+  XLOGF(
+      INFO,
+      "Sent network traffic = {}, Received network traffic = {}",
+      trafficStatistics.first,
+      trafficStatistics.second);
+
+  schedulerStatistics_.nonFreeGates = gateStatistics.first;
+  schedulerStatistics_.freeGates = gateStatistics.second;
+  schedulerStatistics_.sentNetwork = trafficStatistics.first;
+  schedulerStatistics_.receivedNetwork = trafficStatistics.second;
+  schedulerStatistics_.details = metricCollector_->collectMetrics();
 }
 
 template <int schedulerId>
 void DemographicMetricsApp<schedulerId>::addFromCSV(
     const std::vector<std::string>& header,
     const std::vector<std::string>& parts,
-    DemographicInfo& demographicInfo) {
+    DemographicInfo& demographicInfo,
+    const InputColumns& columns) {
   std::vector<std::string> featureValues;
 
   uint32_t ageValue;
-  bool genderValue;
+  uint32_t genderValue;
   uint32_t wealthValue;
+  std::vector<uint32_t> categoryValues(columns.categories.size());
 
   for (std::size_t i = 0; i < header.size(); ++i) {
-    auto column = header[i];
-    auto value = parts[i];
+    const auto& column = header[i];
+    // columns no metric uses are skipped without parsing them
+    if ((column == "gender" && !columns.gender) ||
+        (column == "wealth" && !columns.wealth)) {
+      continue;
+    }
+    auto category = std::find(
+        columns.categories.begin(), columns.categories.end(), column);
+    const auto& value = parts[i];
+    // ids are only joined on, they may be any string
+    if (column == "id_" && columns.ids) {
+      demographicInfo.ids.push_back(value);
+      continue;
+    }
     uint32_t parsed = 0;
     std::istringstream iss{value};
 
     // Array columns and features may be parsed differently
-    if ((column == "age" || column == "wealth" || column == "id_" || column == "gender")) {
+    if ((column == "age" || column == "wealth" || column == "id_" ||
+         column == "gender" || category != columns.categories.end())) {
       iss >> parsed;
 
       if (iss.fail()) {
@@ -150,6 +729,8 @@ void DemographicMetricsApp<schedulerId>::addFromCSV(
       genderValue = (parsed);
     } else if (column == "wealth") {
       wealthValue = (parsed);
+    } else if (category != columns.categories.end()) {
+      categoryValues.at(category - columns.categories.begin()) = parsed;
     } else if (column != "id_") {
       // We shouldn't fail if there are extra columns in the input
       XLOG(WARNING) << "Warning: Unknown column in csv: " << column;
@@ -157,23 +738,43 @@ void DemographicMetricsApp<schedulerId>::addFromCSV(
   }
 
   demographicInfo.ageShare.push_back(ageValue);
-  demographicInfo.genderShare.push_back(genderValue);
-  demographicInfo.wealthShare.push_back(wealthValue);
+  if (columns.gender) {
+    demographicInfo.genderShare.push_back(genderValue);
+  }
+  if (columns.wealth) {
+    demographicInfo.wealthShare.push_back(wealthValue);
+  }
+  for (size_t i = 0; i < columns.categories.size(); ++i) {
+    demographicInfo.categoryShares[columns.categories[i]].push_back(
+        categoryValues[i]);
+  }
 }
 
 template <int schedulerId>
 typename DemographicMetricsApp<schedulerId>::DemographicInfo
 DemographicMetricsApp<schedulerId>::getInputData(
-      const std::string& inputPath) {
+      const std::string& inputPath,
+      const InputColumns& columns) {
     XLOG(INFO) << "Parsing input from " << inputPath;
     DemographicInfo outputInfo;
 
     auto readLine = [&](const std::vector<std::string>& header,
                         const std::vector<std::string>& parts) {
-      addFromCSV(header, parts, outputInfo);
+      addFromCSV(header, parts, outputInfo, columns);
+    };
+
+    // a missing group by column would silently put every row in category 0
+    auto checkHeader = [&](const std::vector<std::string>& header) {
+      for (const auto& category : columns.categories) {
+        if (std::find(header.begin(), header.end(), category) == header.end()) {
+          XLOG(FATAL) << "Input file " << inputPath << " has no column "
+                      << category;
+        }
+      }
     };
 
-    if (!fbpcf::demographic_metrics::readCsv(inputPath, readLine)) {
+    if (!fbpcf::demographic_metrics::readCsv(
+            inputPath, readLine, checkHeader, readahead_)) {
       XLOG(FATAL) << "Failed to read input file " << inputPath;
     }
     return outputInfo;
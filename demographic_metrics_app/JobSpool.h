@@ -0,0 +1,178 @@
+#pragma once
+
+#include <algorithm>
+#include <filesystem>
+#include <fstream>
+#include <optional>
+#include <string>
+#include <vector>
+
+#include <folly/String.h>
+#include "folly/logging/xlog.h"
+
+#include "./DemographicMetricsApp.h"
+
+namespace fbpcf::demographic_metrics {
+
+/**
+ * A job for the long-lived (daemon) mode of demographicapp. Jobs are text
+ * files with the ".job" extension dropped into a spool directory, one
+ * key=value pair per line:
+ *
+ *   input=/data/in_0.csv,/data/in_1.csv
+ *   output=/data/out_0.csv,/data/out_1.csv
+ *   metrics=average,variance,histogram,minmax,covariance
+ *   percentiles=0.5,0.9
+ *   validation=age=..199,gender=0|1
+ *   oblivious_validation=true
+ *   group_by=region:16
+ *   group_value=wealth
+ *   join_on_id=true
+ *   sample_rate=0.01
+ *   sample_seed=42
+ *   confidence=0.95
+ *
+ * A job with the line "shutdown=true" stops the daemon. Both parties have to
+ * receive a job with the same file name, jobs are taken in file name order.
+ * A job that is malformed on either side, or that asks for different
+ * metrics than the other party's, is rejected by both and the daemon moves
+ * on to the next one.
+ */
+struct DaemonJob {
+  std::string name;
+  std::vector<std::string> inputPaths;
+  std::vector<std::string> outputPaths;
+  MetricsSelection metrics;
+  bool shutdown = false;
+
+  // Everything both parties' copies of the job have to agree on, the
+  // number of files and the metrics decide the shape of the circuits
+  std::string toString() const {
+    return name + ";files=" + std::to_string(inputPaths.size()) +
+        ";shutdown=" + std::to_string(shutdown) + ";" + metrics.toString();
+  }
+};
+
+inline DaemonJob parseDaemonJob(const std::filesystem::path& jobPath) {
+  DaemonJob job;
+  job.name = jobPath.stem().string();
+
+  std::ifstream in(jobPath);
+  std::string line;
+  std::string groupBy;
+  std::string groupValue = "age";
+  while (std::getline(in, line)) {
+    line = folly::trimWhitespace(line).str();
+    if (line.empty() || line[0] == '#') {
+      continue;
+    }
+    auto separator = line.find('=');
+    if (separator == std::string::npos) {
+      throw std::invalid_argument("Malformed line in job " + job.name + ": " + line);
+    }
+    auto key = line.substr(0, separator);
+    auto value = line.substr(separator + 1);
+
+    if (key == "input") {
+      folly::split(',', value, job.inputPaths);
+    } else if (key == "output") {
+      folly::split(',', value, job.outputPaths);
+    } else if (key == "metrics") {
+      std::vector<std::string> metricNames;
+      folly::split(',', value, metricNames);
+      for (const auto& metric : metricNames) {
+        if (metric == "average") {
+          job.metrics.average = true;
+        } else if (metric == "variance") {
+          job.metrics.variance = true;
+        } else if (metric == "histogram") {
+          job.metrics.histogram = true;
+        } else if (metric == "minmax") {
+          job.metrics.minMax = true;
+        } else if (metric == "covariance") {
+          job.metrics.covariance = true;
+        } else {
+          throw std::invalid_argument("Unknown metric in job " + job.name + ": " + metric);
+        }
+      }
+    } else if (key == "percentiles") {
+      std::vector<std::string> quantiles;
+      folly::split(',', value, quantiles);
+      for (const auto& quantile : quantiles) {
+        job.metrics.percentiles.push_back(std::stod(quantile));
+      }
+    } else if (key == "validation") {
+      job.metrics.validationSpec = ValidationSpec::parse(
+          value, job.metrics.validationSpec.oblivious);
+    } else if (key == "oblivious_validation") {
+      job.metrics.validationSpec.oblivious = value == "true";
+    } else if (key == "group_by") {
+      groupBy = value;
+    } else if (key == "group_value") {
+      groupValue = value;
+    } else if (key == "join_on_id") {
+      job.metrics.joinOnId = value == "true";
+    } else if (key == "sample_rate") {
+      job.metrics.sampleRate = std::stod(value);
+    } else if (key == "sample_seed") {
+      job.metrics.sampleSeed = std::stoull(value);
+    } else if (key == "confidence") {
+      job.metrics.confidence = std::stod(value);
+    } else if (key == "shutdown") {
+      job.shutdown = value == "true";
+    } else {
+      XLOG(WARNING) << "Warning: Unknown key in job " << job.name << ": " << key;
+    }
+  }
+
+  job.metrics.groupBy = GroupBySpec::parse(groupBy, groupValue);
+
+  if (!job.shutdown && job.inputPaths.size() != job.outputPaths.size()) {
+    throw std::invalid_argument(
+        "Job " + job.name + " has unequal number of input and output files");
+  }
+  if (job.metrics.validationSpec.oblivious &&
+      (job.metrics.minMax || job.metrics.covariance ||
+       !job.metrics.percentiles.empty())) {
+    throw std::invalid_argument(
+        "Job " + job.name +
+        " uses oblivious validation with minmax, covariance or percentiles");
+  }
+  if (!(job.metrics.sampleRate > 0 && job.metrics.sampleRate <= 1) ||
+      !(job.metrics.confidence > 0 && job.metrics.confidence < 1)) {
+    throw std::invalid_argument(
+        "Job " + job.name + " has a sample rate or confidence out of range");
+  }
+  if (job.metrics.sampled() && job.metrics.validationSpec.oblivious) {
+    throw std::invalid_argument(
+        "Job " + job.name + " samples with oblivious validation");
+  }
+  if (!job.metrics.anyMetric()) {
+    job.metrics.average = true;
+  }
+  return job;
+}
+
+// Returns the pending job with the smallest file name, if any
+inline std::optional<std::filesystem::path> getNextDaemonJob(
+    const std::filesystem::path& spoolDirectory) {
+  std::optional<std::filesystem::path> next;
+  for (const auto& entry : std::filesystem::directory_iterator(spoolDirectory)) {
+    if (entry.is_regular_file() && entry.path().extension() == ".job" &&
+        (!next || entry.path().filename() < next->filename())) {
+      next = entry.path();
+    }
+  }
+  return next;
+}
+
+// Marks a job as processed by renaming it to <name>.<state>
+inline void finishDaemonJob(
+    const std::filesystem::path& jobPath,
+    const std::string& state) {
+  auto finishedPath = jobPath;
+  finishedPath.replace_extension(state);
+  std::filesystem::rename(jobPath, finishedPath);
+}
+
+} // namespace fbpcf::demographic_metrics
@@ -2,9 +2,12 @@
 
 #include <future>
 #include <memory>
+#include <optional>
 
 #include <folly/dynamic.h>
+#include "./CpuAffinity.h" //@manual
 #include "./DemographicMetricsApp.h" //@manual
+#include "./JobSpool.h" //@manual
 #include "fbpcf/engine/communication/SocketPartyCommunicationAgentFactory.h"
 
 
@@ -52,6 +55,25 @@ getIOFilepaths(
   return std::make_pair(inputFilepaths, outputFilepaths);
 }
 
+// Applies the options to the app of game thread threadIndex
+template <typename App>
+inline void configureApp(
+    App& app,
+    const AppOptions& options,
+    int party,
+    int threadIndex) {
+  app.setTraceRecorder(options.traceRecorder);
+  if (!options.tupleDirectory.empty()) {
+    app.setTupleStorePath(
+        getTupleStorePath(options.tupleDirectory, party, threadIndex));
+  }
+  if (!options.summaryOutputPath.empty()) {
+    app.setPartialAggregatesOnly(options.stateDirectory);
+  }
+  app.setCheckpointManifest(options.checkpointManifest);
+  app.setReadahead(options.readahead, options.prefetchNextShard);
+}
+
 template <int PARTY, int index>
 inline SchedulerStatistics startCalculatorAppsForShardedFilesHelper(
     int startFileIndex,
@@ -64,9 +86,9 @@ inline SchedulerStatistics startCalculatorAppsForShardedFilesHelper(
     std::vector<std::string>& outputFilepaths,
     fbpcf::engine::communication::SocketPartyCommunicationAgent::TlsInfo&
         tlsInfo,
-    bool averageMetrics,
-    bool varianceMetrics,
-    bool histogramMetrics) {
+    const MetricsSelection& metrics,
+    const AppOptions& options,
+    PartialAggregates& aggregateShares) {
   // aggregate scheduler statistics across apps
   SchedulerStatistics schedulerStatistics{
       0, 0, 0, 0, folly::dynamic::object()};
@@ -104,9 +126,18 @@ inline SchedulerStatistics startCalculatorAppsForShardedFilesHelper(
         metricCollector,
         startFileIndex,
         numFiles);
+    configureApp(*app, options, PARTY, index);
 
-    auto future = std::async([&app, &averageMetrics, &varianceMetrics, &histogramMetrics]() {
-      app->run(true, averageMetrics, varianceMetrics, histogramMetrics);
+    // always a thread of its own, a deferred task would run (and be pinned)
+    // on the thread of the caller
+    auto future = std::async(std::launch::async, [&app, &metrics, &options]() {
+      if (options.pinThreads) {
+        pinGameThread(index);
+      }
+      if constexpr (index == 0) {
+        app->syncTraceClock();
+      }
+      app->run(metrics);
       return app->getSchedulerStatistics();
     });
 
@@ -125,18 +156,68 @@ inline SchedulerStatistics startCalculatorAppsForShardedFilesHelper(
                 inputGlobalParamsPath,
                 outputFilepaths,
                 tlsInfo,
-                averageMetrics,
-                varianceMetrics,
-                histogramMetrics);
+                metrics,
+                options,
+                aggregateShares);
         schedulerStatistics.add(remainingStats);
       }
     }
     auto stats = future.get();
     schedulerStatistics.add(stats);
+    // shares are additive, so the threads' shares are merged locally
+    aggregateShares.merge(app->getPartialAggregates());
   }
   return schedulerStatistics;
 }
 
+// Final reduce step: reveals the aggregates of all the shards of the job
+// from the merged shares of every thread, on a connection of its own
+template <int PARTY>
+inline SchedulerStatistics revealJobAggregates(
+    const PartialAggregates& aggregateShares,
+    int numThreads,
+    std::string serverIp,
+    int port,
+    fbpcf::engine::communication::SocketPartyCommunicationAgent::TlsInfo&
+        tlsInfo,
+    const MetricsSelection& metrics,
+    const std::string& summaryOutputPath) {
+  // the game threads use the ports up to port + (numThreads - 1) * 100
+  std::map<
+      int,
+      fbpcf::engine::communication::SocketPartyCommunicationAgentFactory::
+          PartyInfo>
+      partyInfos(
+          {{0, {serverIp, port + numThreads * 100}},
+           {1, {serverIp, port + numThreads * 100}}});
+
+  auto metricCollector =
+      std::make_shared<fbpcf::util::MetricCollector>("lift_metrics_for_reduce");
+
+  auto communicationAgentFactory = std::make_unique<
+      fbpcf::engine::communication::SocketPartyCommunicationAgentFactory>(
+      PARTY, partyInfos, tlsInfo, metricCollector);
+
+  // all the game threads are done, so the scheduler id of the first one is
+  // free again
+  auto app = std::make_unique<DemographicMetricsApp<PARTY>>(
+      PARTY,
+      std::move(communicationAgentFactory),
+      std::vector<std::string>(),
+      std::vector<std::string>(),
+      metricCollector,
+      0,
+      0);
+
+  auto aggregates = app->revealPartialAggregates(aggregateShares);
+  XLOG(INFO) << "Revealed the aggregates of " << aggregates.count << " rows";
+  app->putOutputData(
+      DemographicMetricsApp<PARTY>::formatAggregates(aggregates, metrics),
+      summaryOutputPath);
+  fbpcf::scheduler::SchedulerKeeper<PARTY>::deleteEngine();
+  return app->getSchedulerStatistics();
+}
+
 template <int PARTY>
 inline SchedulerStatistics startCalculatorAppsForShardedFiles(
     std::vector<std::string>& inputFilepaths,
@@ -147,16 +228,16 @@ inline SchedulerStatistics startCalculatorAppsForShardedFiles(
     int port,
     fbpcf::engine::communication::SocketPartyCommunicationAgent::TlsInfo&
         tlsInfo,
-    bool averageMetrics = false,
-    bool varianceMetrics = false,
-    bool histogramMetrics = false) {
+    MetricsSelection metrics = MetricsSelection(),
+    const AppOptions& options = AppOptions()) {
 
-  if (!(averageMetrics || varianceMetrics || histogramMetrics))
-    averageMetrics = true;
+  if (!metrics.anyMetric())
+    metrics.average = true;
   // use only as many threads as the number of files
   auto numThreads = std::min((int)inputFilepaths.size(), (int)concurrency);
 
-  return startCalculatorAppsForShardedFilesHelper<PARTY, 0>(
+  PartialAggregates aggregateShares;
+  auto schedulerStatistics = startCalculatorAppsForShardedFilesHelper<PARTY, 0>(
       0,
       numThreads,
       numThreads,
@@ -166,9 +247,270 @@ inline SchedulerStatistics startCalculatorAppsForShardedFiles(
       inputGlobalParamsPath,
       outputFilepaths,
       tlsInfo,
-      averageMetrics,
-      varianceMetrics,
-      histogramMetrics);
+      metrics,
+      options,
+      aggregateShares);
+
+  if (!options.summaryOutputPath.empty()) {
+    schedulerStatistics.add(revealJobAggregates<PARTY>(
+        aggregateShares,
+        numThreads,
+        serverIp,
+        port,
+        tlsInfo,
+        metrics,
+        options.summaryOutputPath));
+  }
+  return schedulerStatistics;
+}
+
+// Estimate mode: runs the metrics on one sample shard with the network
+// plaintext scheduler and extrapolates its costs per row to the whole job.
+// The sample is the first input file (the row count of the others is
+// estimated from their size, so they have to be local files), or
+// sampleRows rows of zeros per input file if sampleRows is positive.
+template <int PARTY>
+inline void estimateJobCosts(
+    const std::vector<std::string>& inputFilepaths,
+    int16_t concurrency,
+    std::string serverIp,
+    int port,
+    fbpcf::engine::communication::SocketPartyCommunicationAgent::TlsInfo&
+        tlsInfo,
+    MetricsSelection metrics,
+    int64_t sampleRows,
+    double bandwidthMbps,
+    double roundTripMs) {
+  std::map<
+      int,
+      fbpcf::engine::communication::SocketPartyCommunicationAgentFactory::
+          PartyInfo>
+      partyInfos({{0, {serverIp, port}}, {1, {serverIp, port}}});
+
+  auto metricCollector =
+      std::make_shared<fbpcf::util::MetricCollector>("lift_metrics_for_estimate");
+
+  auto communicationAgentFactory = std::make_unique<
+      fbpcf::engine::communication::SocketPartyCommunicationAgentFactory>(
+      PARTY, partyInfos, tlsInfo, metricCollector);
+
+  auto app = std::make_unique<DemographicMetricsApp<PARTY>>(
+      PARTY,
+      std::move(communicationAgentFactory),
+      inputFilepaths,
+      std::vector<std::string>(),
+      metricCollector,
+      0,
+      0);
+  app->setPlaintextScheduler(true);
+  // the trace is only used to count the reveals
+  auto traceRecorder = std::make_shared<TraceRecorder>(PARTY);
+  app->setTraceRecorder(traceRecorder);
+
+  if (!metrics.anyMetric()) {
+    metrics.average = true;
+  }
+
+  typename DemographicMetricsGame<PARTY>::DemographicInfo sample;
+  uint64_t totalRows = 0;
+  if (sampleRows > 0) {
+    sample = DemographicMetricsApp<PARTY>::getDummyInput(
+        sampleRows, metrics.inputColumns());
+    totalRows = sampleRows * inputFilepaths.size();
+  } else {
+    sample = app->getInputData(inputFilepaths.at(0), metrics.inputColumns());
+    uint64_t totalBytes = 0;
+    for (const auto& inputFilepath : inputFilepaths) {
+      totalBytes += std::filesystem::file_size(inputFilepath);
+    }
+    totalRows = sample.ageShare.size() * double(totalBytes) /
+        std::filesystem::file_size(inputFilepaths.at(0));
+  }
+  auto numSampleRows = sample.ageShare.size();
+  CHECK_GT(numSampleRows, 0) << "The sample shard is empty";
+
+  auto statistics = app->measureShard(sample, metrics);
+  auto revealsPerShard = traceRecorder->countBegins("reveal");
+  fbpcf::scheduler::SchedulerKeeper<PARTY>::deleteEngine();
+
+  // gates and traffic grow with the rows, reveals with the shards, and the
+  // shards of a thread run one after the other
+  double scale = double(totalRows) / numSampleRows;
+  auto numThreads = std::min<size_t>(inputFilepaths.size(), concurrency);
+  auto shardsPerThread = (inputFilepaths.size() + numThreads - 1) / numThreads;
+  uint64_t trafficBytes =
+      (statistics.sentNetwork + statistics.receivedNetwork) * scale;
+  double transferSeconds = trafficBytes * 8 / (bandwidthMbps * 1e6);
+  double latencySeconds =
+      revealsPerShard * shardsPerThread * roundTripMs / 1000;
+
+  XLOGF(
+      INFO,
+      "Estimate from a sample of {} rows, projected to {} rows in {} files on {} threads:",
+      numSampleRows,
+      totalRows,
+      inputFilepaths.size(),
+      numThreads);
+  XLOGF(
+      INFO,
+      "\tnon-free gates (AND tuples) = {}, free gates = {}",
+      uint64_t(statistics.nonFreeGates * scale),
+      uint64_t(statistics.freeGates * scale));
+  XLOGF(
+      INFO,
+      "\tonline traffic = {} bytes sent and received by this party, tuple generation comes on top unless the tuples are precomputed",
+      trafficBytes);
+  XLOGF(
+      INFO,
+      "\treveals = {} per shard, each one round trip plus the AND depth of the circuit before it",
+      revealsPerShard);
+  XLOGF(
+      INFO,
+      "\tprojected time >= {:.1f} s: {:.1f} s of transfer at {} Mbps and {:.1f} s of round trips at {} ms",
+      transferSeconds + latencySeconds,
+      transferSeconds,
+      bandwidthMbps,
+      latencySeconds,
+      roundTripMs);
+}
+
+// Daemon mode: keeps a single app, its connection and its engine alive and
+// runs the jobs dropped into spoolDirectory until a shutdown job arrives
+template <int PARTY>
+inline SchedulerStatistics runDaemon(
+    const std::string& spoolDirectory,
+    int pollIntervalMs,
+    std::string serverIp,
+    int port,
+    fbpcf::engine::communication::SocketPartyCommunicationAgent::TlsInfo&
+        tlsInfo,
+    const AppOptions& options = AppOptions()) {
+  std::map<
+      int,
+      fbpcf::engine::communication::SocketPartyCommunicationAgentFactory::
+          PartyInfo>
+      partyInfos({{0, {serverIp, port}}, {1, {serverIp, port}}});
+
+  auto metricCollector =
+      std::make_shared<fbpcf::util::MetricCollector>("lift_metrics_for_daemon");
+
+  auto communicationAgentFactory = std::make_unique<
+      fbpcf::engine::communication::SocketPartyCommunicationAgentFactory>(
+      PARTY, partyInfos, tlsInfo, metricCollector);
+
+  // the app is only used through runJob, so it does not own any files
+  auto app = std::make_unique<DemographicMetricsApp<PARTY>>(
+      PARTY,
+      std::move(communicationAgentFactory),
+      std::vector<std::string>(),
+      std::vector<std::string>(),
+      metricCollector,
+      0,
+      0);
+  app->setTraceRecorder(options.traceRecorder);
+  if (!options.tupleDirectory.empty()) {
+    app->setTupleStorePath(getTupleStorePath(options.tupleDirectory, PARTY, 0));
+  }
+  app->syncTraceClock();
+  app->setReadahead(options.readahead, false);
+  // the daemon runs its single game on this thread
+  if (options.pinThreads) {
+    pinGameThread(0);
+  }
+
+  XLOG(INFO) << "Waiting for jobs in " << spoolDirectory;
+  while (true) {
+    auto jobPath = getNextDaemonJob(spoolDirectory);
+    if (!jobPath) {
+      std::this_thread::sleep_for(std::chrono::milliseconds(pollIntervalMs));
+      continue;
+    }
+
+    // a parse error is not fatal: the parties always compare their jobs, so
+    // the other party doesn't wait for a job that never starts
+    auto jobName = jobPath->stem().string();
+    std::optional<DaemonJob> job;
+    try {
+      job = parseDaemonJob(*jobPath);
+    } catch (const std::exception& e) {
+      XLOGF(ERR, "Error: Malformed daemon job {}: {}", jobName, e.what());
+    }
+    if (!app->agreesWithPeer(job ? job->toString() : jobName + ";malformed") ||
+        !job) {
+      XLOG(ERR) << "Rejecting job " << jobName
+                << ", it is malformed or differs from the other party's";
+      finishDaemonJob(*jobPath, ".rejected");
+      continue;
+    }
+
+    try {
+      if (job->shutdown) {
+        XLOG(INFO) << "Shutting down on job " << jobName;
+        finishDaemonJob(*jobPath, ".done");
+        break;
+      }
+
+      XLOG(INFO) << "Running job " << jobName << " with "
+                 << job->inputPaths.size() << " files";
+      app->runJob(job->inputPaths, job->outputPaths, job->metrics);
+      finishDaemonJob(*jobPath, ".done");
+    } catch (const std::exception& e) {
+      // the parties may be out of sync in the middle of the circuit, so the
+      // connection can't be reused
+      XLOGF(
+          ERR,
+          "Error: Exception caught in daemon job {}.\n \t error msg: {}",
+          jobName,
+          e.what());
+      finishDaemonJob(*jobPath, ".failed");
+      std::exit(1);
+    }
+  }
+  return app->getSchedulerStatistics();
+}
+
+// Offline phase, stores numTuples AND tuples for each of the numThreads game
+// threads so a later run with the same concurrency can consume them
+template <int PARTY>
+inline void precomputeTuplesForThreads(
+    int numThreads,
+    std::string serverIp,
+    int port,
+    fbpcf::engine::communication::SocketPartyCommunicationAgent::TlsInfo&
+        tlsInfo,
+    const std::string& tupleDirectory,
+    uint64_t numTuples) {
+  std::filesystem::create_directories(tupleDirectory);
+
+  std::vector<std::future<void>> futures;
+  for (int index = 0; index < numThreads; ++index) {
+    futures.push_back(std::async(std::launch::async, [=, &tlsInfo]() {
+      std::map<
+          int,
+          fbpcf::engine::communication::SocketPartyCommunicationAgentFactory::
+              PartyInfo>
+          partyInfos(
+              {{0, {serverIp, port + index * 100}},
+               {1, {serverIp, port + index * 100}}});
+
+      auto metricCollector = std::make_shared<fbpcf::util::MetricCollector>(
+          "tuple_precompute_for_thread_" + std::to_string(index));
+
+      auto communicationAgentFactory = std::make_unique<
+          fbpcf::engine::communication::SocketPartyCommunicationAgentFactory>(
+          PARTY, partyInfos, tlsInfo, metricCollector);
+
+      precomputeTuples(
+          PARTY,
+          *communicationAgentFactory,
+          metricCollector,
+          getTupleStorePath(tupleDirectory, PARTY, index),
+          numTuples);
+    }));
+  }
+  for (auto& future : futures) {
+    future.get();
+  }
 }
 
 } // namespace fbpcf::edit_distance
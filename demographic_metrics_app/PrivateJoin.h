@@ -0,0 +1,248 @@
+#pragma once
+
+#include <openssl/evp.h>
+#include <openssl/rand.h>
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <cstring>
+#include <exception>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "fbpcf/engine/communication/IPartyCommunicationAgent.h"
+#include "folly/logging/xlog.h"
+
+#include "./CpuAffinity.h"
+
+namespace fbpcf::demographic_metrics {
+
+/**
+ * Private join of the two parties' rows on their id_ column, so the inputs
+ * of a shard don't have to be aligned row by row offline.
+ *
+ * Diffie-Hellman PSI over X25519: every party hashes its ids to curve points
+ * and blinds them with a secret scalar of its own, then the other party
+ * blinds them again with its scalar. Blinding commutes, so an id both
+ * parties have ends up as the same doubly blinded key on both sides, while
+ * neither party can unblind the other's ids. Each party keeps its rows whose
+ * key the other party also has, ordered by key, which pairs up the shares of
+ * every common id. Ids that occur more than once keep their first row.
+ *
+ * Like any PSI this reveals to both parties which of their own rows are in
+ * the intersection, and so its size. The column values stay secret shared.
+ * Both parties have to put the same ids in the same shard (e.g. shard by a
+ * hash of the id), only rows of corresponding shards are joined.
+ */
+const size_t kJoinKeySize = 32;
+using JoinKey = std::array<unsigned char, kJoinKeySize>;
+
+// Multiplication of curve points by a secret scalar, fresh for every join
+class X25519Blinder {
+ public:
+  X25519Blinder() {
+    unsigned char scalar[kJoinKeySize];
+    if (RAND_bytes(scalar, kJoinKeySize) != 1) {
+      throw std::runtime_error("Failed to generate the join scalar");
+    }
+    scalar_.reset(EVP_PKEY_new_raw_private_key(
+        EVP_PKEY_X25519, nullptr, scalar, kJoinKeySize));
+    OPENSSL_cleanse(scalar, kJoinKeySize);
+    if (!scalar_) {
+      throw std::runtime_error("Failed to create the join scalar");
+    }
+  }
+
+  // Hashes an id to the u-coordinate of a point, every 32 byte string is
+  // one on the curve or its twist, and the ladder commutes on both
+  static JoinKey hashToPoint(const std::string& id) {
+    static const std::string kDomain = "demographic_metrics private join\n";
+    JoinKey point;
+    unsigned int size = 0;
+    std::unique_ptr<EVP_MD_CTX, decltype(&EVP_MD_CTX_free)> ctx(
+        EVP_MD_CTX_new(), &EVP_MD_CTX_free);
+    if (!ctx || EVP_DigestInit_ex(ctx.get(), EVP_sha256(), nullptr) != 1 ||
+        EVP_DigestUpdate(ctx.get(), kDomain.data(), kDomain.size()) != 1 ||
+        EVP_DigestUpdate(ctx.get(), id.data(), id.size()) != 1 ||
+        EVP_DigestFinal_ex(ctx.get(), point.data(), &size) != 1) {
+      throw std::runtime_error("Failed to hash a join id");
+    }
+    return point;
+  }
+
+  // Blinds the points (kJoinKeySize bytes each) on up to numThreads
+  // threads, the ladder is most of the cost of a join
+  std::vector<unsigned char> blindAll(
+      const std::vector<unsigned char>& points,
+      size_t numThreads) const {
+    std::vector<unsigned char> blinded(points.size());
+    auto numPoints = points.size() / kJoinKeySize;
+    numThreads = std::max<size_t>(
+        1, std::min(numThreads, numPoints / kMinPointsPerThread));
+    auto pointsPerThread = (numPoints + numThreads - 1) / numThreads;
+
+    std::vector<std::thread> threads;
+    std::vector<std::exception_ptr> errors(numThreads);
+    for (size_t i = 0; i < numThreads; ++i) {
+      auto begin = std::min(numPoints, i * pointsPerThread) * kJoinKeySize;
+      auto end = std::min(numPoints, (i + 1) * pointsPerThread) * kJoinKeySize;
+      threads.emplace_back([&, i, begin, end]() {
+        try {
+          releaseHelperThread();
+          blindRange(points.data() + begin, blinded.data() + begin, end - begin);
+        } catch (const std::exception&) {
+          errors[i] = std::current_exception();
+        }
+      });
+    }
+    for (auto& thread : threads) {
+      thread.join();
+    }
+    for (auto& error : errors) {
+      if (error) {
+        std::rethrow_exception(error);
+      }
+    }
+    return blinded;
+  }
+
+ private:
+  // below this a thread costs more than it saves
+  static constexpr size_t kMinPointsPerThread = 1024;
+
+  // One derivation context for the whole range, only the peer point changes
+  void blindRange(const unsigned char* points, unsigned char* out, size_t size)
+      const {
+    std::unique_ptr<EVP_PKEY_CTX, decltype(&EVP_PKEY_CTX_free)> ctx(
+        EVP_PKEY_CTX_new(scalar_.get(), nullptr), &EVP_PKEY_CTX_free);
+    if (!ctx || EVP_PKEY_derive_init(ctx.get()) != 1) {
+      throw std::runtime_error("Failed to initialize the join key blinding");
+    }
+    for (size_t offset = 0; offset < size; offset += kJoinKeySize) {
+      std::unique_ptr<EVP_PKEY, decltype(&EVP_PKEY_free)> peer(
+          EVP_PKEY_new_raw_public_key(
+              EVP_PKEY_X25519, nullptr, points + offset, kJoinKeySize),
+          &EVP_PKEY_free);
+      size_t blindedSize = kJoinKeySize;
+      // fails for the (negligibly likely) points of small order
+      if (!peer || EVP_PKEY_derive_set_peer(ctx.get(), peer.get()) != 1 ||
+          EVP_PKEY_derive(ctx.get(), out + offset, &blindedSize) != 1) {
+        throw std::runtime_error("Failed to blind a join key");
+      }
+    }
+  }
+
+  struct PkeyDeleter {
+    void operator()(EVP_PKEY* pkey) const {
+      EVP_PKEY_free(pkey);
+    }
+  };
+  std::unique_ptr<EVP_PKEY, PkeyDeleter> scalar_;
+};
+
+// Sends this party's keys and receives the other party's. Alice sends
+// first, so the two large messages are never both in flight.
+inline std::vector<unsigned char> exchangeJoinKeys(
+    fbpcf::engine::communication::IPartyCommunicationAgent& agent,
+    int party,
+    const std::vector<unsigned char>& myKeys) {
+  auto sendKeys = [&]() {
+    uint64_t count = myKeys.size() / kJoinKeySize;
+    std::vector<unsigned char> header(sizeof(count));
+    std::memcpy(header.data(), &count, sizeof(count));
+    agent.send(header);
+    if (!myKeys.empty()) {
+      agent.send(myKeys);
+    }
+  };
+  auto receiveKeys = [&]() {
+    auto header = agent.receive(sizeof(uint64_t));
+    uint64_t count;
+    std::memcpy(&count, header.data(), sizeof(count));
+    return count == 0 ? std::vector<unsigned char>()
+                      : agent.receive(count * kJoinKeySize);
+  };
+
+  if (party == 0) {
+    sendKeys();
+    return receiveKeys();
+  }
+  auto theirKeys = receiveKeys();
+  sendKeys();
+  return theirKeys;
+}
+
+// Returns the indices of this party's rows in the joined order, the row at
+// position i of both parties has the same id. The keys are blinded on up to
+// numThreads threads.
+inline std::vector<size_t> privateJoin(
+    fbpcf::engine::communication::IPartyCommunicationAgent& agent,
+    int party,
+    const std::vector<std::string>& ids,
+    size_t numThreads = std::thread::hardware_concurrency()) {
+  X25519Blinder blinder;
+  auto blindAll = [&blinder, numThreads](const std::vector<unsigned char>& keys) {
+    return blinder.blindAll(keys, numThreads);
+  };
+
+  std::vector<unsigned char> myPoints(ids.size() * kJoinKeySize);
+  for (size_t i = 0; i < ids.size(); ++i) {
+    auto point = X25519Blinder::hashToPoint(ids[i]);
+    std::memcpy(myPoints.data() + i * kJoinKeySize, point.data(), kJoinKeySize);
+  }
+
+  // my ids blinded by me, then by the other party (in my row order), and
+  // the other party's ids blinded by both
+  auto theirBlinded = exchangeJoinKeys(agent, party, blindAll(myPoints));
+  auto theirKeys = blindAll(theirBlinded);
+  auto myKeys = exchangeJoinKeys(agent, party, theirKeys);
+  if (myKeys.size() != myPoints.size()) {
+    throw std::runtime_error("Private join received the wrong number of keys");
+  }
+
+  auto keyAt = [](const std::vector<unsigned char>& keys, size_t row) {
+    return std::string(
+        reinterpret_cast<const char*>(keys.data()) + row * kJoinKeySize,
+        kJoinKeySize);
+  };
+  std::vector<std::string> theirSorted;
+  theirSorted.reserve(theirKeys.size() / kJoinKeySize);
+  for (size_t row = 0; row < theirKeys.size() / kJoinKeySize; ++row) {
+    theirSorted.push_back(keyAt(theirKeys, row));
+  }
+  std::sort(theirSorted.begin(), theirSorted.end());
+
+  std::vector<std::pair<std::string, size_t>> matches;
+  for (size_t row = 0; row < ids.size(); ++row) {
+    auto key = keyAt(myKeys, row);
+    if (std::binary_search(theirSorted.begin(), theirSorted.end(), key)) {
+      matches.emplace_back(std::move(key), row);
+    }
+  }
+  // by key, and for duplicate ids by row so the first one is kept
+  std::sort(matches.begin(), matches.end());
+  auto last = std::unique(
+      matches.begin(), matches.end(), [](const auto& a, const auto& b) {
+        return a.first == b.first;
+      });
+  auto duplicates = matches.end() - last;
+  matches.erase(last, matches.end());
+
+  std::vector<size_t> rows;
+  rows.reserve(matches.size());
+  for (const auto& match : matches) {
+    rows.push_back(match.second);
+  }
+  XLOGF(
+      INFO,
+      "Private join kept {} of {} rows ({} duplicate ids dropped)",
+      rows.size(),
+      ids.size(),
+      duplicates);
+  return rows;
+}
+
+} // namespace fbpcf::demographic_metrics
@@ -0,0 +1,348 @@
+#pragma once
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <algorithm>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <exception>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <aws/s3/S3Client.h>
+#include <aws/s3/model/GetObjectRequest.h>
+#include <aws/s3/model/HeadObjectRequest.h>
+#include "fbpcf/aws/S3Util.h"
+#include "fbpcf/io/api/FileReader.h"
+#include "fbpcf/io/api/IReaderCloser.h"
+
+#include "./CpuAffinity.h"
+
+namespace fbpcf::demographic_metrics {
+
+/**
+ * Streaming input with readahead, so downloading a shard overlaps with
+ * parsing it.
+ *
+ * The file is split into fixed size chunks that a few fetch threads request
+ * in parallel (ranged GETs for s3 objects, pread for local files), keeping
+ * at most `depth` chunks ahead of the parser. The parser reads the chunks in
+ * order through the IReaderCloser interface, as if it was a FileReader.
+ *
+ * s3 objects are fetched with the region of their uri. To test against a
+ * local S3-compatible stand-in, point AWS_ENDPOINT_OVERRIDE at it.
+ */
+struct ReadaheadOptions {
+  // 0 disables readahead, files are read with a plain FileReader
+  size_t chunkSize = 0;
+  int connections = 4;
+  // chunks fetched ahead of the parser, twice the connections by default
+  int depth = 0;
+
+  bool enabled() const {
+    return chunkSize > 0;
+  }
+};
+
+// Random access to the bytes of an input, read concurrently by the fetch
+// threads
+class IRangeSource {
+ public:
+  virtual ~IRangeSource() = default;
+  virtual uint64_t size() = 0;
+  virtual std::string read(uint64_t offset, uint64_t length) = 0;
+  // Changes whenever the input is rewritten, without reading it
+  virtual std::string fingerprint() = 0;
+};
+
+class LocalRangeSource final : public IRangeSource {
+ public:
+  explicit LocalRangeSource(const std::string& path)
+      : path_(path), fd_(::open(path.c_str(), O_RDONLY)) {
+    if (fd_ < 0) {
+      throw std::runtime_error("Failed to open " + path + ": " + std::strerror(errno));
+    }
+  }
+
+  ~LocalRangeSource() override {
+    ::close(fd_);
+  }
+
+  uint64_t size() override {
+    return fileStatus().st_size;
+  }
+
+  // size and modification time
+  std::string fingerprint() override {
+    auto st = fileStatus();
+    return std::to_string(st.st_size) + "@" + std::to_string(st.st_mtim.tv_sec) +
+        "." + std::to_string(st.st_mtim.tv_nsec);
+  }
+
+  std::string read(uint64_t offset, uint64_t length) override {
+    std::string data(length, '\0');
+    uint64_t done = 0;
+    while (done < length) {
+      auto bytes = ::pread(fd_, data.data() + done, length - done, offset + done);
+      if (bytes < 0) {
+        throw std::runtime_error("Failed to read " + path_ + ": " + std::strerror(errno));
+      }
+      if (bytes == 0) {
+        break;
+      }
+      done += bytes;
+    }
+    data.resize(done);
+    return data;
+  }
+
+ private:
+  struct stat fileStatus() {
+    struct stat st;
+    if (::fstat(fd_, &st) != 0) {
+      throw std::runtime_error("Failed to stat " + path_);
+    }
+    return st;
+  }
+
+  std::string path_;
+  int fd_;
+};
+
+class S3RangeSource final : public IRangeSource {
+ public:
+  explicit S3RangeSource(const std::string& uri)
+      : uri_(uri), ref_(fbpcf::aws::uriToObjectReference(uri)) {
+    fbpcf::aws::S3ClientOption option;
+    option.region = ref_.region;
+    if (auto endpoint = std::getenv("AWS_ENDPOINT_OVERRIDE")) {
+      option.endpointOverride = endpoint;
+    }
+    // the sdk client is thread safe, all the fetch threads share it
+    client_ = fbpcf::aws::createS3Client(option);
+  }
+
+  uint64_t size() override {
+    Aws::S3::Model::HeadObjectRequest request;
+    request.SetBucket(ref_.bucket);
+    request.SetKey(ref_.key);
+    auto outcome = client_->HeadObject(request);
+    if (!outcome.IsSuccess()) {
+      throw std::runtime_error(
+          "Failed to get the size of " + uri_ + ": " +
+          outcome.GetError().GetMessage());
+    }
+    return outcome.GetResult().GetContentLength();
+  }
+
+  // the ETag, s3 gives every upload of an object a new one
+  std::string fingerprint() override {
+    Aws::S3::Model::HeadObjectRequest request;
+    request.SetBucket(ref_.bucket);
+    request.SetKey(ref_.key);
+    auto outcome = client_->HeadObject(request);
+    if (!outcome.IsSuccess()) {
+      throw std::runtime_error(
+          "Failed to get the ETag of " + uri_ + ": " +
+          outcome.GetError().GetMessage());
+    }
+    return outcome.GetResult().GetETag();
+  }
+
+  std::string read(uint64_t offset, uint64_t length) override {
+    Aws::S3::Model::GetObjectRequest request;
+    request.SetBucket(ref_.bucket);
+    request.SetKey(ref_.key);
+    request.SetRange(
+        "bytes=" + std::to_string(offset) + "-" +
+        std::to_string(offset + length - 1));
+    auto outcome = client_->GetObject(request);
+    if (!outcome.IsSuccess()) {
+      throw std::runtime_error(
+          "Failed to read " + uri_ + ": " + outcome.GetError().GetMessage());
+    }
+
+    std::string data(length, '\0');
+    auto& body = outcome.GetResult().GetBody();
+    body.read(data.data(), length);
+    data.resize(body.gcount());
+    // only the end of the object may cut a range short, anything else is a
+    // dropped connection and would silently lose rows
+    if (data.size() < length &&
+        offset + data.size() < std::min(offset + length, size())) {
+      throw std::runtime_error(
+          "Short read of " + uri_ + " at offset " + std::to_string(offset) +
+          ": got " + std::to_string(data.size()) + " of " +
+          std::to_string(length) + " bytes");
+    }
+    return data;
+  }
+
+ private:
+  std::string uri_;
+  fbpcf::aws::S3ObjectReference ref_;
+  std::unique_ptr<Aws::S3::S3Client> client_;
+};
+
+class ReadaheadReader final : public fbpcf::io::IReaderCloser {
+ public:
+  ReadaheadReader(
+      std::unique_ptr<IRangeSource> source,
+      const ReadaheadOptions& options)
+      : source_(std::move(source)),
+        chunkSize_(options.chunkSize),
+        depth_(options.depth > 0 ? options.depth : 2 * options.connections) {
+    auto size = source_->size();
+    numChunks_ = (size + chunkSize_ - 1) / chunkSize_;
+    for (int i = 0; i < std::max(1, options.connections); ++i) {
+      fetchers_.emplace_back([this]() { fetch(); });
+    }
+  }
+
+  ~ReadaheadReader() override {
+    close();
+  }
+
+  size_t read(std::vector<char>& buf) override {
+    size_t done = 0;
+    while (done < buf.size() && !eof()) {
+      if (cursor_ == current_.size()) {
+        nextChunk();
+        continue;
+      }
+      auto count = std::min(buf.size() - done, current_.size() - cursor_);
+      std::memcpy(buf.data() + done, current_.data() + cursor_, count);
+      cursor_ += count;
+      done += count;
+    }
+    return done;
+  }
+
+  bool eof() override {
+    return cursor_ == current_.size() && consumed_ == numChunks_;
+  }
+
+  int close() override {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      closed_ = true;
+    }
+    changed_.notify_all();
+    for (auto& fetcher : fetchers_) {
+      if (fetcher.joinable()) {
+        fetcher.join();
+      }
+    }
+    return 0;
+  }
+
+ private:
+  // Takes the next chunk in order, waiting for its fetch if needed
+  void nextChunk() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    changed_.wait(lock, [this]() {
+      return error_ || chunks_.count(consumed_) > 0;
+    });
+    if (error_) {
+      std::rethrow_exception(error_);
+    }
+    current_ = std::move(chunks_.at(consumed_));
+    chunks_.erase(consumed_);
+    cursor_ = 0;
+    ++consumed_;
+    lock.unlock();
+    // a slot in the readahead window is free again
+    changed_.notify_all();
+  }
+
+  void fetch() {
+    releaseHelperThread();
+    while (true) {
+      uint64_t chunk;
+      {
+        std::unique_lock<std::mutex> lock(mutex_);
+        changed_.wait(lock, [this]() {
+          return closed_ || error_ || nextFetch_ >= numChunks_ ||
+              nextFetch_ < consumed_ + depth_;
+        });
+        if (closed_ || error_ || nextFetch_ >= numChunks_) {
+          return;
+        }
+        chunk = nextFetch_++;
+      }
+
+      try {
+        auto data = source_->read(chunk * chunkSize_, chunkSize_);
+        std::lock_guard<std::mutex> lock(mutex_);
+        chunks_[chunk] = std::move(data);
+      } catch (const std::exception&) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        error_ = std::current_exception();
+      }
+      changed_.notify_all();
+    }
+  }
+
+  std::unique_ptr<IRangeSource> source_;
+  uint64_t chunkSize_;
+  uint64_t depth_;
+  uint64_t numChunks_ = 0;
+
+  std::mutex mutex_;
+  std::condition_variable changed_;
+  std::map<uint64_t, std::string> chunks_;
+  uint64_t nextFetch_ = 0;
+  uint64_t consumed_ = 0;
+  bool closed_ = false;
+  std::exception_ptr error_;
+  std::vector<std::thread> fetchers_;
+
+  // chunk the parser is reading, only touched by the parser thread
+  std::string current_;
+  size_t cursor_ = 0;
+};
+
+// Same uris FileReader takes, e.g. https://bucket.s3.region.amazonaws.com/key
+inline bool isS3Path(const std::string& path) {
+  return path.rfind("https://", 0) == 0 && path.find(".s3.") != std::string::npos;
+}
+
+// Fingerprint of a local or s3 input, see IRangeSource::fingerprint. Empty
+// for other paths, they can't be told apart without reading them.
+inline std::string getInputFingerprint(const std::string& path) {
+  if (isS3Path(path)) {
+    return S3RangeSource(path).fingerprint();
+  }
+  if (path.find("://") == std::string::npos) {
+    return LocalRangeSource(path).fingerprint();
+  }
+  return "";
+}
+
+// A ReadaheadReader for s3 and local paths if readahead is enabled, other
+// paths (e.g. gcs) are read with a FileReader
+inline std::unique_ptr<fbpcf::io::IReaderCloser> openInputReader(
+    const std::string& path,
+    const ReadaheadOptions& options) {
+  if (options.enabled()) {
+    if (isS3Path(path)) {
+      return std::make_unique<ReadaheadReader>(
+          std::make_unique<S3RangeSource>(path), options);
+    }
+    if (path.find("://") == std::string::npos) {
+      return std::make_unique<ReadaheadReader>(
+          std::make_unique<LocalRangeSource>(path), options);
+    }
+  }
+  return std::make_unique<fbpcf::io::FileReader>(path);
+}
+
+} // namespace fbpcf::demographic_metrics
@@ -0,0 +1,146 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+namespace fbpcf::demographic_metrics {
+
+/**
+ * Approximate mode: the metrics of a shard are calculated on a Bernoulli
+ * sample of its rows and reported as estimates with confidence intervals.
+ *
+ * Row i is kept if a hash of (seed, i) falls below the sample rate, so both
+ * parties pick the same rows from the shared seed without communicating,
+ * and do so before any column is secret-input. The rows have to be aligned
+ * (by the input or a private join) for this, like for every metric.
+ *
+ * Intervals are normal approximations: counts are scaled by 1 / rate with a
+ * binomial error, means use the sample variance with the finite population
+ * correction (1 - rate), the variance assumes roughly normal values, the
+ * correlation uses the Fisher transform and quantiles the order statistics
+ * at the ranks n * q -/+ z * sqrt(n * q * (1 - q)).
+ */
+struct ConfidenceInterval {
+  double low;
+  double high;
+
+  std::vector<double> toVector() const {
+    return {low, high};
+  }
+};
+
+// splitmix64, a good enough mix of the seed and the row index
+inline uint64_t mixSampleHash(uint64_t value) {
+  value += 0x9e3779b97f4a7c15ULL;
+  value = (value ^ (value >> 30)) * 0xbf58476d1ce4e5b9ULL;
+  value = (value ^ (value >> 27)) * 0x94d049bb133111ebULL;
+  return value ^ (value >> 31);
+}
+
+// Indices of the sampled rows among numRows, the same on both parties
+inline std::vector<size_t>
+sampleRows(size_t numRows, double sampleRate, uint64_t seed) {
+  // rate * 2^64, compared against the hash of every row
+  auto threshold = sampleRate >= 1
+      ? UINT64_MAX
+      : static_cast<uint64_t>(std::ldexp(sampleRate, 64));
+  std::vector<size_t> rows;
+  rows.reserve(numRows * std::min(1.0, sampleRate * 1.1) + 16);
+  auto seedHash = mixSampleHash(seed);
+  for (size_t row = 0; row < numRows; ++row) {
+    if (mixSampleHash(seedHash ^ row) <= threshold) {
+      rows.push_back(row);
+    }
+  }
+  return rows;
+}
+
+// Two-sided z value of a confidence level, e.g. 1.96 for 0.95
+inline double getZScore(double confidence) {
+  // solves erfc(z / sqrt(2)) = 1 - confidence by bisection
+  double low = 0;
+  double high = 40;
+  for (int i = 0; i < 100; ++i) {
+    auto mid = (low + high) / 2;
+    if (std::erfc(mid / std::sqrt(2.0)) > 1 - confidence) {
+      low = mid;
+    } else {
+      high = mid;
+    }
+  }
+  return (low + high) / 2;
+}
+
+// Estimate of a count in the full data from the count in the sample
+inline double scaleCount(double sampleCount, double sampleRate) {
+  return sampleCount / sampleRate;
+}
+
+inline ConfidenceInterval
+countInterval(double sampleCount, double sampleRate, double z) {
+  auto estimate = scaleCount(sampleCount, sampleRate);
+  auto error = z * std::sqrt(sampleCount * (1 - sampleRate)) / sampleRate;
+  return {std::max(0.0, estimate - error), estimate + error};
+}
+
+// Estimates and intervals of counts, e.g. histogram bins
+template <typename T>
+std::pair<std::vector<double>, std::vector<ConfidenceInterval>>
+scaleCounts(const std::vector<T>& sampleCounts, double sampleRate, double z) {
+  std::vector<double> estimates;
+  std::vector<ConfidenceInterval> intervals;
+  for (auto count : sampleCounts) {
+    estimates.push_back(scaleCount(count, sampleRate));
+    intervals.push_back(countInterval(count, sampleRate, z));
+  }
+  return {estimates, intervals};
+}
+
+inline ConfidenceInterval meanInterval(
+    double mean,
+    double variance,
+    double sampleCount,
+    double sampleRate,
+    double z) {
+  // no spread to estimate without rows, like the mean itself (0)
+  if (sampleCount < 1) {
+    return {mean, mean};
+  }
+  auto error =
+      z * std::sqrt(std::max(0.0, variance) / sampleCount * (1 - sampleRate));
+  return {mean - error, mean + error};
+}
+
+inline ConfidenceInterval
+varianceInterval(double variance, double sampleCount, double sampleRate, double z) {
+  // the variance is reported as 0 with fewer than two rows, and so is its
+  // interval instead of an inf
+  if (sampleCount < 2) {
+    return {variance, variance};
+  }
+  auto error = z * variance * std::sqrt(2 / (sampleCount - 1) * (1 - sampleRate));
+  return {std::max(0.0, variance - error), variance + error};
+}
+
+inline ConfidenceInterval
+correlationInterval(double correlation, double sampleCount, double z) {
+  auto fisher = std::atanh(std::clamp(correlation, -0.999999, 0.999999));
+  auto error = z / std::sqrt(std::max(1.0, sampleCount - 3));
+  return {std::tanh(fisher - error), std::tanh(fisher + error)};
+}
+
+// Quantiles of the sample whose values bound the interval of quantile q
+inline std::pair<double, double>
+quantileBounds(double quantile, double sampleCount, double z) {
+  // an empty sample says nothing about the quantile
+  if (sampleCount < 1) {
+    return {0.0, 1.0};
+  }
+  auto error = z * std::sqrt(quantile * (1 - quantile) / sampleCount);
+  return {std::max(0.0, quantile - error), std::min(1.0, quantile + error)};
+}
+
+} // namespace fbpcf::demographic_metrics
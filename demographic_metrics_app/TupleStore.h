@@ -0,0 +1,444 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <map>
+#include <memory>
+#include <optional>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "folly/logging/xlog.h"
+
+#include "fbpcf/engine/SecretShareEngineFactory.h"
+#include "fbpcf/engine/communication/IPartyCommunicationAgent.h"
+#include "fbpcf/engine/communication/IPartyCommunicationAgentFactory.h"
+#include "fbpcf/engine/tuple_generator/ITupleGenerator.h"
+#include "fbpcf/engine/tuple_generator/ITupleGeneratorFactory.h"
+#include "fbpcf/engine/tuple_generator/TupleGeneratorFactory.h"
+#include "fbpcf/engine/util/AesPrgFactory.h"
+#include "fbpcf/scheduler/LazySchedulerFactory.h"
+#include "fbpcf/util/MetricCollector.h"
+
+namespace fbpcf::demographic_metrics {
+
+/**
+ * Offline/online split for the boolean AND tuples (Beaver triples).
+ *
+ * In the offline phase both parties run the OT based tuple generator for an
+ * expected gate budget and store their tuple shares on local disk (one file
+ * per party and game thread). In the online phase the engine is built with a
+ * PrecomputedTupleGenerator that serves tuples from that file, so no OT
+ * extension runs on the critical path. Both parties evaluate the same
+ * circuit, so they consume the stored tuples in the same order. If the
+ * budget was too small the generator falls back to live generation for the
+ * rest of the job.
+ *
+ * A tuple must never be used twice, reusing a Beaver triple leaks the
+ * difference of the masked inputs. The header keeps the number of tuples
+ * already handed out; it is advanced on disk before the tuples are used, so
+ * a crash or a later run skips them, and the file is removed once it is used
+ * up. Before the engine is built the parties compare the id of their stores
+ * (drawn by Alice in the offline phase) and the consumed counts, and only
+ * use the stores if they match, see tupleStoresMatch.
+ *
+ * File layout: the header, then groups of 8 tuples stored as three bytes
+ * holding the a, b and c bits of the group.
+ */
+using BooleanTuple =
+    fbpcf::engine::tuple_generator::ITupleGenerator::BooleanTuple;
+using CompositeBooleanTuple =
+    fbpcf::engine::tuple_generator::ITupleGenerator::CompositeBooleanTuple;
+
+const uint32_t kTupleStoreMagic = 0x5450434d; // "MCPT"
+const uint32_t kTupleStoreVersion = 2;
+const uint32_t kTupleStoreChunkSize = 1 << 20;
+
+struct TupleStoreHeader {
+  uint32_t magic = kTupleStoreMagic;
+  uint32_t version = kTupleStoreVersion;
+  // the same in the stores of both parties
+  uint64_t storeId = 0;
+  // a multiple of 8
+  uint64_t numTuples = 0;
+  // tuples handed out by earlier runs, never served again
+  uint64_t consumed = 0;
+
+  bool valid() const {
+    return magic == kTupleStoreMagic && version == kTupleStoreVersion &&
+        consumed <= numTuples && numTuples % 8 == 0 && consumed % 8 == 0;
+  }
+
+  uint64_t remaining() const {
+    return numTuples - consumed;
+  }
+};
+const std::streamoff kTupleStoreHeaderSize = sizeof(TupleStoreHeader);
+
+inline std::string getTupleStorePath(
+    const std::string& tupleDirectory,
+    int party,
+    int threadIndex) {
+  return tupleDirectory + "/tuples_party" + std::to_string(party) +
+      "_thread" + std::to_string(threadIndex) + ".bin";
+}
+
+// The OT based generator getLazySchedulerFactoryWithRealEngine uses
+inline std::unique_ptr<fbpcf::engine::tuple_generator::ITupleGeneratorFactory>
+getRealTupleGeneratorFactory(
+    int party,
+    fbpcf::engine::communication::IPartyCommunicationAgentFactory&
+        communicationAgentFactory,
+    std::shared_ptr<fbpcf::util::MetricCollector> metricCollector) {
+  return fbpcf::engine::tuple_generator::createTupleGeneratorFactoryWithRealOt(
+      2, party, communicationAgentFactory, metricCollector);
+}
+
+// Header of the store at path, or nullopt if there is no valid store
+inline std::optional<TupleStoreHeader> readTupleStoreHeader(
+    const std::string& path) {
+  std::ifstream in(path, std::ios::binary);
+  TupleStoreHeader header;
+  in.read(reinterpret_cast<char*>(&header), kTupleStoreHeaderSize);
+  if (!in || !header.valid()) {
+    return std::nullopt;
+  }
+  return header;
+}
+
+// Describes the unused part of the store at path, empty if there is none
+inline std::string describeTupleStore(const std::string& path) {
+  if (path.empty() || !std::filesystem::exists(path)) {
+    return "";
+  }
+  auto header = readTupleStoreHeader(path);
+  if (!header) {
+    XLOG(WARNING) << "Ignoring invalid tuple store " << path;
+    return "";
+  }
+  if (header->remaining() == 0) {
+    return "";
+  }
+  return std::to_string(header->storeId) + ":" +
+      std::to_string(header->consumed) + ":" +
+      std::to_string(header->numTuples);
+}
+
+// Exchanges a string with the other party in the clear, party 0 sends first
+inline std::string exchangeWithPeer(
+    fbpcf::engine::communication::IPartyCommunicationAgent& agent,
+    int party,
+    const std::string& mine) {
+  auto send = [&]() {
+    uint64_t size = mine.size();
+    std::vector<unsigned char> message(sizeof(size) + mine.size());
+    std::memcpy(message.data(), &size, sizeof(size));
+    std::memcpy(message.data() + sizeof(size), mine.data(), mine.size());
+    agent.send(message);
+  };
+  auto receive = [&]() {
+    auto header = agent.receive(sizeof(uint64_t));
+    uint64_t size;
+    std::memcpy(&size, header.data(), sizeof(size));
+    if (size == 0) {
+      return std::string();
+    }
+    auto message = agent.receive(size);
+    return std::string(message.begin(), message.end());
+  };
+
+  if (party == 0) {
+    send();
+    return receive();
+  }
+  auto theirs = receive();
+  send();
+  return theirs;
+}
+
+// True if both parties have an unused part of the same store at the same
+// offset, otherwise neither party may use its store. Both parties have to
+// call it before building their engines, whether they have a store or not.
+inline bool tupleStoresMatch(
+    fbpcf::engine::communication::IPartyCommunicationAgent& agent,
+    int party,
+    const std::string& tupleStorePath) {
+  auto mine = describeTupleStore(tupleStorePath);
+  auto theirs = exchangeWithPeer(agent, party, mine);
+  if (mine.empty() && theirs.empty()) {
+    return false;
+  }
+  if (mine != theirs) {
+    XLOGF(
+        WARNING,
+        "Tuple stores don't match (mine '{}', other party's '{}'), generating tuples online",
+        mine,
+        theirs);
+    return false;
+  }
+  return true;
+}
+
+class TupleStoreWriter {
+ public:
+  // The store only appears at path once it is closed, an interrupted offline
+  // phase leaves no partial store behind
+  TupleStoreWriter(const std::string& path, uint64_t storeId, uint64_t numTuples)
+      : path_(path), out_(path + ".tmp", std::ios::binary | std::ios::trunc) {
+    if (!out_) {
+      throw std::runtime_error("Failed to open tuple store " + path);
+    }
+    TupleStoreHeader header;
+    header.storeId = storeId;
+    header.numTuples = numTuples;
+    out_.write(reinterpret_cast<const char*>(&header), kTupleStoreHeaderSize);
+  }
+
+  // size must be a multiple of 8, the file has no room for partial groups
+  void write(const std::vector<BooleanTuple>& tuples) {
+    std::vector<char> packed;
+    packed.reserve((tuples.size() + 7) / 8 * 3);
+    for (size_t group = 0; group < tuples.size(); group += 8) {
+      uint8_t a = 0, b = 0, c = 0;
+      for (size_t j = 0; j < 8 && group + j < tuples.size(); ++j) {
+        a |= tuples[group + j].getA() << j;
+        b |= tuples[group + j].getB() << j;
+        c |= tuples[group + j].getC() << j;
+      }
+      packed.push_back(a);
+      packed.push_back(b);
+      packed.push_back(c);
+    }
+    out_.write(packed.data(), packed.size());
+  }
+
+  void close() {
+    out_.close();
+    if (!out_) {
+      throw std::runtime_error("Failed to write tuple store " + path_);
+    }
+    std::filesystem::rename(path_ + ".tmp", path_);
+  }
+
+ private:
+  std::string path_;
+  std::ofstream out_;
+};
+
+class PrecomputedTupleGenerator final
+    : public fbpcf::engine::tuple_generator::ITupleGenerator {
+ public:
+  PrecomputedTupleGenerator(
+      const std::string& path,
+      std::unique_ptr<fbpcf::engine::tuple_generator::ITupleGeneratorFactory>
+          fallbackFactory)
+      : path_(path),
+        file_(path, std::ios::binary | std::ios::in | std::ios::out),
+        fallbackFactory_(std::move(fallbackFactory)) {
+    file_.read(reinterpret_cast<char*>(&header_), kTupleStoreHeaderSize);
+    if (!file_ || !header_.valid()) {
+      throw std::runtime_error("Invalid tuple store " + path);
+    }
+    file_.seekg(kTupleStoreHeaderSize + header_.consumed / 8 * 3);
+  }
+
+  std::vector<BooleanTuple> getBooleanTuple(uint32_t size) override {
+    std::vector<BooleanTuple> tuples;
+    tuples.reserve(size);
+    while (tuples.size() < size) {
+      if (cursor_ == buffered_.size() && !refill()) {
+        break;
+      }
+      auto count = std::min<size_t>(size - tuples.size(), buffered_.size() - cursor_);
+      tuples.insert(
+          tuples.end(),
+          buffered_.begin() + cursor_,
+          buffered_.begin() + cursor_ + count);
+      cursor_ += count;
+    }
+    precomputedUsed_ += tuples.size();
+
+    if (tuples.size() < size) {
+      auto remaining = getFallback().getBooleanTuple(size - tuples.size());
+      tuples.insert(tuples.end(), remaining.begin(), remaining.end());
+    }
+    return tuples;
+  }
+
+  // Composite tuples share their "a" bit between many ANDs, they are sized by
+  // the circuit shape rather than the gate count, so they are not stored
+  std::map<size_t, std::vector<CompositeBooleanTuple>> getCompositeTuple(
+      const std::map<size_t, uint32_t>& tupleSizes) override {
+    return getFallback().getCompositeTuple(tupleSizes);
+  }
+
+  std::pair<
+      std::vector<BooleanTuple>,
+      std::map<size_t, std::vector<CompositeBooleanTuple>>>
+  getNormalAndCompositeBooleanTuples(
+      uint32_t tupleSize,
+      const std::map<size_t, uint32_t>& tupleSizes) override {
+    auto composite = tupleSizes.empty()
+        ? std::map<size_t, std::vector<CompositeBooleanTuple>>()
+        : getCompositeTuple(tupleSizes);
+    return {getBooleanTuple(tupleSize), std::move(composite)};
+  }
+
+  std::pair<uint64_t, uint64_t> getTrafficStatistics() const override {
+    return fallback_ ? fallback_->getTrafficStatistics()
+                     : std::pair<uint64_t, uint64_t>(0, 0);
+  }
+
+  uint64_t getPrecomputedTuplesUsed() const {
+    return precomputedUsed_;
+  }
+
+ private:
+  // Reads the next chunk of the store, after marking it as consumed on disk
+  bool refill() {
+    buffered_.clear();
+    cursor_ = 0;
+    auto count = std::min<uint64_t>(kTupleStoreChunkSize, header_.remaining());
+    if (count == 0) {
+      return false;
+    }
+    header_.consumed += count;
+    file_.seekp(0);
+    file_.write(reinterpret_cast<const char*>(&header_), kTupleStoreHeaderSize);
+    file_.flush();
+    if (!file_) {
+      throw std::runtime_error("Failed to update tuple store " + path_);
+    }
+
+    std::vector<char> packed(count / 8 * 3);
+    file_.seekg(kTupleStoreHeaderSize + (header_.consumed - count) / 8 * 3);
+    file_.read(packed.data(), packed.size());
+    auto bytesRead = file_.gcount() - file_.gcount() % 3;
+    if (header_.remaining() == 0) {
+      // the open stream still reads the last chunk
+      std::filesystem::remove(path_);
+    }
+    for (std::streamsize i = 0; i < bytesRead; i += 3) {
+      for (int j = 0; j < 8; ++j) {
+        buffered_.emplace_back(
+            (packed[i] >> j) & 1, (packed[i + 1] >> j) & 1, (packed[i + 2] >> j) & 1);
+      }
+    }
+    return !buffered_.empty();
+  }
+
+  fbpcf::engine::tuple_generator::ITupleGenerator& getFallback() {
+    if (!fallback_) {
+      XLOG(WARNING) << "Starting online tuple generation after "
+                    << precomputedUsed_ << " precomputed tuples";
+      fallback_ = fallbackFactory_->create();
+    }
+    return *fallback_;
+  }
+
+  std::string path_;
+  std::fstream file_;
+  TupleStoreHeader header_;
+  std::unique_ptr<fbpcf::engine::tuple_generator::ITupleGeneratorFactory>
+      fallbackFactory_;
+  std::unique_ptr<fbpcf::engine::tuple_generator::ITupleGenerator> fallback_;
+  std::vector<BooleanTuple> buffered_;
+  size_t cursor_ = 0;
+  uint64_t precomputedUsed_ = 0;
+};
+
+class PrecomputedTupleGeneratorFactory final
+    : public fbpcf::engine::tuple_generator::ITupleGeneratorFactory {
+ public:
+  PrecomputedTupleGeneratorFactory(
+      std::string path,
+      std::unique_ptr<fbpcf::engine::tuple_generator::ITupleGeneratorFactory>
+          fallbackFactory)
+      : path_(std::move(path)), fallbackFactory_(std::move(fallbackFactory)) {}
+
+  std::unique_ptr<fbpcf::engine::tuple_generator::ITupleGenerator> create()
+      override {
+    CHECK(fallbackFactory_) << "Tuple store " << path_ << " opened twice";
+    return std::make_unique<PrecomputedTupleGenerator>(
+        path_, std::move(fallbackFactory_));
+  }
+
+ private:
+  std::string path_;
+  std::unique_ptr<fbpcf::engine::tuple_generator::ITupleGeneratorFactory>
+      fallbackFactory_;
+};
+
+// Same as fbpcf::scheduler::getLazySchedulerFactoryWithRealEngine, but the
+// engine takes its AND tuples from the given tuple store first.
+inline std::unique_ptr<fbpcf::scheduler::ISchedulerFactory<false>>
+getLazySchedulerFactoryWithPrecomputedTuples(
+    int party,
+    fbpcf::engine::communication::IPartyCommunicationAgentFactory&
+        communicationAgentFactory,
+    std::shared_ptr<fbpcf::util::MetricCollector> metricCollector,
+    const std::string& tupleStorePath) {
+  auto tupleGeneratorFactory = std::make_unique<PrecomputedTupleGeneratorFactory>(
+      tupleStorePath,
+      getRealTupleGeneratorFactory(
+          party, communicationAgentFactory, metricCollector));
+  auto engineFactory =
+      std::make_unique<fbpcf::engine::SecretShareEngineFactory<false>>(
+          party,
+          2,
+          communicationAgentFactory,
+          std::move(tupleGeneratorFactory),
+          std::make_unique<fbpcf::engine::util::AesPrgFactory>());
+  return std::make_unique<fbpcf::scheduler::LazySchedulerFactory<false>>(
+      std::move(engineFactory), metricCollector);
+}
+
+// Offline phase: runs the OT based generator with the other party and stores
+// numTuples tuple shares at tupleStorePath.
+inline void precomputeTuples(
+    int party,
+    fbpcf::engine::communication::IPartyCommunicationAgentFactory&
+        communicationAgentFactory,
+    std::shared_ptr<fbpcf::util::MetricCollector> metricCollector,
+    const std::string& tupleStorePath,
+    uint64_t numTuples) {
+  // a fresh id drawn by Alice, so the online phase can tell the stores of
+  // this run apart from older ones
+  uint64_t storeId = 0;
+  if (party == 0) {
+    std::random_device random;
+    storeId = (uint64_t(random()) << 32) | random();
+  }
+  auto agent = communicationAgentFactory.create(1 - party, "tuple_store");
+  auto theirStoreId =
+      exchangeWithPeer(*agent, party, party == 0 ? std::to_string(storeId) : "");
+  if (party == 1) {
+    storeId = std::stoull(theirStoreId);
+  }
+
+  auto generator = getRealTupleGeneratorFactory(
+                       party, communicationAgentFactory, metricCollector)
+                       ->create();
+  numTuples = (numTuples + 7) / 8 * 8;
+  TupleStoreWriter writer(tupleStorePath, storeId, numTuples);
+
+  for (uint64_t done = 0; done < numTuples; done += kTupleStoreChunkSize) {
+    auto chunk = std::min<uint64_t>(kTupleStoreChunkSize, numTuples - done);
+    writer.write(generator->getBooleanTuple(chunk));
+  }
+  writer.close();
+
+  auto traffic = generator->getTrafficStatistics();
+  XLOGF(
+      INFO,
+      "Stored {} tuples at {}, sent {} bytes, received {} bytes",
+      numTuples,
+      tupleStorePath,
+      traffic.first,
+      traffic.second);
+}
+
+} // namespace fbpcf::demographic_metrics
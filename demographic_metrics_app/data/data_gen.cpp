@@ -0,0 +1,214 @@
+/*
+ * Native replacement for data_gen.py: writes secret shared demographic
+ * data for both parties. Every row is split into a random share for Alice
+ * (<prefix>.csv) and the matching share for Bob (<prefix>Helper.csv), such
+ * that aliceShare + bobShare = value mod 2^32.
+ *
+ * Rows are generated in blocks on --threads threads. Every block has its
+ * own PRG seeded from (--seed, shard, block), so the output only depends on
+ * the flags and not on the number of threads.
+ */
+
+#include <gflags/gflags.h>
+#include <algorithm>
+#include <charconv>
+#include <cmath>
+#include <cstdint>
+#include <fstream>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "folly/init/Init.h"
+#include "folly/logging/xlog.h"
+
+DEFINE_string(
+    output_prefix,
+    "data",
+    "Alice's shares are written to <prefix>.csv and Bob's to <prefix>Helper.csv, with a _<shard> suffix if there is more than one shard");
+DEFINE_int64(rows, 1000, "Number of rows in every shard");
+DEFINE_int32(num_shards, 1, "Number of shards to write for each party");
+DEFINE_int32(
+    threads,
+    0,
+    "Number of generator threads, 0 uses all hardware threads");
+DEFINE_uint64(seed, 0, "Seed of the generator, 0 picks a random seed");
+DEFINE_double(
+    invalid_rate,
+    0.05,
+    "Fraction of rows with an out of range age (between 2^16 and 2^32)");
+DEFINE_string(
+    age_distribution,
+    "normal",
+    "Distribution of valid ages: normal (--age_mean, --age_stddev) or uniform (0 to --age_max)");
+DEFINE_double(age_mean, 50, "Mean of the normal age distribution");
+DEFINE_double(age_stddev, 15, "Standard deviation of the normal age distribution");
+DEFINE_int32(age_max, 100, "Upper bound of the uniform age distribution");
+DEFINE_string(
+    wealth_distribution,
+    "uniform",
+    "Distribution of wealth: uniform (0 to --wealth_max) or lognormal (--wealth_log_mean, --wealth_log_stddev, capped at --wealth_max)");
+DEFINE_int64(wealth_max, 250000, "Upper bound of the wealth");
+DEFINE_double(wealth_log_mean, 10, "Mean of log(wealth) for the lognormal distribution");
+DEFINE_double(wealth_log_stddev, 1, "Standard deviation of log(wealth) for the lognormal distribution");
+
+namespace {
+
+const int64_t kBlockRows = 1 << 18;
+const char* kHeader = "id_,age,wealth,gender\n";
+
+uint64_t splitMix64(uint64_t x) {
+  x += 0x9e3779b97f4a7c15;
+  x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9;
+  x = (x ^ (x >> 27)) * 0x94d049bb133111eb;
+  return x ^ (x >> 31);
+}
+
+struct Block {
+  std::string alice;
+  std::string bob;
+};
+
+void appendNumber(std::string& out, uint64_t value) {
+  char buffer[20];
+  auto result = std::to_chars(buffer, buffer + sizeof(buffer), value);
+  out.append(buffer, result.ptr);
+}
+
+// Appends the shares of one row to both parties' outputs
+void appendRow(
+    Block& block,
+    uint64_t id,
+    const uint32_t values[3],
+    std::mt19937_64& e) {
+  appendNumber(block.alice, id);
+  appendNumber(block.bob, id);
+  for (int column = 0; column < 3; ++column) {
+    uint32_t mask = e();
+    block.alice.push_back(',');
+    block.bob.push_back(',');
+    appendNumber(block.alice, mask);
+    appendNumber(block.bob, values[column] - mask);
+  }
+  block.alice.push_back('\n');
+  block.bob.push_back('\n');
+}
+
+Block generateBlock(uint64_t seed, int shard, int64_t blockIndex) {
+  std::mt19937_64 e(splitMix64(splitMix64(seed ^ shard) ^ blockIndex));
+  std::bernoulli_distribution invalid(FLAGS_invalid_rate);
+  std::uniform_int_distribution<uint32_t> invalidAge(1u << 16, UINT32_MAX);
+  std::normal_distribution<double> normalAge(FLAGS_age_mean, FLAGS_age_stddev);
+  std::uniform_int_distribution<uint32_t> uniformAge(0, FLAGS_age_max);
+  std::uniform_int_distribution<uint32_t> uniformWealth(0, FLAGS_wealth_max);
+  std::lognormal_distribution<double> lognormalWealth(
+      FLAGS_wealth_log_mean, FLAGS_wealth_log_stddev);
+  std::bernoulli_distribution gender(0.5);
+
+  auto firstRow = blockIndex * kBlockRows;
+  auto numRows = std::min(kBlockRows, FLAGS_rows - firstRow);
+
+  Block block;
+  // ids and shares are at most 10 digits each
+  block.alice.reserve(numRows * 40);
+  block.bob.reserve(numRows * 40);
+
+  for (int64_t i = 0; i < numRows; ++i) {
+    uint32_t values[3];
+    if (invalid(e)) {
+      values[0] = invalidAge(e);
+    } else if (FLAGS_age_distribution == "uniform") {
+      values[0] = uniformAge(e);
+    } else {
+      values[0] = std::max(0L, std::lround(normalAge(e)));
+    }
+    values[1] = FLAGS_wealth_distribution == "lognormal"
+        ? std::min<double>(lognormalWealth(e), FLAGS_wealth_max)
+        : uniformWealth(e);
+    values[2] = gender(e);
+
+    appendRow(block, shard * FLAGS_rows + firstRow + i, values, e);
+  }
+  return block;
+}
+
+void generateShard(uint64_t seed, int shard, int numThreads) {
+  auto suffix =
+      FLAGS_num_shards > 1 ? "_" + std::to_string(shard) : std::string();
+  auto alicePath = FLAGS_output_prefix + ".csv" + suffix;
+  auto bobPath = FLAGS_output_prefix + "Helper.csv" + suffix;
+
+  std::ofstream alice(alicePath, std::ios::binary | std::ios::trunc);
+  std::ofstream bob(bobPath, std::ios::binary | std::ios::trunc);
+  if (!alice || !bob) {
+    XLOG(FATAL) << "Failed to open " << alicePath << " or " << bobPath;
+  }
+  alice << kHeader;
+  bob << kHeader;
+
+  // blocks are generated one wave of numThreads at a time and written in
+  // order, so memory stays bounded for 100M row shards
+  auto numBlocks = (FLAGS_rows + kBlockRows - 1) / kBlockRows;
+  for (int64_t wave = 0; wave < numBlocks; wave += numThreads) {
+    auto waveSize = std::min<int64_t>(numThreads, numBlocks - wave);
+    std::vector<Block> blocks(waveSize);
+    std::vector<std::thread> workers;
+    for (int64_t i = 0; i < waveSize; ++i) {
+      workers.emplace_back([&blocks, i, seed, shard, wave]() {
+        blocks[i] = generateBlock(seed, shard, wave + i);
+      });
+    }
+    for (auto& worker : workers) {
+      worker.join();
+    }
+    for (const auto& block : blocks) {
+      alice.write(block.alice.data(), block.alice.size());
+      bob.write(block.bob.data(), block.bob.size());
+    }
+  }
+  XLOG(INFO) << "Wrote " << FLAGS_rows << " rows to " << alicePath << " and "
+             << bobPath;
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+  folly::init(&argc, &argv);
+  gflags::ParseCommandLineFlags(&argc, &argv, true);
+
+  if (FLAGS_age_distribution != "normal" &&
+      FLAGS_age_distribution != "uniform") {
+    XLOG(FATAL) << "Unknown age distribution: " << FLAGS_age_distribution;
+  }
+  if (FLAGS_wealth_distribution != "uniform" &&
+      FLAGS_wealth_distribution != "lognormal") {
+    XLOG(FATAL) << "Unknown wealth distribution: " << FLAGS_wealth_distribution;
+  }
+  // the distributions are undefined outside these ranges
+  if (!(FLAGS_invalid_rate >= 0 && FLAGS_invalid_rate <= 1)) {
+    XLOG(FATAL) << "--invalid_rate has to be between 0 and 1: "
+                << FLAGS_invalid_rate;
+  }
+  if (FLAGS_wealth_max < 0 || FLAGS_wealth_max > UINT32_MAX) {
+    XLOG(FATAL) << "--wealth_max has to be between 0 and 2^32 - 1: "
+                << FLAGS_wealth_max;
+  }
+  if (FLAGS_age_max < 0) {
+    XLOG(FATAL) << "--age_max can't be negative: " << FLAGS_age_max;
+  }
+
+  auto seed = FLAGS_seed != 0 ? FLAGS_seed : std::random_device()();
+  int numThreads = FLAGS_threads > 0
+      ? FLAGS_threads
+      : std::max(1u, std::thread::hardware_concurrency());
+
+  XLOG(INFO) << "Generating " << FLAGS_num_shards << " shards of "
+             << FLAGS_rows << " rows with seed " << seed << " on "
+             << numThreads << " threads";
+
+  for (int shard = 0; shard < FLAGS_num_shards; ++shard) {
+    generateShard(seed, shard, numThreads);
+  }
+  return 0;
+}
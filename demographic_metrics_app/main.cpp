@@ -84,6 +84,114 @@ DEFINE_bool(
     histogram,
     false,
     "Run count computation on the inputs");
+DEFINE_bool(
+    min_max,
+    false,
+    "Run min and max computation of age and wealth on the inputs");
+DEFINE_bool(
+    covariance,
+    false,
+    "Run wealth average and variance, and age/wealth covariance and correlation computation on the inputs");
+DEFINE_string(
+    percentiles,
+    "",
+    "Comma separated quantiles of age and wealth to compute on the inputs, e.g. 0.5,0.9 for the median and p90");
+DEFINE_string(
+    group_by,
+    "",
+    "Categorical input column and its number of categories, e.g. region:16, to compute the count, sum and average of --group_value for every category 0..15. Rows with other values are in no category");
+DEFINE_string(
+    group_value,
+    "age",
+    "Column summed and averaged per category with --group_by, age or wealth");
+DEFINE_bool(
+    join_on_id,
+    false,
+    "Align the rows of the two parties by their id_ column with a private join (PSI), instead of requiring row i of both inputs to have the same id. Reveals to each party which of its rows the other party has. Both parties have to put the same ids in the same shard");
+DEFINE_double(
+    sample_rate,
+    1,
+    "Approximate mode: calculate the metrics on this share of the rows of every input file, e.g. 0.01, and report estimates with confidence intervals. Min and max are those of the sample. 1 uses all the rows");
+DEFINE_int64(
+    sample_seed,
+    0,
+    "Seed the rows are sampled with, both parties have to use the same");
+DEFINE_double(
+    confidence,
+    0.95,
+    "Confidence level of the intervals reported with --sample_rate");
+DEFINE_string(
+    checkpoint_directory,
+    "",
+    "Local directory of the manifest of completed shards. A restarted job skips the shards both parties completed with the same metrics and unchanged outputs. Not used with --summary_output_path, see --state_directory");
+DEFINE_int32(
+    readahead_chunk_mb,
+    0,
+    "Stream s3 and local inputs in chunks of this many MB, fetched in parallel ahead of the parser. 0 reads the inputs with a plain FileReader");
+DEFINE_int32(
+    readahead_connections,
+    4,
+    "Number of chunks of an input fetched in parallel with --readahead_chunk_mb");
+DEFINE_bool(
+    prefetch_next_shard,
+    false,
+    "Read the next shard of every game thread while the current one is calculated");
+DEFINE_bool(
+    pin_threads,
+    false,
+    "Pin every game thread to its own core, filling one NUMA node before the next, and allocate its data on that node");
+DEFINE_string(
+    validation_spec,
+    "age=..199",
+    "Comma separated rules for the rows the validation keeps, e.g. age=..199,wealth=0..10000000,gender=0|1");
+DEFINE_bool(
+    oblivious_validation,
+    false,
+    "Keep the validity of every row secret instead of revealing it and removing the invalid rows. Not supported with --min_max, --covariance and --percentiles");
+DEFINE_string(
+    trace_output_path,
+    "",
+    "Local or s3 path of a Chrome trace-event json with shard, metric and reveal timings, with Bob's clock lined up to Alice's. Tracing is disabled if empty. Each party may trace on its own.");
+DEFINE_string(
+    tuple_directory,
+    "",
+    "Local directory with AND tuples stored by the offline phase. Each game thread consumes its own file, every tuple is used once and a file is removed when it is used up, then tuples are generated online. The stores are only used if both parties' match.");
+DEFINE_int64(
+    precompute_tuples,
+    0,
+    "If positive, run only the offline phase: store this many AND tuples per game thread in --tuple_directory and exit. Use the same --concurrency for the online run.");
+DEFINE_string(
+    daemon_spool_directory,
+    "",
+    "If set, run as a long-lived daemon that keeps its connection and engine alive and runs the .job files dropped into this directory until a shutdown job arrives. Input and output flags are ignored.");
+DEFINE_int32(
+    daemon_poll_interval_ms,
+    1000,
+    "How often the daemon checks its spool directory for new jobs");
+DEFINE_string(
+    summary_output_path,
+    "",
+    "If set, the aggregates (valid count, average, variance, histogram) of all the input files are revealed once and written here, instead of the metrics of every file to the output files. Each game thread only calculates secret shares of the aggregates of its files.");
+DEFINE_string(
+    state_directory,
+    "",
+    "With --summary_output_path, store this party's shares of the aggregates of every input file here. Files that already have a state from an earlier run are not recalculated, so a run over appended data only processes the new files.");
+DEFINE_bool(
+    estimate,
+    false,
+    "Don't calculate the metrics, only estimate the gates, traffic and time of the job by running the metrics on one sample shard with the network plaintext scheduler. The other party has to run the estimate too.");
+DEFINE_int64(
+    estimate_rows,
+    0,
+    "With --estimate, use this many rows of zeros per input file as the sample instead of the first input file");
+DEFINE_double(
+    estimate_bandwidth_mbps,
+    1000,
+    "With --estimate, the bandwidth between the parties used to project the time");
+DEFINE_double(
+    estimate_rtt_ms,
+    1,
+    "With --estimate, the round trip time between the parties used to project the time");
 DEFINE_bool(
     use_tls,
     false,
@@ -153,15 +261,167 @@ int main(int argc, char** argv) {
                << "Calculating:" << "\n"
                << "\taverage: " << FLAGS_average << "\n"
                << "\tvariance: " << FLAGS_variance << "\n"
-               << "\thistogram: " << FLAGS_histogram << "\n";
+               << "\thistogram: " << FLAGS_histogram << "\n"
+               << "\tmin/max: " << FLAGS_min_max << "\n"
+               << "\tcovariance: " << FLAGS_covariance << "\n"
+               << "\tpercentiles: " << FLAGS_percentiles << "\n"
+               << "\tvalidation: " << FLAGS_validation_spec
+               << (FLAGS_oblivious_validation ? " (oblivious)" : "") << "\n"
+               << "\tgroup by: " << FLAGS_group_by << " (" << FLAGS_group_value
+               << ")\n"
+               << "\tjoin on id: " << FLAGS_join_on_id << "\n"
+               << "\tsample rate: " << FLAGS_sample_rate << " (seed "
+               << FLAGS_sample_seed << ")\n";
   }
 
   FLAGS_party--; // subtract 1 because we use 0 and 1 for publisher and partner
                  // instead of 1 and 2
   fbpcf::demographic_metrics::SchedulerStatistics schedulerStatistics;
 
+  fbpcf::demographic_metrics::AppOptions options;
+  if (!FLAGS_trace_output_path.empty()) {
+    options.traceRecorder =
+        std::make_shared<fbpcf::demographic_metrics::TraceRecorder>(
+            FLAGS_party);
+  }
+  options.tupleDirectory = FLAGS_tuple_directory;
+  CHECK(FLAGS_state_directory.empty() || !FLAGS_summary_output_path.empty())
+      << "--state_directory requires --summary_output_path";
+  options.stateDirectory = FLAGS_state_directory;
+  options.summaryOutputPath = FLAGS_summary_output_path;
+  options.pinThreads = FLAGS_pin_threads;
+  options.readahead.chunkSize = size_t(FLAGS_readahead_chunk_mb) << 20;
+  options.readahead.connections = FLAGS_readahead_connections;
+  options.prefetchNextShard = FLAGS_prefetch_next_shard;
+  if (!FLAGS_checkpoint_directory.empty()) {
+    if (!FLAGS_summary_output_path.empty()) {
+      XLOG(WARNING) << "--checkpoint_directory is ignored with "
+                    << "--summary_output_path, use --state_directory";
+    } else {
+      std::filesystem::create_directories(FLAGS_checkpoint_directory);
+      options.checkpointManifest =
+          std::make_shared<fbpcf::demographic_metrics::CheckpointManifest>(
+              fbpcf::demographic_metrics::getCheckpointManifestPath(
+                  FLAGS_checkpoint_directory, FLAGS_party));
+    }
+  }
+
+  if (FLAGS_precompute_tuples > 0) {
+    CHECK(!FLAGS_tuple_directory.empty())
+        << "--precompute_tuples requires --tuple_directory";
+    auto numThreads = std::min((int)inputFilepaths.size(), (int)concurrency);
+    XLOG(INFO) << "Precomputing " << FLAGS_precompute_tuples
+               << " tuples for each of " << numThreads << " threads...";
+    if (FLAGS_party == 0) {
+      fbpcf::demographic_metrics::precomputeTuplesForThreads<0>(
+          numThreads,
+          FLAGS_server_ip,
+          FLAGS_port,
+          tlsInfo,
+          FLAGS_tuple_directory,
+          FLAGS_precompute_tuples);
+    } else {
+      fbpcf::demographic_metrics::precomputeTuplesForThreads<1>(
+          numThreads,
+          FLAGS_server_ip,
+          FLAGS_port,
+          tlsInfo,
+          FLAGS_tuple_directory,
+          FLAGS_precompute_tuples);
+    }
+    return 0;
+  }
+
+  fbpcf::demographic_metrics::MetricsSelection metrics;
+  metrics.average = FLAGS_average;
+  metrics.variance = FLAGS_variance;
+  metrics.histogram = FLAGS_histogram;
+  metrics.minMax = FLAGS_min_max;
+  metrics.covariance = FLAGS_covariance;
+  if (!FLAGS_percentiles.empty()) {
+    std::vector<std::string> quantiles;
+    folly::split(',', FLAGS_percentiles, quantiles);
+    for (const auto& quantile : quantiles) {
+      metrics.percentiles.push_back(std::stod(quantile));
+    }
+  }
+  metrics.validationSpec =
+      fbpcf::demographic_metrics::ValidationSpec::parse(
+          FLAGS_validation_spec, FLAGS_oblivious_validation);
+  metrics.groupBy = fbpcf::demographic_metrics::GroupBySpec::parse(
+      FLAGS_group_by, FLAGS_group_value);
+  metrics.joinOnId = FLAGS_join_on_id;
+  metrics.sampleRate = FLAGS_sample_rate;
+  metrics.sampleSeed = FLAGS_sample_seed;
+  metrics.confidence = FLAGS_confidence;
+  CHECK(FLAGS_sample_rate > 0 && FLAGS_sample_rate <= 1)
+      << "--sample_rate has to be in (0, 1]";
+  CHECK(FLAGS_confidence > 0 && FLAGS_confidence < 1)
+      << "--confidence has to be in (0, 1)";
+  // the intervals need the count of valid rows, and stored states are exact
+  CHECK(!metrics.sampled() ||
+        (!FLAGS_oblivious_validation && FLAGS_state_directory.empty()))
+      << "--sample_rate doesn't support --oblivious_validation and "
+      << "--state_directory";
+  // the other metrics can't exclude rows whose validity is secret
+  CHECK(!FLAGS_oblivious_validation ||
+        !(metrics.minMax || metrics.covariance || !metrics.percentiles.empty()))
+      << "--oblivious_validation doesn't support --min_max, --covariance and "
+      << "--percentiles";
+  // only sums can be merged from secret shares of different shards
+  if (!FLAGS_summary_output_path.empty() &&
+      (metrics.minMax || metrics.covariance || !metrics.percentiles.empty())) {
+    XLOG(WARNING) << "--min_max, --covariance and --percentiles are ignored "
+                  << "with --summary_output_path";
+  }
+
+  if (FLAGS_estimate) {
+    XLOG(INFO) << "Estimating the costs of the job...";
+    if (FLAGS_party == 0) {
+      fbpcf::demographic_metrics::estimateJobCosts<0>(
+          inputFilepaths,
+          concurrency,
+          FLAGS_server_ip,
+          FLAGS_port,
+          tlsInfo,
+          metrics,
+          FLAGS_estimate_rows,
+          FLAGS_estimate_bandwidth_mbps,
+          FLAGS_estimate_rtt_ms);
+    } else {
+      fbpcf::demographic_metrics::estimateJobCosts<1>(
+          inputFilepaths,
+          concurrency,
+          FLAGS_server_ip,
+          FLAGS_port,
+          tlsInfo,
+          metrics,
+          FLAGS_estimate_rows,
+          FLAGS_estimate_bandwidth_mbps,
+          FLAGS_estimate_rtt_ms);
+    }
+    return 0;
+  }
+
   XLOG(INFO) << "Start Demographic Metrics...";
-  if (FLAGS_party == 0) {
+  if (!FLAGS_daemon_spool_directory.empty()) {
+    XLOG(INFO) << "Starting daemon for party " << FLAGS_party;
+    schedulerStatistics = FLAGS_party == 0
+        ? fbpcf::demographic_metrics::runDaemon<0>(
+              FLAGS_daemon_spool_directory,
+              FLAGS_daemon_poll_interval_ms,
+              FLAGS_server_ip,
+              FLAGS_port,
+              tlsInfo,
+              options)
+        : fbpcf::demographic_metrics::runDaemon<1>(
+              FLAGS_daemon_spool_directory,
+              FLAGS_daemon_poll_interval_ms,
+              FLAGS_server_ip,
+              FLAGS_port,
+              tlsInfo,
+              options);
+  } else if (FLAGS_party == 0) {
     XLOG(INFO)
         << "Starting as Alice, will wait for Bob...";
     schedulerStatistics =
@@ -173,9 +433,8 @@ int main(int argc, char** argv) {
             FLAGS_server_ip,
             FLAGS_port,
             tlsInfo,
-            FLAGS_average,
-            FLAGS_variance,
-            FLAGS_histogram);
+            metrics,
+            options);
   } else if (FLAGS_party == 1) {
     XLOG(INFO)
         << "Starting as Bob, will wait for Alice...";
@@ -188,13 +447,17 @@ int main(int argc, char** argv) {
             FLAGS_server_ip,
             FLAGS_port,
             tlsInfo,
-            FLAGS_average,
-            FLAGS_variance,
-            FLAGS_histogram);
+            metrics,
+            options);
   } else {
     XLOGF(FATAL, "Invalid Party: {}", FLAGS_party);
   }
 
+  if (options.traceRecorder) {
+    XLOG(INFO) << "Writing trace to " << FLAGS_trace_output_path;
+    options.traceRecorder->writeToFile(FLAGS_trace_output_path);
+  }
+
   XLOGF(
       INFO,
       "Non-free gate count = {}, Free gate count = {}",
@@ -0,0 +1,110 @@
+#include "../CheckpointManifest.h"
+#include "../ReadaheadReader.h"
+#include <gtest/gtest.h>
+#include <unistd.h>
+#include <filesystem>
+#include <fstream>
+#include <string>
+
+namespace fbpcf::demographic_metrics {
+
+class CheckpointManifestTest : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    directory_ = std::filesystem::temp_directory_path() /
+        ("checkpoint_manifest_test_" + std::to_string(::getpid()));
+    std::filesystem::create_directories(directory_);
+    manifestPath_ = getCheckpointManifestPath(directory_, 0);
+    inputPath_ = directory_ / "in_0.csv";
+    outputPath_ = directory_ / "out_0.csv";
+    writeFile(inputPath_, "id_,age\n1,20\n");
+    writeFile(outputPath_, kOutput);
+  }
+
+  void TearDown() override {
+    std::filesystem::remove_all(directory_);
+  }
+
+  void writeFile(const std::string& path, const std::string& content) {
+    std::ofstream(path, std::ios::trunc) << content;
+  }
+
+  static constexpr const char* kOutput = "{\"average\":20}";
+  static constexpr const char* kMetrics = "average";
+
+  std::filesystem::path directory_;
+  std::string manifestPath_;
+  std::string inputPath_;
+  std::string outputPath_;
+};
+
+TEST_F(CheckpointManifestTest, testRecordedShardIsCompleted) {
+  auto fingerprint = getInputFingerprint(inputPath_);
+  CheckpointManifest manifest(manifestPath_);
+  EXPECT_FALSE(
+      manifest.isCompleted(inputPath_, fingerprint, outputPath_, kMetrics));
+
+  manifest.recordCompleted(
+      inputPath_, fingerprint, outputPath_, kMetrics, kOutput);
+  EXPECT_TRUE(
+      manifest.isCompleted(inputPath_, fingerprint, outputPath_, kMetrics));
+
+  // a restarted job loads it from disk
+  CheckpointManifest reloaded(manifestPath_);
+  EXPECT_TRUE(
+      reloaded.isCompleted(inputPath_, fingerprint, outputPath_, kMetrics));
+}
+
+TEST_F(CheckpointManifestTest, testChangesInvalidateTheShard) {
+  auto fingerprint = getInputFingerprint(inputPath_);
+  CheckpointManifest manifest(manifestPath_);
+  manifest.recordCompleted(
+      inputPath_, fingerprint, outputPath_, kMetrics, kOutput);
+
+  EXPECT_FALSE(
+      manifest.isCompleted(inputPath_, fingerprint, outputPath_, "variance"));
+  EXPECT_FALSE(manifest.isCompleted(
+      inputPath_, fingerprint, directory_ / "other.csv", kMetrics));
+  EXPECT_FALSE(manifest.isCompleted(
+      directory_ / "in_1.csv", fingerprint, outputPath_, kMetrics));
+  // without a fingerprint the input can't be told apart from a rewrite
+  EXPECT_FALSE(manifest.isCompleted(inputPath_, "", outputPath_, kMetrics));
+
+  writeFile(outputPath_, "{\"average\":21}");
+  EXPECT_FALSE(
+      manifest.isCompleted(inputPath_, fingerprint, outputPath_, kMetrics));
+  std::filesystem::remove(outputPath_);
+  EXPECT_FALSE(
+      manifest.isCompleted(inputPath_, fingerprint, outputPath_, kMetrics));
+}
+
+TEST_F(CheckpointManifestTest, testRewrittenInputIsRecalculated) {
+  auto fingerprint = getInputFingerprint(inputPath_);
+  CheckpointManifest manifest(manifestPath_);
+  manifest.recordCompleted(
+      inputPath_, fingerprint, outputPath_, kMetrics, kOutput);
+
+  // same size, only the modification time tells them apart
+  writeFile(inputPath_, "id_,age\n1,21\n");
+  std::filesystem::last_write_time(
+      inputPath_,
+      std::filesystem::last_write_time(inputPath_) + std::chrono::seconds(1));
+  auto rewritten = getInputFingerprint(inputPath_);
+  EXPECT_NE(rewritten, fingerprint);
+  EXPECT_FALSE(
+      manifest.isCompleted(inputPath_, rewritten, outputPath_, kMetrics));
+}
+
+TEST_F(CheckpointManifestTest, testEntriesWithoutFingerprintAreRecalculated) {
+  // written before the manifest recorded input fingerprints
+  writeFile(
+      manifestPath_,
+      "{\"" + inputPath_ + "\":{\"output\":\"" + outputPath_ +
+          "\",\"hash\":\"" + CheckpointManifest::hashOutput(kOutput) +
+          "\",\"metrics\":\"" + kMetrics + "\"}}");
+  CheckpointManifest manifest(manifestPath_);
+  EXPECT_FALSE(manifest.isCompleted(
+      inputPath_, getInputFingerprint(inputPath_), outputPath_, kMetrics));
+}
+
+} // namespace fbpcf::demographic_metrics
@@ -0,0 +1,77 @@
+#include "../ClockSync.h"
+#include <gtest/gtest.h>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <future>
+#include <utility>
+#include <vector>
+
+#include "fbpcf/engine/communication/test/AgentFactoryCreationHelper.h"
+
+namespace fbpcf::demographic_metrics {
+
+// Runs measureClockOffset for both parties, each on a thread of its own
+std::pair<ClockOffset, ClockOffset> measureBoth(int rounds) {
+  auto factories = fbpcf::engine::communication::getInMemoryAgentFactory(2);
+  auto aliceAgent = factories[0]->create(1, "clock_sync");
+  auto bobAgent = factories[1]->create(0, "clock_sync");
+  auto bobOffset = std::async(std::launch::async, [&]() {
+    return measureClockOffset(*bobAgent, 1, rounds);
+  });
+  auto aliceOffset = measureClockOffset(*aliceAgent, 0, rounds);
+  return {aliceOffset, bobOffset.get()};
+}
+
+TEST(ClockSyncTest, testSameClock) {
+  auto [aliceOffset, bobOffset] = measureBoth(8);
+  // alice's clock is the reference
+  EXPECT_EQ(aliceOffset.offsetUs, 0);
+  EXPECT_EQ(aliceOffset.roundTripUs, 0);
+
+  // both parties read the same clock: alice's answer lies within the round
+  // trip, so the offset from its midpoint is at most half of it
+  EXPECT_GE(bobOffset.roundTripUs, 0);
+  EXPECT_LE(std::abs(bobOffset.offsetUs), bobOffset.roundTripUs / 2 + 1);
+}
+
+TEST(ClockSyncTest, testSkewedClock) {
+  const int64_t skewUs = 5000000;
+  const int rounds = 4;
+  auto factories = fbpcf::engine::communication::getInMemoryAgentFactory(2);
+  auto aliceAgent = factories[0]->create(1, "clock_sync");
+  auto bobAgent = factories[1]->create(0, "clock_sync");
+
+  // alice's side by hand, with her clock 5 seconds ahead
+  auto alice = std::async(std::launch::async, [&]() {
+    std::vector<unsigned char> message(sizeof(int64_t));
+    for (int i = 0; i < rounds; ++i) {
+      aliceAgent->receive(message.size());
+      auto nowUs = wallClockUs() + skewUs;
+      std::memcpy(message.data(), &nowUs, sizeof(nowUs));
+      aliceAgent->send(message);
+    }
+  });
+  auto bobOffset = measureClockOffset(*bobAgent, 1, rounds);
+  alice.get();
+
+  EXPECT_LE(
+      std::abs(bobOffset.offsetUs - skewUs), bobOffset.roundTripUs / 2 + 1);
+}
+
+TEST(ClockSyncTest, testAgentStaysInSync) {
+  auto factories = fbpcf::engine::communication::getInMemoryAgentFactory(2);
+  auto aliceAgent = factories[0]->create(1, "clock_sync");
+  auto bobAgent = factories[1]->create(0, "clock_sync");
+  auto bob = std::async(std::launch::async, [&]() {
+    measureClockOffset(*bobAgent, 1, 3);
+    return bobAgent->receive(1);
+  });
+  measureClockOffset(*aliceAgent, 0, 3);
+
+  // every ping was answered, the next message is the one sent after
+  aliceAgent->send(std::vector<unsigned char>{42});
+  EXPECT_EQ(bob.get(), std::vector<unsigned char>{42});
+}
+
+} // namespace fbpcf::demographic_metrics
@@ -0,0 +1,120 @@
+#include "../CpuAffinity.h"
+#include <gtest/gtest.h>
+#include <unistd.h>
+#include <filesystem>
+#include <fstream>
+#include <set>
+#include <string>
+#include <vector>
+
+namespace fbpcf::demographic_metrics {
+
+class CpuAffinityTest : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    root_ = std::filesystem::temp_directory_path() /
+        ("cpu_affinity_test_" + std::to_string(::getpid()));
+  }
+
+  void TearDown() override {
+    std::filesystem::remove_all(root_);
+  }
+
+  // A cpu the way sysfs describes it: topology files and a nodeN entry
+  void addCpu(int cpu, int package, int core, int node) {
+    auto cpuDirectory = root_ + "/cpu" + std::to_string(cpu);
+    std::filesystem::create_directories(cpuDirectory + "/topology");
+    std::filesystem::create_directories(
+        cpuDirectory + "/node" + std::to_string(node));
+    std::ofstream(cpuDirectory + "/topology/physical_package_id")
+        << package << "\n";
+    std::ofstream(cpuDirectory + "/topology/core_id") << core << "\n";
+  }
+
+  // Two sockets of two cores with two hardware threads each, numbered the
+  // way Linux does: the siblings of cpu 0-3 are cpu 4-7
+  void addTwoSockets() {
+    for (int cpu = 0; cpu < 8; ++cpu) {
+      auto package = (cpu / 2) % 2;
+      addCpu(cpu, package, cpu % 2, package);
+    }
+  }
+
+  static std::vector<int> cpusOf(const std::vector<CpuPlacement>& order) {
+    std::vector<int> cpus;
+    for (const auto& placement : order) {
+      cpus.push_back(placement.cpu);
+    }
+    return cpus;
+  }
+
+  std::string root_;
+};
+
+TEST_F(CpuAffinityTest, testCompactOrder) {
+  addTwoSockets();
+  auto order = getCompactCpuOrder({0, 1, 2, 3, 4, 5, 6, 7}, root_);
+  // node by node, the first thread of every core before the siblings
+  EXPECT_EQ(cpusOf(order), std::vector<int>({0, 1, 4, 5, 2, 3, 6, 7}));
+
+  std::vector<int> nodes;
+  std::vector<int> siblings;
+  for (const auto& placement : order) {
+    nodes.push_back(placement.node);
+    siblings.push_back(placement.sibling);
+  }
+  EXPECT_EQ(nodes, std::vector<int>({0, 0, 0, 0, 1, 1, 1, 1}));
+  EXPECT_EQ(siblings, std::vector<int>({0, 0, 1, 1, 0, 0, 1, 1}));
+  // the same core id on both sockets are different cores
+  EXPECT_NE(order[0].core, order[4].core);
+}
+
+TEST_F(CpuAffinityTest, testOnlyAllowedCpus) {
+  addTwoSockets();
+  // cpu 5 is the sibling of cpu 1, while 6 and 7 are the first allowed
+  // threads of their cores
+  auto order = getCompactCpuOrder({1, 5, 6, 7}, root_);
+  EXPECT_EQ(cpusOf(order), std::vector<int>({1, 5, 6, 7}));
+  EXPECT_EQ(order[1].sibling, 1);
+  EXPECT_EQ(order[2].sibling, 0);
+  EXPECT_EQ(order[3].sibling, 0);
+}
+
+TEST_F(CpuAffinityTest, testMissingTopology) {
+  // without sysfs every cpu is a core of its own on node 0
+  auto order = getCompactCpuOrder({3, 1, 2}, root_);
+  EXPECT_EQ(cpusOf(order), std::vector<int>({1, 2, 3}));
+  for (const auto& placement : order) {
+    EXPECT_EQ(placement.node, 0);
+    EXPECT_EQ(placement.core, placement.cpu);
+    EXPECT_EQ(placement.sibling, 0);
+  }
+}
+
+TEST_F(CpuAffinityTest, testMalformedTopologyFiles) {
+  addCpu(0, 0, 0, 0);
+  std::ofstream(root_ + "/cpu0/topology/core_id") << "not a number";
+  // a nodeN entry needs a number
+  std::filesystem::remove(root_ + "/cpu0/node0");
+  std::filesystem::create_directories(root_ + "/cpu0/nodex");
+  auto order = getCompactCpuOrder({0}, root_);
+  ASSERT_EQ(order.size(), 1);
+  EXPECT_EQ(order[0].core, 0);
+  EXPECT_EQ(order[0].node, 0);
+}
+
+TEST_F(CpuAffinityTest, testProcessOrderCoversTheAllowedCpus) {
+  cpu_set_t allowed;
+  CPU_ZERO(&allowed);
+  ASSERT_EQ(sched_getaffinity(0, sizeof(allowed), &allowed), 0);
+
+  auto cpus = cpusOf(getCompactCpuOrder());
+  EXPECT_EQ(cpus.size(), CPU_COUNT(&allowed));
+  std::set<int> unique(cpus.begin(), cpus.end());
+  EXPECT_EQ(unique.size(), cpus.size());
+  for (auto cpu : cpus) {
+    EXPECT_TRUE(CPU_ISSET(cpu, &allowed)) << cpu;
+  }
+}
+
+} // namespace fbpcf::demographic_metrics
@@ -0,0 +1,178 @@
+#include "../DecompressingReader.h"
+#include <gtest/gtest.h>
+#include <zlib.h>
+#include <zstd.h>
+#include <algorithm>
+#include <memory>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+namespace fbpcf::demographic_metrics {
+
+// Hands out the compressed bytes at most readSize at a time, like a file
+// read in small pieces
+class StringReader final : public fbpcf::io::IReaderCloser {
+ public:
+  StringReader(std::string content, size_t readSize)
+      : content_(std::move(content)), readSize_(readSize) {}
+
+  size_t read(std::vector<char>& buf) override {
+    auto count = std::min({buf.size(), readSize_, content_.size() - pos_});
+    std::copy_n(content_.data() + pos_, count, buf.data());
+    pos_ += count;
+    return count;
+  }
+
+  bool eof() override {
+    return pos_ == content_.size();
+  }
+
+  int close() override {
+    return 0;
+  }
+
+ private:
+  std::string content_;
+  size_t readSize_;
+  size_t pos_ = 0;
+};
+
+std::string gzip(const std::string& data) {
+  z_stream stream{};
+  // 15 + 16: largest window with a gzip header
+  EXPECT_EQ(
+      deflateInit2(&stream, 6, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY),
+      Z_OK);
+  std::string out(deflateBound(&stream, data.size()), '\0');
+  stream.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(data.data()));
+  stream.avail_in = data.size();
+  stream.next_out = reinterpret_cast<Bytef*>(out.data());
+  stream.avail_out = out.size();
+  EXPECT_EQ(deflate(&stream, Z_FINISH), Z_STREAM_END);
+  out.resize(stream.total_out);
+  deflateEnd(&stream);
+  return out;
+}
+
+std::string zstd(const std::string& data) {
+  std::string out(ZSTD_compressBound(data.size()), '\0');
+  auto size = ZSTD_compress(out.data(), out.size(), data.data(), data.size(), 3);
+  EXPECT_FALSE(ZSTD_isError(size));
+  out.resize(size);
+  return out;
+}
+
+std::string compress(const std::string& data, Compression compression) {
+  return compression == Compression::Gzip ? gzip(data) : zstd(data);
+}
+
+// csv like rows, compressible but not trivially
+std::string randomRows(size_t numRows, unsigned seed) {
+  std::mt19937 e(seed);
+  std::string rows;
+  for (size_t i = 0; i < numRows; ++i) {
+    rows += std::to_string(i) + "," + std::to_string(e() % 200) + "," +
+        std::to_string(e()) + "\n";
+  }
+  return rows;
+}
+
+std::string decompress(
+    const std::string& compressed,
+    Compression compression,
+    size_t readSize,
+    size_t bufferSize = 4096) {
+  DecompressingReader reader(
+      std::make_unique<StringReader>(compressed, readSize), compression);
+  std::string content;
+  std::vector<char> buf(bufferSize);
+  while (!reader.eof()) {
+    auto count = reader.read(buf);
+    content.append(buf.data(), count);
+  }
+  reader.close();
+  return content;
+}
+
+class DecompressingReaderTest : public ::testing::TestWithParam<Compression> {};
+
+TEST_P(DecompressingReaderTest, testSingleMember) {
+  // above the 1MB blocks of the reader
+  auto data = randomRows(100000, 1);
+  auto compressed = compress(data, GetParam());
+  for (size_t readSize : {1 << 20, 4096, 7}) {
+    EXPECT_EQ(decompress(compressed, GetParam(), readSize), data)
+        << "read size " << readSize;
+  }
+}
+
+TEST_P(DecompressingReaderTest, testMultipleMembers) {
+  // e.g. pigz output, or shards concatenated with cat
+  std::string data;
+  std::string compressed;
+  for (unsigned i = 0; i < 5; ++i) {
+    auto part = randomRows(1000 * i, i);
+    data += part;
+    compressed += compress(part, GetParam());
+  }
+  for (size_t readSize : {1 << 20, 333, 1}) {
+    EXPECT_EQ(decompress(compressed, GetParam(), readSize, 1000), data)
+        << "read size " << readSize;
+  }
+}
+
+TEST_P(DecompressingReaderTest, testTruncatedInputThrows) {
+  auto data = randomRows(20000, 2);
+  auto compressed = compress(data, GetParam());
+  for (auto size : {compressed.size() / 2, compressed.size() - 1}) {
+    EXPECT_THROW(
+        decompress(compressed.substr(0, size), GetParam(), 4096),
+        std::runtime_error)
+        << "truncated to " << size;
+  }
+
+  // a complete member followed by a truncated one
+  auto twoMembers = compressed + compressed.substr(0, compressed.size() / 2);
+  EXPECT_THROW(
+      decompress(twoMembers, GetParam(), 4096), std::runtime_error);
+}
+
+TEST_P(DecompressingReaderTest, testCorruptInputThrows) {
+  EXPECT_THROW(
+      decompress(std::string(100, 'x'), GetParam(), 4096), std::runtime_error);
+}
+
+TEST_P(DecompressingReaderTest, testEmptyInput) {
+  EXPECT_EQ(decompress("", GetParam(), 4096), "");
+  EXPECT_EQ(decompress(compress("", GetParam()), GetParam(), 4096), "");
+}
+
+TEST_P(DecompressingReaderTest, testCloseBeforeEnd) {
+  auto data = randomRows(500000, 3);
+  DecompressingReader reader(
+      std::make_unique<StringReader>(compress(data, GetParam()), 4096),
+      GetParam());
+  std::vector<char> buf(100);
+  EXPECT_EQ(reader.read(buf), 100);
+  EXPECT_EQ(std::string(buf.begin(), buf.end()), data.substr(0, 100));
+  EXPECT_EQ(reader.close(), 0);
+}
+
+INSTANTIATE_TEST_SUITE_P(
+    DecompressingReaderTest,
+    DecompressingReaderTest,
+    ::testing::Values(Compression::Gzip, Compression::Zstd),
+    [](const ::testing::TestParamInfo<Compression>& info) {
+      return info.param == Compression::Gzip ? "Gzip" : "Zstd";
+    });
+
+TEST(GetCompressionTest, testGetCompression) {
+  EXPECT_EQ(getCompression("/data/in_0.csv.gz"), Compression::Gzip);
+  EXPECT_EQ(getCompression("https://b.s3.r.amazonaws.com/in.zst"), Compression::Zstd);
+  EXPECT_EQ(getCompression("/data/in_0.csv"), Compression::None);
+  EXPECT_EQ(getCompression("gz"), Compression::None);
+}
+
+} // namespace fbpcf::demographic_metrics
@@ -0,0 +1,119 @@
+#include "../JobSpool.h"
+#include <gtest/gtest.h>
+#include <unistd.h>
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include <vector>
+
+namespace fbpcf::demographic_metrics {
+
+class JobSpoolTest : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    spoolDirectory_ = std::filesystem::temp_directory_path() /
+        ("job_spool_test_" + std::to_string(::getpid()));
+    std::filesystem::create_directories(spoolDirectory_);
+  }
+
+  void TearDown() override {
+    std::filesystem::remove_all(spoolDirectory_);
+  }
+
+  std::filesystem::path writeJob(
+      const std::string& name,
+      const std::string& content) {
+    auto path = spoolDirectory_ / (name + ".job");
+    std::ofstream(path) << content;
+    return path;
+  }
+
+  std::filesystem::path spoolDirectory_;
+};
+
+TEST_F(JobSpoolTest, testParseJob) {
+  auto job = parseDaemonJob(writeJob(
+      "job_1",
+      "# comment\n"
+      "input=/data/in_0.csv,/data/in_1.csv\n"
+      "output=/data/out_0.csv,/data/out_1.csv\n"
+      "metrics=variance,histogram\n"
+      "percentiles=0.5,0.9\n"
+      "validation=age=..120,gender=0|1\n"
+      "group_by=region:16\n"
+      "group_value=wealth\n"
+      "sample_rate=0.5\n"
+      "sample_seed=7\n"));
+
+  EXPECT_EQ(job.name, "job_1");
+  EXPECT_EQ(job.inputPaths.size(), 2);
+  EXPECT_EQ(job.outputPaths.at(1), "/data/out_1.csv");
+  EXPECT_FALSE(job.metrics.average);
+  EXPECT_TRUE(job.metrics.variance);
+  EXPECT_TRUE(job.metrics.histogram);
+  EXPECT_EQ(job.metrics.percentiles, std::vector<double>({0.5, 0.9}));
+  EXPECT_EQ(job.metrics.groupBy.column, "region");
+  EXPECT_EQ(job.metrics.groupBy.numCategories, 16);
+  EXPECT_EQ(job.metrics.groupBy.valueColumn, "wealth");
+  EXPECT_DOUBLE_EQ(job.metrics.sampleRate, 0.5);
+  EXPECT_EQ(job.metrics.sampleSeed, 7);
+  EXPECT_FALSE(job.shutdown);
+}
+
+TEST_F(JobSpoolTest, testDefaultsToAverage) {
+  auto job = parseDaemonJob(writeJob("job", "input=a\noutput=b\n"));
+  EXPECT_TRUE(job.metrics.average);
+  EXPECT_FALSE(job.metrics.sampled());
+}
+
+TEST_F(JobSpoolTest, testShutdownNeedsNoFiles) {
+  EXPECT_TRUE(parseDaemonJob(writeJob("stop", "shutdown=true\n")).shutdown);
+}
+
+TEST_F(JobSpoolTest, testMalformedJobs) {
+  EXPECT_THROW(
+      parseDaemonJob(writeJob("no_separator", "input\n")),
+      std::invalid_argument);
+  EXPECT_THROW(
+      parseDaemonJob(writeJob("unknown_metric", "metrics=median\n")),
+      std::invalid_argument);
+  EXPECT_THROW(
+      parseDaemonJob(writeJob("unequal_files", "input=a,b\noutput=c\n")),
+      std::invalid_argument);
+  EXPECT_THROW(
+      parseDaemonJob(writeJob(
+          "oblivious_minmax",
+          "input=a\noutput=b\nmetrics=minmax\noblivious_validation=true\n")),
+      std::invalid_argument);
+  EXPECT_THROW(
+      parseDaemonJob(writeJob("sample_rate", "input=a\noutput=b\nsample_rate=0\n")),
+      std::invalid_argument);
+  EXPECT_THROW(
+      parseDaemonJob(writeJob("percentile", "input=a\noutput=b\npercentiles=x\n")),
+      std::invalid_argument);
+}
+
+TEST_F(JobSpoolTest, testJobsOfDifferentMetricsDiffer) {
+  auto average = parseDaemonJob(writeJob("job", "input=a\noutput=b\n"));
+  auto variance =
+      parseDaemonJob(writeJob("job", "input=a\noutput=b\nmetrics=variance\n"));
+  auto otherFiles = parseDaemonJob(writeJob("job", "input=c\noutput=d\n"));
+
+  EXPECT_NE(average.toString(), variance.toString());
+  // only the number of files has to match, each party has its own paths
+  EXPECT_EQ(average.toString(), otherFiles.toString());
+}
+
+TEST_F(JobSpoolTest, testJobsAreTakenInNameOrder) {
+  EXPECT_FALSE(getNextDaemonJob(spoolDirectory_).has_value());
+
+  auto second = writeJob("job_2", "shutdown=true\n");
+  auto first = writeJob("job_1", "shutdown=true\n");
+  EXPECT_EQ(getNextDaemonJob(spoolDirectory_), first);
+
+  finishDaemonJob(first, ".rejected");
+  EXPECT_TRUE(std::filesystem::exists(spoolDirectory_ / "job_1.rejected"));
+  EXPECT_EQ(getNextDaemonJob(spoolDirectory_), second);
+}
+
+} // namespace fbpcf::demographic_metrics
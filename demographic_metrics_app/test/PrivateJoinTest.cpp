@@ -0,0 +1,96 @@
+#include "../PrivateJoin.h"
+#include <gtest/gtest.h>
+#include <future>
+#include <memory>
+#include <set>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "fbpcf/engine/communication/test/AgentFactoryCreationHelper.h"
+
+namespace fbpcf::demographic_metrics {
+
+// Joins alice's and bob's ids, each party on a thread of its own
+std::pair<std::vector<size_t>, std::vector<size_t>> joinIds(
+    const std::vector<std::string>& aliceIds,
+    const std::vector<std::string>& bobIds,
+    size_t numThreads = 1) {
+  auto factories = fbpcf::engine::communication::getInMemoryAgentFactory(2);
+  auto aliceAgent = factories[0]->create(1, "private_join");
+  auto bobAgent = factories[1]->create(0, "private_join");
+  auto bobRows = std::async(std::launch::async, [&]() {
+    return privateJoin(*bobAgent, 1, bobIds, numThreads);
+  });
+  auto aliceRows = privateJoin(*aliceAgent, 0, aliceIds, numThreads);
+  return {aliceRows, bobRows.get()};
+}
+
+void expectAligned(
+    const std::vector<std::string>& aliceIds,
+    const std::vector<std::string>& bobIds,
+    const std::vector<size_t>& aliceRows,
+    const std::vector<size_t>& bobRows) {
+  ASSERT_EQ(aliceRows.size(), bobRows.size());
+  for (size_t i = 0; i < aliceRows.size(); ++i) {
+    EXPECT_EQ(aliceIds.at(aliceRows[i]), bobIds.at(bobRows[i])) << "row " << i;
+  }
+}
+
+std::vector<std::string> makeIds(size_t begin, size_t end, size_t step = 1) {
+  std::vector<std::string> ids;
+  for (auto i = begin; i < end; i += step) {
+    ids.push_back("id" + std::to_string(i));
+  }
+  return ids;
+}
+
+TEST(PrivateJoinTest, testJoinsCommonIds) {
+  // in different orders on the two sides
+  std::vector<std::string> aliceIds = {"a", "b", "c", "d", "e"};
+  std::vector<std::string> bobIds = {"e", "x", "c", "a", "y"};
+  auto [aliceRows, bobRows] = joinIds(aliceIds, bobIds);
+  EXPECT_EQ(aliceRows.size(), 3);
+  expectAligned(aliceIds, bobIds, aliceRows, bobRows);
+
+  std::set<std::string> joined;
+  for (auto row : aliceRows) {
+    joined.insert(aliceIds.at(row));
+  }
+  EXPECT_EQ(joined, std::set<std::string>({"a", "c", "e"}));
+}
+
+TEST(PrivateJoinTest, testDuplicateIdsKeepTheirFirstRow) {
+  std::vector<std::string> aliceIds = {"a", "b", "a", "c", "b"};
+  std::vector<std::string> bobIds = {"b", "b", "c", "c", "c", "d"};
+  auto [aliceRows, bobRows] = joinIds(aliceIds, bobIds);
+  expectAligned(aliceIds, bobIds, aliceRows, bobRows);
+  EXPECT_EQ(std::set<size_t>(aliceRows.begin(), aliceRows.end()), std::set<size_t>({1, 3}));
+  EXPECT_EQ(std::set<size_t>(bobRows.begin(), bobRows.end()), std::set<size_t>({0, 2}));
+}
+
+TEST(PrivateJoinTest, testDisjointIds) {
+  auto aliceIds = makeIds(0, 100);
+  auto bobIds = makeIds(100, 150);
+  auto [aliceRows, bobRows] = joinIds(aliceIds, bobIds);
+  EXPECT_TRUE(aliceRows.empty());
+  EXPECT_TRUE(bobRows.empty());
+}
+
+TEST(PrivateJoinTest, testEmptySide) {
+  auto [aliceRows, bobRows] = joinIds(makeIds(0, 10), {});
+  EXPECT_TRUE(aliceRows.empty());
+  EXPECT_TRUE(bobRows.empty());
+}
+
+TEST(PrivateJoinTest, testBlindingOnSeveralThreads) {
+  // enough keys for every thread to get a share
+  auto aliceIds = makeIds(0, 6000);
+  auto bobIds = makeIds(3000, 9000, 2);
+  bobIds.push_back("id3000");
+  auto [aliceRows, bobRows] = joinIds(aliceIds, bobIds, 4);
+  EXPECT_EQ(aliceRows.size(), 1500);
+  expectAligned(aliceIds, bobIds, aliceRows, bobRows);
+}
+
+} // namespace fbpcf::demographic_metrics
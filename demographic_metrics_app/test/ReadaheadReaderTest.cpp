@@ -0,0 +1,147 @@
+#include "../ReadaheadReader.h"
+#include <gtest/gtest.h>
+#include <unistd.h>
+#include <filesystem>
+#include <fstream>
+#include <memory>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+namespace fbpcf::demographic_metrics {
+
+class ReadaheadReaderTest : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    path_ = std::filesystem::temp_directory_path() /
+        ("readahead_reader_test_" + std::to_string(::getpid()));
+  }
+
+  void TearDown() override {
+    std::filesystem::remove(path_);
+  }
+
+  std::string writeRandomFile(size_t size) {
+    std::mt19937 e(size);
+    std::string content(size, '\0');
+    for (auto& c : content) {
+      c = 'a' + e() % 26;
+    }
+    std::ofstream(path_, std::ios::trunc) << content;
+    return content;
+  }
+
+  // Reads everything with reads of bufferSize bytes
+  static std::string readAll(fbpcf::io::IReaderCloser& reader, size_t bufferSize) {
+    std::string content;
+    std::vector<char> buf(bufferSize);
+    while (!reader.eof()) {
+      auto count = reader.read(buf);
+      content.append(buf.data(), count);
+    }
+    reader.close();
+    return content;
+  }
+
+  std::string path_;
+};
+
+// Fails to read the chunk at failingOffset
+class FailingRangeSource final : public IRangeSource {
+ public:
+  FailingRangeSource(uint64_t size, uint64_t failingOffset)
+      : size_(size), failingOffset_(failingOffset) {}
+
+  uint64_t size() override {
+    return size_;
+  }
+
+  std::string fingerprint() override {
+    return "";
+  }
+
+  std::string read(uint64_t offset, uint64_t length) override {
+    if (offset == failingOffset_) {
+      throw std::runtime_error("connection reset");
+    }
+    return std::string(std::min(length, size_ - offset), 'x');
+  }
+
+ private:
+  uint64_t size_;
+  uint64_t failingOffset_;
+};
+
+TEST_F(ReadaheadReaderTest, testReadsLocalFileInOrder) {
+  // chunk sizes that do and don't divide the file, and one above its size
+  for (size_t chunkSize : {1, 7, 64, 1000, 5000}) {
+    for (int connections : {1, 3}) {
+      auto content = writeRandomFile(4096 + 13);
+      ReadaheadOptions options{
+          .chunkSize = chunkSize, .connections = connections, .depth = 2};
+      ReadaheadReader reader(std::make_unique<LocalRangeSource>(path_), options);
+      EXPECT_EQ(readAll(reader, 100), content)
+          << "chunk size " << chunkSize << ", connections " << connections;
+    }
+  }
+}
+
+TEST_F(ReadaheadReaderTest, testBufferLargerThanFile) {
+  auto content = writeRandomFile(300);
+  ReadaheadReader reader(
+      std::make_unique<LocalRangeSource>(path_), ReadaheadOptions{.chunkSize = 64});
+  EXPECT_EQ(readAll(reader, 1 << 16), content);
+}
+
+TEST_F(ReadaheadReaderTest, testEmptyFile) {
+  writeRandomFile(0);
+  ReadaheadReader reader(
+      std::make_unique<LocalRangeSource>(path_), ReadaheadOptions{.chunkSize = 64});
+  EXPECT_TRUE(reader.eof());
+  EXPECT_EQ(readAll(reader, 16), "");
+}
+
+TEST_F(ReadaheadReaderTest, testOpenInputReader) {
+  auto content = writeRandomFile(1000);
+  auto reader = openInputReader(path_, ReadaheadOptions{.chunkSize = 128});
+  EXPECT_NE(dynamic_cast<ReadaheadReader*>(reader.get()), nullptr);
+  EXPECT_EQ(readAll(*reader, 100), content);
+}
+
+TEST_F(ReadaheadReaderTest, testFetchErrorReachesTheParser) {
+  ReadaheadReader reader(
+      std::make_unique<FailingRangeSource>(1000, 512),
+      ReadaheadOptions{.chunkSize = 128, .connections = 2});
+  std::vector<char> buf(100);
+  EXPECT_THROW(
+      {
+        while (!reader.eof()) {
+          reader.read(buf);
+        }
+      },
+      std::runtime_error);
+  reader.close();
+}
+
+TEST_F(ReadaheadReaderTest, testCloseBeforeEndStopsTheFetchers) {
+  writeRandomFile(100000);
+  ReadaheadReader reader(
+      std::make_unique<LocalRangeSource>(path_),
+      ReadaheadOptions{.chunkSize = 10, .connections = 4});
+  std::vector<char> buf(25);
+  EXPECT_EQ(reader.read(buf), 25);
+  EXPECT_EQ(reader.close(), 0);
+}
+
+TEST_F(ReadaheadReaderTest, testMissingFile) {
+  EXPECT_THROW(LocalRangeSource{path_}, std::runtime_error);
+}
+
+TEST(IsS3PathTest, testIsS3Path) {
+  EXPECT_TRUE(isS3Path("https://bucket.s3.us-west-2.amazonaws.com/key.csv"));
+  EXPECT_FALSE(isS3Path("https://storage.cloud.google.com/bucket/key.csv"));
+  EXPECT_FALSE(isS3Path("/data/in_0.csv"));
+}
+
+} // namespace fbpcf::demographic_metrics
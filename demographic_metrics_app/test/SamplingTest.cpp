@@ -0,0 +1,122 @@
+#include "../Sampling.h"
+#include <gtest/gtest.h>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+namespace fbpcf::demographic_metrics {
+
+TEST(SamplingTest, testSampleRowsIsDeterministic) {
+  // both parties call it with the shared seed
+  auto aliceRows = sampleRows(10000, 0.3, 42);
+  auto bobRows = sampleRows(10000, 0.3, 42);
+  EXPECT_EQ(aliceRows, bobRows);
+  EXPECT_NE(sampleRows(10000, 0.3, 43), aliceRows);
+
+  // increasing row indices without duplicates
+  for (size_t i = 1; i < aliceRows.size(); ++i) {
+    EXPECT_LT(aliceRows[i - 1], aliceRows[i]);
+  }
+  EXPECT_LT(aliceRows.back(), 10000);
+}
+
+TEST(SamplingTest, testSampleRowsKeepsTheRequestedRate) {
+  size_t numRows = 100000;
+  for (double rate : {0.01, 0.1, 0.5, 0.9}) {
+    auto rows = sampleRows(numRows, rate, 7);
+    // more than 10 standard deviations of the binomial
+    auto tolerance = 10 * std::sqrt(numRows * rate * (1 - rate));
+    EXPECT_NEAR(rows.size(), numRows * rate, tolerance) << rate;
+  }
+  EXPECT_EQ(sampleRows(numRows, 1, 7).size(), numRows);
+  EXPECT_TRUE(sampleRows(numRows, 0, 7).empty());
+  EXPECT_TRUE(sampleRows(0, 0.5, 7).empty());
+}
+
+TEST(SamplingTest, testZScore) {
+  EXPECT_NEAR(getZScore(0.95), 1.959964, 1e-6);
+  EXPECT_NEAR(getZScore(0.99), 2.575829, 1e-6);
+  EXPECT_NEAR(getZScore(0.6827), 1.0, 1e-3);
+}
+
+TEST(SamplingTest, testCountInterval) {
+  EXPECT_DOUBLE_EQ(scaleCount(100, 0.25), 400);
+  // error z * sqrt(100 * 0.5) / 0.5
+  auto interval = countInterval(100, 0.5, 2);
+  EXPECT_NEAR(interval.low, 200 - 28.284271, 1e-6);
+  EXPECT_NEAR(interval.high, 200 + 28.284271, 1e-6);
+  // not below 0
+  EXPECT_EQ(countInterval(1, 0.01, 2).low, 0);
+  // a full sample has no error
+  interval = countInterval(100, 1, 2);
+  EXPECT_EQ(interval.low, 100);
+  EXPECT_EQ(interval.high, 100);
+}
+
+TEST(SamplingTest, testScaleCounts) {
+  auto [estimates, intervals] =
+      scaleCounts(std::vector<uint64_t>{0, 10, 100}, 0.5, 2);
+  EXPECT_EQ(estimates, std::vector<double>({0, 20, 200}));
+  ASSERT_EQ(intervals.size(), 3);
+  EXPECT_EQ(intervals[0].low, 0);
+  EXPECT_EQ(intervals[0].high, 0);
+  EXPECT_NEAR(intervals[2].high, 228.284271, 1e-6);
+}
+
+TEST(SamplingTest, testMeanInterval) {
+  // error z * sqrt(4 / 100 * 0.5)
+  auto interval = meanInterval(10, 4, 100, 0.5, 2);
+  EXPECT_NEAR(interval.low, 10 - 0.28284271, 1e-6);
+  EXPECT_NEAR(interval.high, 10 + 0.28284271, 1e-6);
+  // no rows, no interval around the mean
+  interval = meanInterval(0, 0, 0, 0.5, 2);
+  EXPECT_EQ(interval.low, 0);
+  EXPECT_EQ(interval.high, 0);
+}
+
+TEST(SamplingTest, testVarianceInterval) {
+  // error z * 4 * sqrt(2 / 50 * 0.5)
+  auto interval = varianceInterval(4, 51, 0.5, 2);
+  EXPECT_NEAR(interval.low, 4 - 1.1313708, 1e-6);
+  EXPECT_NEAR(interval.high, 4 + 1.1313708, 1e-6);
+  // not below 0
+  EXPECT_EQ(varianceInterval(4, 3, 0.1, 3).low, 0);
+  // fewer than two rows: finite, the variance itself
+  for (double count : {0, 1}) {
+    interval = varianceInterval(0, count, 0.5, 2);
+    EXPECT_EQ(interval.low, 0) << count;
+    EXPECT_EQ(interval.high, 0) << count;
+  }
+}
+
+TEST(SamplingTest, testCorrelationInterval) {
+  // error z / sqrt(103 - 3) in the Fisher transform
+  auto interval = correlationInterval(0, 103, 2);
+  EXPECT_NEAR(interval.low, std::tanh(-0.2), 1e-9);
+  EXPECT_NEAR(interval.high, std::tanh(0.2), 1e-9);
+
+  interval = correlationInterval(0.5, 103, 2);
+  EXPECT_NEAR(interval.low, std::tanh(std::atanh(0.5) - 0.2), 1e-9);
+  EXPECT_NEAR(interval.high, std::tanh(std::atanh(0.5) + 0.2), 1e-9);
+
+  // perfect correlation stays finite and within [-1, 1]
+  interval = correlationInterval(1, 2, 2);
+  EXPECT_GE(interval.low, -1);
+  EXPECT_LE(interval.high, 1);
+}
+
+TEST(SamplingTest, testQuantileBounds) {
+  // error z * sqrt(0.5 * 0.5 / 100)
+  auto bounds = quantileBounds(0.5, 100, 2);
+  EXPECT_NEAR(bounds.first, 0.4, 1e-9);
+  EXPECT_NEAR(bounds.second, 0.6, 1e-9);
+  // clamped to [0, 1]
+  bounds = quantileBounds(0.99, 10, 3);
+  EXPECT_EQ(bounds.second, 1);
+  // an empty sample bounds nothing
+  bounds = quantileBounds(0.5, 0, 2);
+  EXPECT_EQ(bounds.first, 0);
+  EXPECT_EQ(bounds.second, 1);
+}
+
+} // namespace fbpcf::demographic_metrics
@@ -0,0 +1,254 @@
+#include "../TupleStore.h"
+#include <gtest/gtest.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <future>
+#include <map>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "fbpcf/engine/communication/test/AgentFactoryCreationHelper.h"
+
+namespace fbpcf::demographic_metrics {
+
+// Stands in for the OT based generator, serves (1, 1, 1) tuples and counts
+// the generators created
+class FakeTupleGenerator final
+    : public fbpcf::engine::tuple_generator::ITupleGenerator {
+ public:
+  std::vector<BooleanTuple> getBooleanTuple(uint32_t size) override {
+    return std::vector<BooleanTuple>(size, BooleanTuple(1, 1, 1));
+  }
+
+  std::map<size_t, std::vector<CompositeBooleanTuple>> getCompositeTuple(
+      const std::map<size_t, uint32_t>& /*tupleSizes*/) override {
+    return {};
+  }
+
+  std::pair<
+      std::vector<BooleanTuple>,
+      std::map<size_t, std::vector<CompositeBooleanTuple>>>
+  getNormalAndCompositeBooleanTuples(
+      uint32_t tupleSize,
+      const std::map<size_t, uint32_t>& tupleSizes) override {
+    return {getBooleanTuple(tupleSize), getCompositeTuple(tupleSizes)};
+  }
+
+  std::pair<uint64_t, uint64_t> getTrafficStatistics() const override {
+    return {0, 0};
+  }
+};
+
+class FakeTupleGeneratorFactory final
+    : public fbpcf::engine::tuple_generator::ITupleGeneratorFactory {
+ public:
+  explicit FakeTupleGeneratorFactory(std::shared_ptr<int> created)
+      : created_(std::move(created)) {}
+
+  std::unique_ptr<fbpcf::engine::tuple_generator::ITupleGenerator> create()
+      override {
+    ++*created_;
+    return std::make_unique<FakeTupleGenerator>();
+  }
+
+ private:
+  std::shared_ptr<int> created_;
+};
+
+// Tuple i of the test stores, never (1, 1, 1)
+BooleanTuple storedTuple(uint64_t i) {
+  return BooleanTuple(i % 2, (i / 2) % 2, 0);
+}
+
+void expectStoredTuples(
+    const std::vector<BooleanTuple>& tuples,
+    uint64_t first,
+    size_t begin = 0,
+    size_t end = SIZE_MAX) {
+  end = std::min(end, tuples.size());
+  for (size_t i = begin; i < end; ++i) {
+    auto expected = storedTuple(first + i - begin);
+    ASSERT_EQ(tuples[i].getA(), expected.getA()) << "tuple " << i;
+    ASSERT_EQ(tuples[i].getB(), expected.getB()) << "tuple " << i;
+    ASSERT_EQ(tuples[i].getC(), expected.getC()) << "tuple " << i;
+  }
+}
+
+void expectFallbackTuples(
+    const std::vector<BooleanTuple>& tuples,
+    size_t begin) {
+  for (size_t i = begin; i < tuples.size(); ++i) {
+    ASSERT_TRUE(tuples[i].getA() && tuples[i].getB() && tuples[i].getC())
+        << "tuple " << i;
+  }
+}
+
+class TupleStoreTest : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    directory_ = std::filesystem::temp_directory_path() /
+        ("tuple_store_test_" + std::to_string(::getpid()));
+    std::filesystem::create_directories(directory_);
+    path_ = getTupleStorePath(directory_, 0, 0);
+    created_ = std::make_shared<int>(0);
+  }
+
+  void TearDown() override {
+    std::filesystem::remove_all(directory_);
+  }
+
+  void writeStore(
+      const std::string& path,
+      uint64_t storeId,
+      uint64_t numTuples) {
+    TupleStoreWriter writer(path, storeId, numTuples);
+    std::vector<BooleanTuple> tuples;
+    for (uint64_t i = 0; i < numTuples; ++i) {
+      tuples.push_back(storedTuple(i));
+    }
+    writer.write(tuples);
+    writer.close();
+  }
+
+  std::unique_ptr<PrecomputedTupleGenerator> openStore() {
+    return std::make_unique<PrecomputedTupleGenerator>(
+        path_, std::make_unique<FakeTupleGeneratorFactory>(created_));
+  }
+
+  // Runs tupleStoresMatch for both parties with their own stores
+  static std::pair<bool, bool> storesMatch(
+      const std::string& alicePath,
+      const std::string& bobPath) {
+    auto factories = fbpcf::engine::communication::getInMemoryAgentFactory(2);
+    auto aliceAgent = factories[0]->create(1, "tuple_store");
+    auto bobAgent = factories[1]->create(0, "tuple_store");
+    auto bobMatch = std::async(std::launch::async, [&]() {
+      return tupleStoresMatch(*bobAgent, 1, bobPath);
+    });
+    auto aliceMatch = tupleStoresMatch(*aliceAgent, 0, alicePath);
+    return {aliceMatch, bobMatch.get()};
+  }
+
+  std::string directory_;
+  std::string path_;
+  std::shared_ptr<int> created_;
+};
+
+TEST_F(TupleStoreTest, testServesStoredTuplesThenFallsBack) {
+  writeStore(path_, 7, 64);
+  auto generator = openStore();
+
+  auto tuples = generator->getBooleanTuple(40);
+  ASSERT_EQ(tuples.size(), 40);
+  expectStoredTuples(tuples, 0);
+  // the whole store fits in one chunk, it is used up on the first read
+  EXPECT_FALSE(std::filesystem::exists(path_));
+  EXPECT_EQ(*created_, 0);
+
+  // past the end of the store
+  tuples = generator->getBooleanTuple(40);
+  ASSERT_EQ(tuples.size(), 40);
+  expectStoredTuples(tuples, 40, 0, 24);
+  expectFallbackTuples(tuples, 24);
+  EXPECT_EQ(generator->getPrecomputedTuplesUsed(), 64);
+  EXPECT_EQ(*created_, 1);
+
+  tuples = generator->getBooleanTuple(8);
+  expectFallbackTuples(tuples, 0);
+  // the fallback generator is only created once
+  EXPECT_EQ(*created_, 1);
+}
+
+TEST_F(TupleStoreTest, testChunksAreConsumedOnDiskBeforeUse) {
+  uint64_t numTuples = kTupleStoreChunkSize + 16;
+  writeStore(path_, 7, numTuples);
+  {
+    auto generator = openStore();
+    auto tuples = generator->getBooleanTuple(8);
+    expectStoredTuples(tuples, 0);
+
+    // the whole first chunk counts as used, not just the 8 tuples
+    auto header = readTupleStoreHeader(path_);
+    ASSERT_TRUE(header.has_value());
+    EXPECT_EQ(header->consumed, kTupleStoreChunkSize);
+    EXPECT_EQ(describeTupleStore(path_), "7:1048576:1048592");
+  }
+
+  // a restart skips the chunk the first run may have used
+  auto generator = openStore();
+  auto tuples = generator->getBooleanTuple(16);
+  expectStoredTuples(tuples, kTupleStoreChunkSize);
+  EXPECT_FALSE(std::filesystem::exists(path_));
+  EXPECT_EQ(describeTupleStore(path_), "");
+  EXPECT_EQ(*created_, 0);
+}
+
+TEST_F(TupleStoreTest, testRejectsInvalidStores) {
+  std::ofstream(path_, std::ios::binary) << "not a tuple store";
+  EXPECT_FALSE(readTupleStoreHeader(path_).has_value());
+  EXPECT_EQ(describeTupleStore(path_), "");
+  EXPECT_THROW(openStore(), std::runtime_error);
+}
+
+TEST_F(TupleStoreTest, testExchangeWithPeer) {
+  auto factories = fbpcf::engine::communication::getInMemoryAgentFactory(2);
+  auto aliceAgent = factories[0]->create(1, "exchange");
+  auto bobAgent = factories[1]->create(0, "exchange");
+  // (alice's message, bob's message), empty messages too
+  std::vector<std::pair<std::string, std::string>> exchanges = {
+      {"alice", "bob"}, {"", "bob"}, {"alice", ""}, {"", ""}};
+  for (const auto& messages : exchanges) {
+    auto fromAlice = std::async(std::launch::async, [&]() {
+      return exchangeWithPeer(*bobAgent, 1, messages.second);
+    });
+    EXPECT_EQ(exchangeWithPeer(*aliceAgent, 0, messages.first), messages.second);
+    EXPECT_EQ(fromAlice.get(), messages.first);
+  }
+}
+
+TEST_F(TupleStoreTest, testStoresMatch) {
+  auto alicePath = getTupleStorePath(directory_, 0, 0);
+  auto bobPath = getTupleStorePath(directory_, 1, 0);
+  writeStore(alicePath, 7, 64);
+  writeStore(bobPath, 7, 64);
+  EXPECT_EQ(storesMatch(alicePath, bobPath), std::make_pair(true, true));
+}
+
+TEST_F(TupleStoreTest, testStoresDontMatch) {
+  auto alicePath = getTupleStorePath(directory_, 0, 0);
+  auto bobPath = getTupleStorePath(directory_, 1, 0);
+
+  // different store ids
+  writeStore(alicePath, 7, 64);
+  writeStore(bobPath, 8, 64);
+  EXPECT_EQ(storesMatch(alicePath, bobPath), std::make_pair(false, false));
+
+  // only one party has a store
+  std::filesystem::remove(bobPath);
+  EXPECT_EQ(storesMatch(alicePath, bobPath), std::make_pair(false, false));
+
+  // neither party has one
+  std::filesystem::remove(alicePath);
+  EXPECT_EQ(storesMatch(alicePath, bobPath), std::make_pair(false, false));
+}
+
+TEST_F(TupleStoreTest, testStoresAtDifferentOffsetsDontMatch) {
+  auto alicePath = getTupleStorePath(directory_, 0, 0);
+  auto bobPath = getTupleStorePath(directory_, 1, 0);
+  uint64_t numTuples = kTupleStoreChunkSize + 16;
+  writeStore(alicePath, 7, numTuples);
+  writeStore(bobPath, 7, numTuples);
+
+  // alice's previous run used a chunk bob's didn't
+  PrecomputedTupleGenerator(
+      alicePath, std::make_unique<FakeTupleGeneratorFactory>(created_))
+      .getBooleanTuple(8);
+  EXPECT_EQ(storesMatch(alicePath, bobPath), std::make_pair(false, false));
+}
+
+} // namespace fbpcf::demographic_metrics